@@ -0,0 +1,251 @@
+#include "AsyncFileWriter.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "async_io.h"
+#include "async_syscall.h"
+#include "debug.cpp"
+#include "timer.h"
+#include "uthread.h"
+
+AsyncFileWriter::AsyncFileWriter(int fd, size_t buffer_size, int num_buffers, long sync_usecs)
+    : fd(fd),
+      buffer_size((buffer_size + WRITER_ALIGNMENT - 1) / WRITER_ALIGNMENT * WRITER_ALIGNMENT),
+      num_buffers(num_buffers < 2 ? 2 : num_buffers),
+      sync_usecs(sync_usecs),
+      memory(nullptr),
+      sizes(new size_t[this->num_buffers]),
+      sealed(0),
+      flushed(0),
+      active_used(0),
+      spilling(false),
+      offset(-1),
+      error(0),
+      closing(false),
+      flusher(-1),
+      lock("AsyncFileWriter"),
+      space_cv("AsyncFileWriter space"),
+      work_cv("AsyncFileWriter work") {
+    if (this->buffer_size == 0) {
+        this->buffer_size = WRITER_ALIGNMENT;
+    }
+    // Appends fail with ENOMEM if the buffers cannot be allocated
+    void *aligned;
+    if (posix_memalign(&aligned, WRITER_ALIGNMENT, this->buffer_size * this->num_buffers) == 0) {
+        memory = (char *) aligned;
+    } else {
+        error = ENOMEM;
+    }
+}
+
+AsyncFileWriter::~AsyncFileWriter() {
+    close();
+    free(memory);
+    delete[] sizes;
+}
+
+// Hand the active buffer to the flusher
+void AsyncFileWriter::_seal() {
+    sizes[sealed % num_buffers] = active_used;
+    sealed++;
+    active_used = 0;
+    work_cv.signal();
+}
+
+// Append len bytes of data
+int AsyncFileWriter::append(const void *data, size_t len) {
+    const char *bytes = (const char *) data;
+    lock.lock();
+    // Start the flusher on the first append
+    if (flusher == -1 && error == 0 && !closing) {
+        // Regular files are written at their end, anything else (pipes,
+        // sockets, devices) at its current position
+        struct stat statbuf;
+        offset = (fstat(fd, &statbuf) == 0 && S_ISREG(statbuf.st_mode) ? statbuf.st_size : -1);
+        flusher = uthread_create(_flush_loop, this);
+        if (flusher == -1) {
+            error = EAGAIN;
+        }
+    }
+    bool owns_spill = false;    // true once part of this append is buffered and the rest waits
+    while (len > 0 && error == 0 && !closing) {
+        // Wait for an append that is split across buffers to finish, so appends
+        // are never interleaved. Checked again after every wait, since another
+        // append may have started spilling meanwhile
+        if (spilling && !owns_spill) {
+            space_cv.wait(lock);
+            continue;
+        }
+        // The active buffer is still waiting to be written from its last lap
+        if (_full()) {
+            if (bytes != data) {
+                spilling = true;
+                owns_spill = true;
+            }
+            space_cv.wait(lock);
+            continue;
+        }
+        size_t n = buffer_size - active_used < len ? buffer_size - active_used : len;
+        memcpy(memory + (sealed % num_buffers) * buffer_size + active_used, bytes, n);
+        active_used += n;
+        bytes += n;
+        len -= n;
+        if (active_used == buffer_size) {
+            _seal();
+        }
+    }
+    if (owns_spill) {
+        spilling = false;
+        space_cv.broadcast();
+    }
+    int ret_val = 0;
+    if (error != 0 || closing) {
+        errno = error != 0 ? error : EBADF;
+        ret_val = -1;
+    }
+    lock.unlock();
+    return ret_val;
+}
+
+// Block until everything appended before the call has been written
+int AsyncFileWriter::flush() {
+    lock.lock();
+    if (active_used > 0) {
+        _seal();
+    }
+    unsigned long target = sealed;
+    while (flushed < target && error == 0) {
+        space_cv.wait(lock);
+    }
+    int ret_val = 0;
+    if (error != 0) {
+        errno = error;
+        ret_val = -1;
+    }
+    lock.unlock();
+    return ret_val;
+}
+
+// flush(), then fdatasync() the file
+int AsyncFileWriter::sync() {
+    if (flush() == -1) {
+        return -1;
+    }
+    int fd = this->fd;
+    return async_syscall([fd]() -> long { return fdatasync(fd); });
+}
+
+// Flush everything and stop the flusher thread
+int AsyncFileWriter::close() {
+    lock.lock();
+    if (closing) {
+        lock.unlock();
+        return 0;
+    }
+    closing = true;
+    if (active_used > 0 && error == 0) {
+        _seal();
+    }
+    work_cv.signal();
+    // Wake appenders waiting for space, they fail
+    space_cv.broadcast();
+    int thread = flusher;
+    lock.unlock();
+    if (thread != -1 && uthread_join(thread, nullptr) != 0) {
+        return -1;
+    }
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+// Write size bytes of buf at offset
+int AsyncFileWriter::_write(const char *buf, size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t nbytes = async_pwrite(fd, buf, size, offset);
+        if (nbytes <= 0) {
+            if (nbytes == 0) {
+                errno = EIO;
+            }
+            return -1;
+        }
+        buf += nbytes;
+        size -= nbytes;
+        if (offset != -1) {
+            offset += nbytes;
+        }
+    }
+    return 0;
+}
+
+// Flusher thread: write sealed buffers in order and sync periodically
+void *AsyncFileWriter::_flush_loop(void *arg) {
+    AsyncFileWriter *writer = (AsyncFileWriter *) arg;
+    struct timespec next_sync = timer_deadline(writer->sync_usecs);
+    bool unsynced = false;
+    writer->lock.lock();
+    while (true) {
+        bool sync_due = false;
+        // Wait for a sealed buffer, the next periodic sync or close()
+        while (writer->flushed == writer->sealed && !writer->closing) {
+            if (writer->sync_usecs <= 0) {
+                writer->work_cv.wait(writer->lock);
+            } else if (timer_compare(timer_now(), next_sync) >= 0 ||
+                       writer->work_cv.wait_until(writer->lock, next_sync) == CV_TIMEOUT) {
+                sync_due = true;
+                break;
+            }
+        }
+        if (sync_due && writer->active_used > 0 && writer->error == 0) {
+            writer->_seal();
+        }
+        if (writer->flushed < writer->sealed) {
+            // Write the oldest sealed buffer without holding the lock
+            int index = writer->flushed % writer->num_buffers;
+            const char *buffer = writer->memory + index * writer->buffer_size;
+            size_t size = writer->sizes[index];
+            off_t offset = writer->offset;
+            writer->lock.unlock();
+            PRINT("AsyncFileWriter writing %zu bytes\n", size);
+            int ret_val = writer->_write(buffer, size, offset);
+            int write_error = errno;
+            writer->lock.lock();
+            if (ret_val == -1 && writer->error == 0) {
+                writer->error = write_error;
+            }
+            if (writer->error != 0) {
+                // Drop what is still buffered, every caller fails from now on
+                writer->flushed = writer->sealed;
+                writer->active_used = 0;
+            } else {
+                if (writer->offset != -1) {
+                    writer->offset += size;
+                }
+                writer->flushed++;
+                unsynced = true;
+            }
+            writer->space_cv.broadcast();
+        }
+        if (sync_due) {
+            next_sync = timer_deadline(writer->sync_usecs);
+        }
+        if (sync_due && unsynced && writer->flushed == writer->sealed) {
+            writer->lock.unlock();
+            int fd = writer->fd;
+            async_syscall([fd]() -> long { return fdatasync(fd); });
+            writer->lock.lock();
+            unsynced = false;
+        }
+        if (writer->closing && writer->flushed == writer->sealed) {
+            break;
+        }
+    }
+    writer->lock.unlock();
+    return nullptr;
+}
@@ -0,0 +1,101 @@
+#ifndef ASYNC_FILE_WRITER_H
+#define ASYNC_FILE_WRITER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "CondVar.h"
+#include "Lock.h"
+
+#define WRITER_BUFFER_SIZE (256 * 1024)    // Default size of each buffer
+#define WRITER_NUM_BUFFERS 4               // Default number of buffers
+#define WRITER_ALIGNMENT 4096              // Buffer address and size alignment
+
+// Write-behind appender shared by many threads. Appends are copied into large
+// page aligned buffers, and a background flusher thread writes every filled
+// buffer with one async write, so many small appends cost one I/O per buffer
+// instead of one each. Appenders only block while every buffer is waiting to
+// be written and on the flush()/sync() barriers
+// A regular file is written with positioned writes starting at its end when
+// the first append is made (the fd's file position is not moved). Anything
+// else (pipes, sockets, devices) is written at its current position
+// NOTE: Appends are never interleaved with each other, but an append may be
+//       split across two writes. Once a write fails the data still buffered is
+//       dropped and every later call fails with its errno
+class AsyncFileWriter {
+public:
+    // fd: File to append to (not closed by the writer)
+    // buffer_size: Size of each buffer (rounded up to WRITER_ALIGNMENT)
+    // num_buffers: Number of buffers (at least 2, so appends can go on while a
+    //              buffer is written)
+    // sync_usecs: If > 0, the flusher also writes partially filled buffers and
+    //             calls fdatasync() every sync_usecs microseconds
+    explicit AsyncFileWriter(int fd, size_t buffer_size = WRITER_BUFFER_SIZE,
+                             int num_buffers = WRITER_NUM_BUFFERS, long sync_usecs = 0);
+
+    // Flushes and stops the flusher (see close())
+    ~AsyncFileWriter();
+
+    // Writers cannot be copied (threads may be blocked on them)
+    AsyncFileWriter(const AsyncFileWriter &) = delete;
+    AsyncFileWriter &operator=(const AsyncFileWriter &) = delete;
+
+    // Append len bytes of data. The flusher thread is started on the first
+    // append
+    // Output:
+    // - 0 on success, -1 on failure (errno of the failed write, EBADF after
+    //   close())
+    int append(const void *data, size_t len);
+
+    // Block until everything appended before the call has been written
+    // Output:
+    // - 0 on success, -1 on failure
+    int flush();
+
+    // flush(), then fdatasync() the file
+    // Output:
+    // - 0 on success, -1 on failure
+    int sync();
+
+    // Flush everything and stop the flusher thread. Later appends fail
+    // Output:
+    // - 0 on success, -1 if a write failed
+    int close();
+
+private:
+    int fd;                   // File being appended to
+    size_t buffer_size;       // Size of each buffer
+    int num_buffers;          // Number of buffers
+    long sync_usecs;          // Periodic flush and sync interval, 0 if off
+    char *memory;             // The buffers, one after another
+    size_t *sizes;            // Bytes to write of each sealed buffer
+    unsigned long sealed;     // Buffers handed to the flusher so far
+    unsigned long flushed;    // Buffers written so far
+    size_t active_used;       // Bytes in the buffer being filled (sealed % num_buffers)
+    bool spilling;            // true while a partly buffered append waits for the next buffer
+    off_t offset;             // File offset of the next write, -1 if not seekable
+    int error;                // errno of the first failed write, 0 if none
+    bool closing;             // true once close() was called
+    int flusher;              // Flusher thread id, -1 if not started
+    Lock lock;                // Guards the fields above
+    CondVar space_cv;         // Signaled when a buffer was written
+    CondVar work_cv;          // Signals the flusher that a buffer was sealed
+
+    // Hand the active buffer to the flusher
+    // NOTE: Assumes the lock is held
+    void _seal();
+
+    // Returns true if the active buffer has not been written since its last
+    // lap (i.e. appends must wait)
+    // NOTE: Assumes the lock is held
+    bool _full() const { return sealed - flushed == (unsigned long) num_buffers; }
+
+    // Write size bytes of buf at offset. Returns 0 on success, -1 on failure
+    int _write(const char *buf, size_t size, off_t offset);
+
+    // Flusher thread: write sealed buffers in order and sync periodically
+    static void *_flush_loop(void *arg);
+};
+
+#endif    // ASYNC_FILE_WRITER_H
@@ -0,0 +1,114 @@
+#include "Channel.h"
+
+#include "debug.cpp"
+#include "uthread_private.h"
+
+// Thread blocked on a channel. Lives on the waiting thread's stack
+// NOTE: A thread in channel_select() is queued on several channels at once.
+//       All of its nodes share one woken flag so it is only made ready once
+struct ChannelWaiter : WaitNode {
+    bool *woken;                // Shared by every node of the same wait
+    std::atomic<int> *count;    // Length counter of the queue the node is on
+};
+
+ChannelBase::ChannelBase() : is_closed(false), num_senders(0), num_recvers(0) {
+    // Nothing to do
+}
+
+// Close the channel and wake every blocked thread
+void ChannelBase::close() {
+    is_closed.store(true, std::memory_order_release);
+    disableInterrupts();
+    PRINT("Channel %p closed by thread %d\n", (void *) this, running->getId());
+    while (!senders.empty()) {
+        _wake_one(senders, num_senders);
+    }
+    while (!recvers.empty()) {
+        _wake_one(recvers, num_recvers);
+    }
+    enableInterrupts();
+}
+
+// Block until _can_send() is true
+void ChannelBase::_wait_send() {
+    _wait(senders, num_senders, &ChannelBase::_can_send);
+}
+
+// Block until _can_recv() is true
+void ChannelBase::_wait_recv() {
+    _wait(recvers, num_recvers, &ChannelBase::_can_recv);
+}
+
+// Block on queue until ready() is true
+void ChannelBase::_wait(WaitQueue &queue, std::atomic<int> &count,
+                        bool (ChannelBase::*ready)() const) {
+    disableInterrupts();
+    // Recheck with interrupts disabled so a wakeup cannot be missed
+    if (!(this->*ready)()) {
+        bool woken = false;
+        ChannelWaiter waiter;
+        waiter.tcb = running;
+        waiter.woken = &woken;
+        waiter.count = &count;
+        queue.push(&waiter);
+        count.fetch_add(1, std::memory_order_relaxed);
+        running->setState(BLOCK);
+        PRINT("Thread %d blocked on channel %p\n", running->getId(), (void *) this);
+        switchThreads();
+    }
+    enableInterrupts();
+}
+
+// Block until at least one of the channels can receive
+void ChannelBase::_wait_recv_any(ChannelBase *const *channels, int n) {
+    disableInterrupts();
+    for (int i = 0; i < n; i++) {
+        if (channels[i]->_can_recv()) {
+            enableInterrupts();
+            return;
+        }
+    }
+    // Queue on every channel. The first sender to wake us wins
+    bool woken = false;
+    ChannelWaiter waiters[CHANNEL_SELECT_MAX];
+    for (int i = 0; i < n; i++) {
+        waiters[i].tcb = running;
+        waiters[i].woken = &woken;
+        waiters[i].count = &channels[i]->num_recvers;
+        channels[i]->recvers.push(&waiters[i]);
+        channels[i]->num_recvers.fetch_add(1, std::memory_order_relaxed);
+    }
+    running->setState(BLOCK);
+    PRINT("Thread %d selecting on %d channels\n", running->getId(), n);
+    switchThreads();
+    // Unlink the nodes that were not used to wake us
+    for (int i = 0; i < n; i++) {
+        if (waiters[i].queue != nullptr) {
+            waiters[i].queue->remove(&waiters[i]);
+            waiters[i].count->fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+    enableInterrupts();
+}
+
+// Wake the first thread on queue that has not already been woken
+void ChannelBase::_wake(WaitQueue &queue, std::atomic<int> &count) {
+    disableInterrupts();
+    _wake_one(queue, count);
+    enableInterrupts();
+}
+
+// Wake the first thread on queue that has not already been woken
+void ChannelBase::_wake_one(WaitQueue &queue, std::atomic<int> &count) {
+    while (!queue.empty()) {
+        ChannelWaiter *waiter = (ChannelWaiter *) queue.pop();
+        count.fetch_sub(1, std::memory_order_relaxed);
+        // Skip nodes of a select that another channel already woke
+        if (!*waiter->woken) {
+            *waiter->woken = true;
+            waiter->tcb->setState(READY);
+            addToReady(waiter->tcb);
+            break;
+        }
+    }
+}
@@ -0,0 +1,293 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+
+#include "WaitQueue.h"
+
+#define CHANNEL_SELECT_MAX 16    // Max number of channels in one channel_select()
+
+template <typename T>
+class Channel;
+
+// Blocking machinery shared by every Channel<T>. Threads only park here when
+// the lock-free ring is full/empty, so the uncontended path never disables
+// interrupts
+class ChannelBase {
+public:
+    ChannelBase();
+    virtual ~ChannelBase() {}
+
+    // Channels cannot be copied (threads may be queued on them)
+    ChannelBase(const ChannelBase &) = delete;
+    ChannelBase &operator=(const ChannelBase &) = delete;
+
+    // Close the channel. Blocked senders and receivers are woken up, further
+    // sends fail, and receives fail once the remaining items are drained
+    void close();
+
+    // Returns true if the channel has been closed
+    bool closed() const { return is_closed.load(std::memory_order_acquire); }
+
+protected:
+    std::atomic<bool> is_closed;    // true once close() has been called
+
+    // Returns true if a send would not block (space available or closed)
+    virtual bool _can_send() const = 0;
+
+    // Returns true if a receive would not block (item available or closed)
+    virtual bool _can_recv() const = 0;
+
+    // Block until _can_send() is true
+    void _wait_send();
+
+    // Block until _can_recv() is true
+    void _wait_recv();
+
+    // Wake one blocked sender after an item was received
+    void _wake_sender() {
+        // Read the count only after the ring update (the parking side checks
+        // the ring with interrupts disabled, so a compiler fence is enough)
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        if (num_senders.load(std::memory_order_relaxed) > 0) {
+            _wake(senders, num_senders);
+        }
+    }
+
+    // Wake one blocked receiver after an item was sent
+    void _wake_recver() {
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        if (num_recvers.load(std::memory_order_relaxed) > 0) {
+            _wake(recvers, num_recvers);
+        }
+    }
+
+    // Block until at least one of the channels can receive
+    static void _wait_recv_any(ChannelBase *const *channels, int n);
+
+    template <typename T>
+    friend int channel_select(Channel<T> *const *channels, int n, T &value);
+
+private:
+    WaitQueue senders;               // Threads waiting for space
+    WaitQueue recvers;               // Threads waiting for an item
+    std::atomic<int> num_senders;    // Length of senders, read on the fast path
+    std::atomic<int> num_recvers;    // Length of recvers, read on the fast path
+
+    // Block on queue until ready() is true
+    void _wait(WaitQueue &queue, std::atomic<int> &count, bool (ChannelBase::*ready)() const);
+
+    // Wake the first thread on queue that has not already been woken
+    static void _wake(WaitQueue &queue, std::atomic<int> &count);
+
+    // Same as _wake()
+    // NOTE: Assumes interrupts are disabled
+    static void _wake_one(WaitQueue &queue, std::atomic<int> &count);
+};
+
+// Bounded multi-producer multi-consumer channel for uthreads
+// Items are stored in a lock-free ring (one sequence number per slot). Threads
+// only disable interrupts and park when the ring is full (send) or empty (recv)
+// NOTE: T must be default constructible and copy assignable
+template <typename T>
+class Channel : public ChannelBase {
+public:
+    // Create a channel that buffers at most capacity items (capacity > 0)
+    explicit Channel(size_t capacity);
+    ~Channel();
+
+    // Send an item, blocking while the channel is full
+    // Returns true on success, false if the channel is closed
+    bool send(const T &value);
+
+    // Receive an item, blocking while the channel is empty
+    // Returns true on success, false if the channel is closed and drained
+    bool recv(T &value);
+
+    // Send an item without blocking
+    // Returns true on success, false if the channel is full or closed
+    bool try_send(const T &value);
+
+    // Receive an item without blocking
+    // Returns true on success, false if the channel is empty
+    bool try_recv(T &value);
+
+    // Get the maximum number of buffered items
+    size_t capacity() const { return cap; }
+
+private:
+    // Ring slot. seq == 2 * pos means free for the send at pos and
+    // seq == 2 * pos + 1 means filled for the receive at pos (doubling keeps
+    // the two states distinct even when capacity is 1)
+    struct Cell {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    Cell *cells;                     // Ring buffer
+    size_t cap;                      // Number of cells
+    std::atomic<size_t> send_pos;    // Position of the next send
+    std::atomic<size_t> recv_pos;    // Position of the next receive
+
+    // Lock-free ring operations
+    bool push(const T &value);
+    bool pop(T &value);
+
+    bool _can_send() const override;
+    bool _can_recv() const override;
+};
+
+template <typename T>
+Channel<T>::Channel(size_t capacity) : cells(new Cell[capacity]), cap(capacity) {
+    assert(capacity > 0);
+    for (size_t i = 0; i < cap; i++) {
+        cells[i].seq.store(2 * i, std::memory_order_relaxed);
+    }
+    send_pos.store(0, std::memory_order_relaxed);
+    recv_pos.store(0, std::memory_order_relaxed);
+}
+
+template <typename T>
+Channel<T>::~Channel() {
+    delete[] cells;
+}
+
+// Claim the next free cell and publish the value into it
+template <typename T>
+bool Channel<T>::push(const T &value) {
+    size_t pos = send_pos.load(std::memory_order_relaxed);
+    while (true) {
+        Cell &cell = cells[pos % cap];
+        size_t seq = cell.seq.load(std::memory_order_acquire);
+        long diff = (long) seq - (long) (2 * pos);
+        if (diff == 0) {
+            if (send_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                cell.value = value;
+                cell.seq.store(2 * pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;    // Full
+        } else {
+            pos = send_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+// Claim the next filled cell and take the value out of it
+template <typename T>
+bool Channel<T>::pop(T &value) {
+    size_t pos = recv_pos.load(std::memory_order_relaxed);
+    while (true) {
+        Cell &cell = cells[pos % cap];
+        size_t seq = cell.seq.load(std::memory_order_acquire);
+        long diff = (long) seq - (long) (2 * pos + 1);
+        if (diff == 0) {
+            if (recv_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                value = cell.value;
+                cell.seq.store(2 * (pos + cap), std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;    // Empty
+        } else {
+            pos = recv_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+template <typename T>
+bool Channel<T>::_can_send() const {
+    size_t pos = send_pos.load(std::memory_order_relaxed);
+    size_t seq = cells[pos % cap].seq.load(std::memory_order_acquire);
+    return closed() || (long) seq - (long) (2 * pos) >= 0;
+}
+
+template <typename T>
+bool Channel<T>::_can_recv() const {
+    size_t pos = recv_pos.load(std::memory_order_relaxed);
+    size_t seq = cells[pos % cap].seq.load(std::memory_order_acquire);
+    return closed() || (long) seq - (long) (2 * pos + 1) >= 0;
+}
+
+template <typename T>
+bool Channel<T>::try_send(const T &value) {
+    if (closed() || !push(value)) {
+        return false;
+    }
+    _wake_recver();
+    return true;
+}
+
+template <typename T>
+bool Channel<T>::try_recv(T &value) {
+    if (!pop(value)) {
+        return false;
+    }
+    _wake_sender();
+    return true;
+}
+
+template <typename T>
+bool Channel<T>::send(const T &value) {
+    while (!closed()) {
+        if (try_send(value)) {
+            return true;
+        }
+        _wait_send();
+    }
+    return false;
+}
+
+template <typename T>
+bool Channel<T>::recv(T &value) {
+    while (true) {
+        if (try_recv(value)) {
+            return true;
+        }
+        // Check closed after the failed receive so items sent before close()
+        // are still drained
+        if (closed()) {
+            return try_recv(value);
+        }
+        _wait_recv();
+    }
+}
+
+// Receive from whichever channel has an item first, blocking until one does
+// Returns the index of the channel received from, or -1 if every channel is
+// closed and drained
+// NOTE: At most CHANNEL_SELECT_MAX channels can be selected on
+template <typename T>
+int channel_select(Channel<T> *const *channels, int n, T &value) {
+    assert(n <= CHANNEL_SELECT_MAX);
+    while (true) {
+        for (int i = 0; i < n; i++) {
+            if (channels[i]->try_recv(value)) {
+                return i;
+            }
+        }
+        // Only wait on open channels (a closed channel is always "ready")
+        ChannelBase *open[CHANNEL_SELECT_MAX];
+        int num_open = 0;
+        for (int i = 0; i < n; i++) {
+            if (!channels[i]->closed()) {
+                open[num_open++] = channels[i];
+            }
+        }
+        if (num_open == 0) {
+            // Drain anything sent just before the last close()
+            for (int i = 0; i < n; i++) {
+                if (channels[i]->try_recv(value)) {
+                    return i;
+                }
+            }
+            return -1;
+        }
+        ChannelBase::_wait_recv_any(open, num_open);
+    }
+}
+
+#endif    // CHANNEL_H
@@ -0,0 +1,79 @@
+#include "Combiner.h"
+
+#include "debug.cpp"
+
+// clang-format off
+Combiner::Combiner(const char *name)
+    : locked(false), max_slot(0)
+#ifdef LOCK_STATS
+    , stats(name, "Combiner")
+#endif
+{
+    (void) name;
+    for (int i = 0; i < MAX_THREAD_NUM; i++) {
+        slots[i].fn.store(nullptr, std::memory_order_relaxed);
+        slots[i].arg = nullptr;
+    }
+}
+// clang-format on
+
+// Run fn(arg) mutually exclusive with every other operation on this combiner
+void Combiner::execute(void (*fn)(void *), void *arg) {
+#ifdef LOCK_STATS
+    uint64_t wait_start = lock_stats_now();
+#endif
+    int tid = uthread_self();
+    Slot &slot = slots[tid];
+    // Publish the operation
+    slot.arg = arg;
+    slot.fn.store(fn, std::memory_order_release);
+    int max = max_slot.load(std::memory_order_relaxed);
+    while (tid > max && !max_slot.compare_exchange_weak(max, tid, std::memory_order_relaxed));
+
+    while (true) {
+        // Become the combiner if no other thread is
+        if (!locked.load(std::memory_order_relaxed) &&
+            !locked.exchange(true, std::memory_order_acquire)) {
+#ifdef LOCK_STATS
+            // Stats are only updated while combining
+            uint64_t batch_start = lock_stats_now();
+            int ran = _combine();
+            stats.record_wait(batch_start - wait_start, ran > 1);
+            stats.record_hold(lock_stats_now() - batch_start);
+#else
+            _combine();
+#endif
+            locked.store(false, std::memory_order_release);
+            return;
+        }
+        // Another thread is combining, let it run (and run our operation)
+        uthread_yield();
+        if (slot.fn.load(std::memory_order_acquire) == nullptr) {
+            return;
+        }
+    }
+}
+
+// Run every published operation. Returns the number of operations run
+int Combiner::_combine() {
+    int ran = 0;
+    for (int pass = 0; pass < COMBINER_PASSES; pass++) {
+        int max = max_slot.load(std::memory_order_relaxed);
+        int ran_pass = 0;
+        for (int i = 0; i <= max; i++) {
+            void (*fn)(void *) = slots[i].fn.load(std::memory_order_acquire);
+            if (fn != nullptr) {
+                fn(slots[i].arg);
+                slots[i].fn.store(nullptr, std::memory_order_release);
+                ran_pass++;
+            }
+        }
+        ran += ran_pass;
+        // Stop once a pass finds nothing new to run
+        if (ran_pass == 0) {
+            break;
+        }
+    }
+    PRINT("Thread %d combined %d operations\n", uthread_self(), ran);
+    return ran;
+}
@@ -0,0 +1,59 @@
+#ifndef COMBINER_H
+#define COMBINER_H
+
+#include <atomic>
+#include <type_traits>
+
+#include "lock_stats.h"
+#include "uthread.h"
+
+#define COMBINER_PASSES 2    // Max scans over the slots per batch
+
+// Flat combining executor for short, hot critical sections
+// A thread publishes its operation into its own slot (indexed by thread id).
+// Whichever thread takes the combiner lock runs every published operation in
+// one batch while the other threads wait on their slot instead of the lock,
+// so the protected data stays with one thread and contended callers never
+// queue up on a Lock
+// NOTE: Operations must not block or call execute() on the same combiner
+class Combiner {
+public:
+    // name: Optional name reported by uthread_dump_lock_stats()
+    explicit Combiner(const char *name = nullptr);
+
+    // Combiners cannot be copied (threads may have published operations)
+    Combiner(const Combiner &) = delete;
+    Combiner &operator=(const Combiner &) = delete;
+
+    // Run fn(arg) mutually exclusive with every other operation on this
+    // combiner. Returns once the operation has run (possibly on another thread)
+    void execute(void (*fn)(void *), void *arg);
+
+    // Same as execute() for a callable taking no arguments (e.g. a lambda)
+    template <typename F>
+    void execute(F &&fn) {
+        execute([](void *f) { (*(typename std::remove_reference<F>::type *) f)(); },
+                (void *) &fn);
+    }
+
+private:
+    // Published operation of one thread, padded so that threads publishing at
+    // the same time do not share a cache line
+    struct alignas(64) Slot {
+        std::atomic<void (*)(void *)> fn;    // Pending operation, nullptr once run
+        void *arg;                           // Argument passed to fn
+    };
+
+    Slot slots[MAX_THREAD_NUM];    // One slot per thread id
+    std::atomic<bool> locked;      // true while a thread is combining
+    std::atomic<int> max_slot;     // Highest slot index ever published
+#ifdef LOCK_STATS
+    LockStats stats;    // Batches run (contended: batches of more than one operation)
+#endif
+
+    // Run every published operation. Returns the number of operations run
+    // NOTE: Assumes the combiner lock is held
+    int _combine();
+};
+
+#endif    // COMBINER_H
@@ -3,29 +3,92 @@
 #include <cassert>
 
 #include "debug.cpp"
+#include "timer.h"
 #include "uthread_private.h"
 
-CondVar::CondVar() {
+// Thread blocked on a condition variable. Lives on the waiting thread's stack
+struct CondWaiter : WaitNode {
+    Lock *lock;        // Lock to reacquire once woken
+    Timer timer;       // Timeout for timed waits
+    bool timed_out;    // true if woken by the timer instead of a signal
+};
+
+#ifdef LOCK_STATS
+CondVar::CondVar(const char *name) : stats(name, "CondVar") {
     // Nothing to do
 }
+#else
+CondVar::CondVar(const char *name) {
+    (void) name;
+}
+#endif
 
 // Release the lock and block this thread atomically. Thread is woken up when
 // signalled or broadcasted
 void CondVar::wait(Lock &lock) {
+    _wait(lock, nullptr);
+}
+
+// Same as wait() but also wakes up once timeout_usecs microseconds have passed
+CvStatus CondVar::wait_for(Lock &lock, long timeout_usecs) {
+    struct timespec deadline = timer_deadline(timeout_usecs);
+    return _wait(lock, &deadline);
+}
+
+// Same as wait() but also wakes up once the deadline has passed
+CvStatus CondVar::wait_until(Lock &lock, const struct timespec &deadline) {
+    return _wait(lock, &deadline);
+}
+
+// Block the running thread until signaled or the deadline (if any) passes
+CvStatus CondVar::_wait(Lock &lock, const struct timespec *deadline) {
     // Ensure thread has lock when calling wait
-    assert(lock.held);
+    assert(lock._held());
+    if (deadline != nullptr) {
+        // Return without giving up the lock if the deadline already passed
+        if (timer_compare(*deadline, timer_now()) <= 0) {
+            return CV_TIMEOUT;
+        }
+        timer_init();
+    }
+#ifdef LOCK_STATS
+    uint64_t wait_start = lock_stats_now();
+#endif
     disableInterrupts();
-    this->lock = &lock;    // ?
+    CondWaiter waiter;
+    waiter.tcb = running;
+    waiter.lock = &lock;
+    waiter.timed_out = false;
     // Add running thread to condition variable queue
     running->setState(BLOCK);
-    queue.push(running);
+    queue.push(&waiter);
+    if (deadline != nullptr) {
+        timer_arm(&waiter.timer, *deadline, _timeout, &waiter);
+    }
     PRINT("Thread %d waiting on condition variable\n", running->getId());
     // Release the lock while interrupts are disabled
     lock._unlock();
     // Switch to another thread
     switchThreads();
     // Lock already acquired
+#ifdef LOCK_STATS
+    stats.record_wait(lock_stats_now() - wait_start, waiter.timed_out);
+    lock._stats_reacquired();
+#endif
     enableInterrupts();
+    return waiter.timed_out ? CV_TIMEOUT : CV_NO_TIMEOUT;
+}
+
+// Timer callback that removes a timed out waiter from the queue
+void CondVar::_timeout(void *arg) {
+    CondWaiter *waiter = (CondWaiter *) arg;
+    // Signaling cancels the timer, so the waiter must still be queued
+    assert(waiter->queue != nullptr);
+    waiter->queue->remove(waiter);
+    waiter->timed_out = true;
+    PRINT("Thread %d timed out on condition variable\n", waiter->tcb->getId());
+    // Reacquire the lock on behalf of the waiter
+    waiter->lock->_resume(waiter);
 }
 
 // Wake up a blocked thread if any is waiting
@@ -34,10 +97,10 @@ void CondVar::signal() {
     // Check if there are other waiting threads
     if (!queue.empty()) {
         // Remove thread from queue
-        TCB *next = queue.front();
-        queue.pop();
-        // Add thread to signaled queue
-        lock->_signal(next);
+        CondWaiter *next = (CondWaiter *) queue.pop();
+        timer_cancel(&next->timer);
+        // Move the waiter node to the lock's signaled queue
+        next->lock->_signal(next);
     }
     enableInterrupts();
 }
@@ -47,10 +110,10 @@ void CondVar::broadcast() {
     PRINT("Thread %d broadcasted to all threads\n", running->getId());
     while (!queue.empty()) {
         // Remove thread from queue
-        TCB *next = queue.front();
-        queue.pop();
-        // Add thread to signaled queue
-        lock->_signal(next);
+        CondWaiter *next = (CondWaiter *) queue.pop();
+        timer_cancel(&next->timer);
+        // Move the waiter node to the lock's signaled queue
+        next->lock->_signal(next);
     }
     enableInterrupts();
 }
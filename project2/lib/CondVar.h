@@ -1,21 +1,42 @@
 #ifndef COND_VAR_H
 #define COND_VAR_H
 
-#include <queue>
+#include <time.h>
 
 #include "Lock.h"
 #include "TCB.h"
+#include "WaitQueue.h"
+#include "lock_stats.h"
+
+// Result of a timed wait on a condition variable
+enum CvStatus {
+    CV_NO_TIMEOUT,    // Woken by signal or broadcast
+    CV_TIMEOUT        // Deadline passed before being signaled
+};
 
 // Synchronization condition variable
 // NOTE: Follows Mesa semantics
 class CondVar {
 public:
-    CondVar();
+    // name: Optional name reported by uthread_dump_lock_stats()
+    explicit CondVar(const char *name = nullptr);
+
+    // Condition variables cannot be copied (threads may be queued on them)
+    CondVar(const CondVar &) = delete;
+    CondVar &operator=(const CondVar &) = delete;
 
     // Release the lock and block this thread atomically. Thread is woken up when
     // signalled or broadcasted
     void wait(Lock &lock);
 
+    // Same as wait() but also wakes up once timeout_usecs microseconds have
+    // passed. The lock is reacquired before returning in both cases
+    CvStatus wait_for(Lock &lock, long timeout_usecs);
+
+    // Same as wait() but also wakes up once the absolute CLOCK_MONOTONIC
+    // deadline has passed. The lock is reacquired before returning in both cases
+    CvStatus wait_until(Lock &lock, const struct timespec &deadline);
+
     // Following Mesa semantics, Wake up a blocked thread if any is waiting
     void signal();
 
@@ -23,8 +44,17 @@ public:
     void broadcast();
 
 private:
-    Lock *lock;                 // Pointer to lock being used with condition variable
-    std::queue<TCB *> queue;    // queue of threads waiting for a signal
+    WaitQueue queue;    // queue of threads waiting for a signal
+#ifdef LOCK_STATS
+    LockStats stats;    // Wait statistics
+#endif
+
+    // Block the running thread until signaled or the deadline (if any) passes
+    CvStatus _wait(Lock &lock, const struct timespec *deadline);
+
+    // Timer callback that removes a timed out waiter from the queue
+    // NOTE: Assumes interrupts are disabled
+    static void _timeout(void *waiter);
 };
 
 #endif    // COND_VAR_H
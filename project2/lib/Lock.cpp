@@ -3,35 +3,95 @@
 #include <cassert>
 
 #include "debug.cpp"
+#include "timer.h"
 #include "uthread_private.h"
 
-Lock::Lock() : held(false) {
-    // Nothing to do
+// Thread blocked in lock(). Lives on the waiting thread's stack
+struct LockWaiter : WaitNode {
+    bool handoff;    // true if unlock() should hand the lock to this thread
+};
+
+// clang-format off
+Lock::Lock(const char *name, LockPolicy policy)
+    : entrance_queue(), signaled_queue()
+#ifdef LOCK_STATS
+    , stats(name, "Lock"), hold_start(0)
+#endif
+#ifdef DEADLOCK_DETECT
+    , name(name), owner(nullptr)
+#endif
+{
+    (void) name;
+    signaled_queue.set_tag(policy == LOCK_BARGING);
 }
+// clang-format on
 
 // Attempt to acquire lock. Grab lock if available, otherwise thread is
 // blocked until the lock becomes available
 void Lock::lock() {
+#ifdef LOCK_STATS
+    uint64_t wait_start = lock_stats_now();
+#endif
+#ifdef DEADLOCK_DETECT
+    // The timer service thread watches for every thread being blocked
+    timer_init();
+#endif
     disableInterrupts();
+#ifdef LOCK_STATS
+    bool contended = _held();
+#endif
     // Check if lock is held
-    if (held) {
+    if (_held()) {
         // Add running thread to entrance queue
-        running->setState(BLOCK);
-        entrance_queue.push(running);
-        PRINT("Thread %d added to entrance queue\n", running->getId());
-        // Switch to another thread
-        switchThreads();
+        LockWaiter waiter;
+        waiter.tcb = running;
+        waiter.handoff = !_barging();
+        int failed = 0;
+        entrance_queue.push(&waiter);
+        while (true) {
+            running->setState(BLOCK);
+            PRINT("Thread %d added to entrance queue\n", running->getId());
+#ifdef DEADLOCK_DETECT
+            deadlock_block(running, this);
+#endif
+            // Switch to another thread
+            switchThreads();
+            // The lock was handed off to this thread
+            if (waiter.handoff) {
+                break;
+            }
+            // Woken to compete for the lock, take it if no other thread barged in
+            if (!_held()) {
+                _set_held(true);
+#ifdef DEADLOCK_DETECT
+                owner = running;
+#endif
+                break;
+            }
+            // Lost the lock, wait again at the front of the queue
+            if (++failed >= LOCK_BARGE_LIMIT) {
+                waiter.handoff = true;
+            }
+            entrance_queue.push_front(&waiter);
+        }
     }
     // Otherwise set held to true
     else {
-        held = true;
+        _set_held(true);
+#ifdef DEADLOCK_DETECT
+        owner = running;
+#endif
     }
     PRINT("Lock acquired by %d\n", running->getId());
+#ifdef LOCK_STATS
+    hold_start = lock_stats_now();
+    stats.record_wait(hold_start - wait_start, contended);
+#endif
     enableInterrupts();
 }
 
 // Unlock the lock. Wake up a blocked thread if any is waiting to acquire the
-// lock and hand off the lock
+// lock and hand off the lock (LOCK_BARGING frees the lock instead)
 void Lock::unlock() {
     disableInterrupts();
     // Call interrupt disabled version
@@ -43,10 +103,16 @@ void Lock::unlock() {
 // NOTE: This function should NOT be used by user code. It is only to be used
 //       by uthread library code
 void Lock::_unlock() {
+#ifdef LOCK_STATS
+    stats.record_hold(lock_stats_now() - hold_start);
+#endif
     // Check if there are waiting signaled threads
     if (!signaled_queue.empty()) {
-        TCB *next = signaled_queue.front();
-        signaled_queue.pop();
+        TCB *next = signaled_queue.pop()->tcb;
+#ifdef DEADLOCK_DETECT
+        deadlock_unblock(next);
+        owner = next;
+#endif
         next->setState(READY);
         addToReady(next);
         PRINT("Thread %d removed from signaled queue by thread %d\n", next->getId(),
@@ -54,8 +120,22 @@ void Lock::_unlock() {
     }
     // Check if there are waiting entrance threads
     else if (!entrance_queue.empty()) {
-        TCB *next = entrance_queue.front();
-        entrance_queue.pop();
+        LockWaiter *waiter = (LockWaiter *) entrance_queue.pop();
+        TCB *next = waiter->tcb;
+#ifdef DEADLOCK_DETECT
+        deadlock_unblock(next);
+#endif
+        // Hand off the lock, or free it and let the thread compete for it
+        if (waiter->handoff) {
+#ifdef DEADLOCK_DETECT
+            owner = next;
+#endif
+        } else {
+            _set_held(false);
+#ifdef DEADLOCK_DETECT
+            owner = nullptr;
+#endif
+        }
         next->setState(READY);
         addToReady(next);
         PRINT("Thread %d removed from entrance queue by thread %d\n", next->getId(),
@@ -63,15 +143,53 @@ void Lock::_unlock() {
     }
     // Otherwise no waiting threads
     else {
-        held = false;
+        _set_held(false);
+#ifdef DEADLOCK_DETECT
+        owner = nullptr;
+#endif
         PRINT("Lock released by thread %d\n", running->getId());
     }
 }
 
 // Let the lock know that it should switch to this thread after the lock has
 // been released (following Mesa semantics)
-void Lock::_signal(TCB *tcb) {
-    // Add TCB to the signaled queue
-    signaled_queue.push(tcb);
-    PRINT("Thread %d signaled by thread %d\n", tcb->getId(), running->getId());
+void Lock::_signal(WaitNode *node) {
+    // Add the thread to the signaled queue
+    signaled_queue.push(node);
+#ifdef DEADLOCK_DETECT
+    // The thread now waits for the lock like a thread in lock()
+    deadlock_block(node->tcb, this);
+#endif
+    PRINT("Thread %d signaled by thread %d\n", node->tcb->getId(), running->getId());
+}
+
+// Give the lock to a thread that was woken without being signaled
+void Lock::_resume(WaitNode *node) {
+    TCB *tcb = node->tcb;
+    // Wait behind the signaled threads if the lock is held
+    if (_held()) {
+        signaled_queue.push(node);
+#ifdef DEADLOCK_DETECT
+        deadlock_block(tcb, this);
+#endif
+        PRINT("Thread %d resumed into signaled queue\n", tcb->getId());
+    }
+    // Otherwise hand the lock straight to the thread
+    else {
+        _set_held(true);
+#ifdef DEADLOCK_DETECT
+        owner = tcb;
+#endif
+        tcb->setState(READY);
+        addToReady(tcb);
+        PRINT("Lock handed to resumed thread %d\n", tcb->getId());
+    }
+}
+
+#ifdef LOCK_STATS
+// Restart hold time accounting once a condition variable waiter has
+// reacquired the lock
+void Lock::_stats_reacquired() {
+    hold_start = lock_stats_now();
 }
+#endif
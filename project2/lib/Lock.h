@@ -1,42 +1,107 @@
 #ifndef LOCK_H
 #define LOCK_H
 
-#include <queue>
-
 #include "TCB.h"
+#include "WaitQueue.h"
+#include "deadlock.h"
+#include "lock_stats.h"
+
+// Number of times a waiter may lose a barging lock to other threads before the
+// lock is handed to it directly (prevents starvation)
+#define LOCK_BARGE_LIMIT 4
+
+// How a Lock is passed on when it is released with threads waiting
+enum LockPolicy {
+    LOCK_HANDOFF,    // Strict FIFO: the lock is handed to the oldest waiter
+    LOCK_BARGING     // The lock is freed and the oldest waiter is woken to compete for it
+};
 
 // Synchronization lock
+// Waiting threads are linked through WaitNodes on their own stacks, so blocking
+// and waking never allocate and a Lock is only two words (plus the optional
+// LOCK_STATS/DEADLOCK_DETECT fields)
 class Lock {
 public:
-    Lock();
+    // name: Optional name reported by uthread_dump_lock_stats() and the
+    //       deadlock detector
+    // policy: LOCK_HANDOFF is fair but every contended acquisition waits for a
+    //         context switch to the next owner. LOCK_BARGING lets a running
+    //         thread take a free lock ahead of the woken waiter, which avoids
+    //         lock convoys under high contention. A waiter that loses
+    //         LOCK_BARGE_LIMIT times is handed the lock directly
+    // NOTE: Threads reacquiring the lock after a CondVar wait are always handed
+    //       the lock
+    explicit Lock(const char *name = nullptr, LockPolicy policy = LOCK_HANDOFF);
+
+    // Locks cannot be copied (threads may be queued on them)
+    Lock(const Lock &) = delete;
+    Lock &operator=(const Lock &) = delete;
 
     // Attempt to acquire lock. Grab lock if available, otherwise thread is
     // blocked until the lock becomes available
     void lock();
 
     // Unlock the lock. Wake up a blocked thread if any is waiting to acquire the
-    // lock and hand off the lock
+    // lock and hand off the lock (LOCK_BARGING frees the lock instead)
     void unlock();
 
 private:
-    bool held;                           // true if the lock is held, false otherwise
-    std::queue<TCB *> entrance_queue;    // queue of threads waiting to acquire the lock
-    std::queue<TCB *>
-        signaled_queue;    // queue of threads that signaled and are waiting to reacquire the lock
+    WaitQueue entrance_queue;    // queue of threads waiting to acquire the lock (tag: held)
+    WaitQueue signaled_queue;    // queue of signaled threads waiting to reacquire the lock
+                                 // (tag: barging policy)
+#ifdef LOCK_STATS
+    LockStats stats;        // Contention statistics
+    uint64_t hold_start;    // Time the current owner acquired the lock
+#endif
+#ifdef DEADLOCK_DETECT
+    const char *name;    // Name printed in deadlock reports
+    TCB *owner;          // Thread holding the lock, nullptr if not held
+#endif
+
+    // Get/set whether the lock is held (kept in the entrance queue's tag bit)
+    bool _held() const { return entrance_queue.tag(); }
+    void _set_held(bool held) { entrance_queue.set_tag(held); }
+
+    // Returns true if the lock uses the LOCK_BARGING policy (kept in the
+    // signaled queue's tag bit)
+    bool _barging() const { return signaled_queue.tag(); }
 
     // Unlock the lock while interrupts have already been disabled
     // NOTE: Assumes interrupts are disabled
     void _unlock();
 
     // Let the lock know that it should switch to this thread after the lock has
-    // been released (following Mesa semantics)
+    // been released (following Mesa semantics). The node must be unlinked and
+    // stay valid until the thread runs again (e.g. the thread's CondVar node)
+    // NOTE: Assumes interrupts are disabled
+    void _signal(WaitNode *node);
+
+    // Give the lock to a thread that was woken without being signaled (e.g. a
+    // condition variable wait that timed out). The thread waits behind the
+    // signaled threads if the lock is held, otherwise it is granted the lock
     // NOTE: Assumes interrupts are disabled
-    void _signal(TCB *tcb);
+    void _resume(WaitNode *node);
+
+#ifdef LOCK_STATS
+    // Restart hold time accounting once a condition variable waiter has
+    // reacquired the lock
+    void _stats_reacquired();
+#endif
 
     // Allow condition variable class access to Lock private members
-    // NOTE: CondVar should only use _unlock() and _signal() private functions
+    // NOTE: CondVar should only use the private functions above
     //       (should not access private variables directly)
     friend class CondVar;
+
+#ifdef DEADLOCK_DETECT
+    // Allow the deadlock detector to walk lock owners
+    friend void deadlock_block(TCB *tcb, Lock *lock);
+    friend void deadlock_all_blocked();
+#endif
 };
 
+#if !defined(LOCK_STATS) && !defined(DEADLOCK_DETECT)
+static_assert(sizeof(Lock) == 2 * sizeof(void *), "Lock should only hold its two wait queues");
+#endif
+
 #endif    // LOCK_H
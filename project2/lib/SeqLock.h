@@ -0,0 +1,105 @@
+#ifndef SEQ_LOCK_H
+#define SEQ_LOCK_H
+
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+#include "uthread.h"
+
+// Sequence lock for small snapshots of read-mostly data
+// Readers never write shared memory: they copy the value and retry if a
+// writer ran in the meantime (the sequence number is odd while a write is in
+// progress). Writers are serialized by the sequence number itself
+// NOTE: T must be trivially copyable since readers may copy a torn value
+//       before retrying
+template <typename T>
+class SeqLock {
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLock requires a trivially copyable T");
+
+public:
+    SeqLock() : seq(0), value() {}
+    explicit SeqLock(const T &value) : seq(0), value(value) {}
+
+    // SeqLocks cannot be copied
+    SeqLock(const SeqLock &) = delete;
+    SeqLock &operator=(const SeqLock &) = delete;
+
+    // Get a consistent copy of the value
+    T load() const;
+
+    // Replace the value
+    void store(const T &new_value);
+
+    // Update the value in place with fn(T &) (e.g. to change a single field)
+    template <typename F>
+    void update(F &&fn);
+
+private:
+    std::atomic<unsigned long> seq;    // Odd while a write is in progress
+    T value;                           // Protected value
+
+    // Start/finish a write. Returns the (even) sequence number before the write
+    unsigned long _write_begin();
+    void _write_end(unsigned long start);
+};
+
+// Get a consistent copy of the value
+template <typename T>
+T SeqLock<T>::load() const {
+    T copy;
+    while (true) {
+        unsigned long start = seq.load(std::memory_order_acquire);
+        // A writer was preempted mid-write, let it finish
+        if (start & 1) {
+            uthread_yield();
+            continue;
+        }
+        memcpy((void *) &copy, (const void *) &value, sizeof(T));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (seq.load(std::memory_order_relaxed) == start) {
+            return copy;
+        }
+    }
+}
+
+// Replace the value
+template <typename T>
+void SeqLock<T>::store(const T &new_value) {
+    unsigned long start = _write_begin();
+    memcpy((void *) &value, (const void *) &new_value, sizeof(T));
+    _write_end(start);
+}
+
+// Update the value in place with fn(T &)
+template <typename T>
+template <typename F>
+void SeqLock<T>::update(F &&fn) {
+    unsigned long start = _write_begin();
+    fn(value);
+    _write_end(start);
+}
+
+// Make the sequence number odd, waiting for any other writer to finish
+template <typename T>
+unsigned long SeqLock<T>::_write_begin() {
+    unsigned long start = seq.load(std::memory_order_relaxed);
+    while ((start & 1) ||
+           !seq.compare_exchange_weak(start, start + 1, std::memory_order_acquire)) {
+        if (start & 1) {
+            uthread_yield();
+            start = seq.load(std::memory_order_relaxed);
+        }
+    }
+    // Keep the value writes after the sequence number update
+    std::atomic_thread_fence(std::memory_order_release);
+    return start;
+}
+
+// Make the sequence number even again, publishing the new value
+template <typename T>
+void SeqLock<T>::_write_end(unsigned long start) {
+    seq.store(start + 2, std::memory_order_release);
+}
+
+#endif    // SEQ_LOCK_H
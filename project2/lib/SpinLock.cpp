@@ -3,19 +3,39 @@
 #include "debug.cpp"
 #include "uthread_private.h"
 
-SpinLock::SpinLock() {
+#ifdef LOCK_STATS
+SpinLock::SpinLock(const char *name) : stats(name, "SpinLock"), hold_start(0) {
     // Nothing to do
 }
+#else
+SpinLock::SpinLock(const char *name) {
+    (void) name;
+}
+#endif
 
 // Acquire the lock. Spin until the lock is acquired if the lock is already held
 void SpinLock::lock() {
     PRINT("Thread %d aquiring spinlock\n", running->getId());
+#ifdef LOCK_STATS
+    uint64_t wait_start = lock_stats_now();
+    bool contended = false;
+    while (atomic_value.test_and_set()) {
+        contended = true;
+    }
+    // Stats are only updated while the spinlock is held
+    hold_start = lock_stats_now();
+    stats.record_wait(hold_start - wait_start, contended);
+#else
     while (atomic_value.test_and_set());
+#endif
     PRINT("Spinlock acquired by thread %d\n", running->getId());
 }
 
 // Unlock the lock
 void SpinLock::unlock() {
     PRINT("Spinlock released by thread %d\n", running->getId());
+#ifdef LOCK_STATS
+    stats.record_hold(lock_stats_now() - hold_start);
+#endif
     atomic_value.clear();
 }
@@ -3,10 +3,17 @@
 
 #include <atomic>
 
+#include "lock_stats.h"
+
 // Synchronization spinlock
 class SpinLock {
 public:
-    SpinLock();
+    // name: Optional name reported by uthread_dump_lock_stats()
+    explicit SpinLock(const char *name = nullptr);
+
+    // Spinlocks cannot be copied
+    SpinLock(const SpinLock &) = delete;
+    SpinLock &operator=(const SpinLock &) = delete;
 
     // Acquire the lock. Spin until the lock is acquired if the lock is already
     // held
@@ -17,6 +24,10 @@ public:
 
 private:
     std::atomic_flag atomic_value = ATOMIC_FLAG_INIT;    // Test-and-Set variable
+#ifdef LOCK_STATS
+    LockStats stats;        // Contention statistics
+    uint64_t hold_start;    // Time the current owner acquired the lock
+#endif
 };
 
 #endif    // SPIN_LOCK_H
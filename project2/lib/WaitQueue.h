@@ -0,0 +1,96 @@
+#ifndef WAIT_QUEUE_H
+#define WAIT_QUEUE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "TCB.h"
+
+class WaitQueue;
+
+// Link for a thread blocked on a wait queue
+// NOTE: Nodes live on the blocked thread's own stack, so linking and unlinking
+//       never allocate memory
+struct WaitNode {
+    TCB *tcb = nullptr;            // Thread that is waiting
+    WaitNode *prev = nullptr;      // Previous node in the queue
+    WaitNode *next = nullptr;      // Next node in the queue
+    WaitQueue *queue = nullptr;    // Queue the node is linked on, nullptr otherwise
+};
+
+// Intrusive FIFO queue of blocked threads
+// The queue is a circular doubly linked list so only the head is stored
+// (head->prev is the tail), which keeps the queue one word wide. Nodes are
+// word aligned, so the low bit of the head pointer is free and is offered to
+// the owner of the queue as a tag (Lock keeps its held flag there)
+// NOTE: Assumes interrupts are disabled for every operation
+class WaitQueue {
+public:
+    WaitQueue() : bits(0) {}
+
+    bool empty() const { return front() == nullptr; }
+
+    WaitNode *front() const { return (WaitNode *) (bits & ~TAG_BIT); }
+
+    // Get/set the tag bit
+    bool tag() const { return (bits & TAG_BIT) != 0; }
+    void set_tag(bool tag) { bits = (bits & ~TAG_BIT) | (tag ? TAG_BIT : 0); }
+
+    // Add a node to the back of the queue
+    void push(WaitNode *node) {
+        WaitNode *head = front();
+        if (head == nullptr) {
+            node->prev = node->next = node;
+            set_front(node);
+        } else {
+            WaitNode *tail = head->prev;
+            node->prev = tail;
+            node->next = head;
+            tail->next = node;
+            head->prev = node;
+        }
+        node->queue = this;
+    }
+
+    // Add a node to the front of the queue
+    void push_front(WaitNode *node) {
+        push(node);
+        set_front(node);
+    }
+
+    // Remove and return the node at the front of the queue
+    WaitNode *pop() {
+        WaitNode *node = front();
+        if (node != nullptr) {
+            remove(node);
+        }
+        return node;
+    }
+
+    // Unlink a node from anywhere in the queue in O(1)
+    void remove(WaitNode *node) {
+        if (node->next == node) {
+            set_front(nullptr);
+        } else {
+            node->prev->next = node->next;
+            node->next->prev = node->prev;
+            if (front() == node) {
+                set_front(node->next);
+            }
+        }
+        node->prev = node->next = nullptr;
+        node->queue = nullptr;
+    }
+
+private:
+    static const uintptr_t TAG_BIT = 1;
+
+    uintptr_t bits;    // Oldest waiter (head of the list) | tag bit
+
+    void set_front(WaitNode *node) { bits = (uintptr_t) node | (bits & TAG_BIT); }
+};
+
+static_assert(sizeof(WaitQueue) == sizeof(void *), "WaitQueue should be one word");
+static_assert(alignof(WaitNode) > 1, "The low bit of a WaitNode pointer must be free for the tag");
+
+#endif    // WAIT_QUEUE_H
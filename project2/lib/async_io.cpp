@@ -2,11 +2,110 @@
 
 #include <aio.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
 
+#include "async_syscall.h"
+#include "cancel.h"
 #include "debug.cpp"
+#include "io_stats.h"
+#include "reactor.h"
+#include "uring.h"
 #include "uthread.h"
+#include "uthread_private.h"
+
+static struct iovec *fixed_buffers = nullptr;    // Registered buffer pool
+static int num_fixed_buffers = 0;                // Number of registered buffers
+static bool fixed_in_kernel = false;             // true if io_uring registered the pool
+
+// Carry out a read/write through the io_uring engine (len is the number of
+// buffers for vectored operations). Returns the number of bytes transferred on
+// success, -1 (with errno set) on failure
+static ssize_t uring_rw(int opcode, int fd, const void *addr, unsigned len, off_t offset,
+                        const IoControl *ctl, int buf_index = 0) {
+    struct io_uring_sqe sqe;
+    uring_prep_rw(&sqe, opcode, fd, addr, len, offset);
+    sqe.buf_index = buf_index;
+    int ret_val = uring_execute(sqe, ctl);
+    // Pipes and sockets have no file offset (POSIX aio ignored it for them)
+    if (ret_val == -ESPIPE && offset != 0) {
+        sqe.off = 0;
+        ret_val = uring_execute(sqe, ctl);
+    }
+    if (ret_val < 0) {
+        errno = -ret_val;
+        return -1;
+    }
+    return ret_val;
+}
+
+// Records a POSIX aio request in the I/O stats (does nothing without IO_STATS)
+class AioStats {
+public:
+#ifdef IO_STATS
+    explicit AioStats(int fd) : fd_class(io_stats_classify(fd)) {
+        disableInterrupts();
+        submit_ns = io_stats_submit(fd_class);
+        enableInterrupts();
+    }
+
+    // Record the completion (result >= 0 on success, -errno on failure)
+    void complete(ssize_t result) {
+        disableInterrupts();
+        io_stats_complete(fd_class, submit_ns, io_stats_now(), result >= 0);
+        enableInterrupts();
+    }
+
+private:
+    IoFdClass fd_class;    // Kind of file the request is on
+    uint64_t submit_ns;    // Time the request was submitted
+#else
+    explicit AioStats(int fd) { (void) fd; }
+    void complete(ssize_t result) { (void) result; }
+#endif
+};
+
+// Carry out a read/write at the current file position on a helper thread (used
+// without io_uring since POSIX aio always needs an offset). ctl is only
+// checked before the call starts. Returns the number of bytes transferred on
+// success, -1 (with errno set) on failure
+static ssize_t syscall_rw(bool write_op, int fd, void *buf, size_t count, const IoControl *ctl) {
+    if (ctl != nullptr) {
+        int error = io_control_check(ctl);
+        if (error != 0) {
+            errno = error;
+            return -1;
+        }
+    }
+    AioStats io_stats(fd);
+    ssize_t nbytes = async_syscall([&]() -> long {
+        return write_op ? write(fd, buf, count) : read(fd, buf, count);
+    });
+    int error = errno;
+    io_stats.complete(nbytes == -1 ? -error : nbytes);
+    errno = error;
+    return nbytes;
+}
+
+// Ask POSIX aio to cancel req once ctl aborts it. Returns the reason (0 while
+// the request may run on)
+static int aio_check_control(int fd, struct aiocb *req, const IoControl *ctl) {
+    if (ctl == nullptr) {
+        return 0;
+    }
+    int error = io_control_check(ctl);
+    if (error != 0) {
+        // Only requests that have not started are cancelled, the others run to
+        // completion and the caller keeps waiting for them
+        aio_cancel(fd, req);
+    }
+    return error;
+}
 
 // Carry out an asynchronous read request where this thread will be blocked
 // while servicing the read but other ready threads will be scheduled
@@ -14,10 +113,19 @@
 // - fd: File descriptor
 // - buf: Buffer to store read in
 // - count: Number of bytes to read
-// - offset: File offset to start at
+// - offset: File offset to start at (-1 for the current file position)
+// - ctl: Deadline and cancellation token (optional)
 // Output:
 // - Number of bytes read on success, -1 on failure
-ssize_t async_read(int fd, void *buf, size_t count, int offset) {
+ssize_t async_pread(int fd, void *buf, size_t count, off_t offset, const IoControl *ctl) {
+    if (uring_available()) {
+        return uring_rw(IORING_OP_READ, fd, buf, count, offset, ctl);
+    }
+    if (offset == -1) {
+        return syscall_rw(false, fd, buf, count, ctl);
+    }
+
+    // Otherwise fall back to POSIX aio
     // clang-format off
     struct aiocb async_read_req = {
         .aio_fildes = fd,
@@ -28,17 +136,29 @@ ssize_t async_read(int fd, void *buf, size_t count, int offset) {
     // clang-format on
 
     // Return immediately if initialization fails
+    AioStats io_stats(fd);
     if (aio_read(&async_read_req) != 0) {
+        io_stats.complete(-errno);
         perror("aio_read");
         return -1;
     }
 
     // Polling until completion
     int ret_val;
+    int error = 0;
     while ((ret_val = aio_error(&async_read_req)) == EINPROGRESS) {
+        if (error == 0) {
+            error = aio_check_control(fd, &async_read_req, ctl);
+        }
         S_PRINT(5000, "Thread %d waiting in read\n", uthread_self());
         uthread_yield();
     }
+    ssize_t nbytes = aio_return(&async_read_req);
+    io_stats.complete(ret_val == 0 ? nbytes : -ret_val);
+    if (ret_val == ECANCELED && error != 0) {
+        errno = error;
+        return -1;
+    }
     // Check if there is an error
     if (ret_val != 0) {
         fprintf(stderr, "aio_error: %s\n", strerror(ret_val));
@@ -47,7 +167,7 @@ ssize_t async_read(int fd, void *buf, size_t count, int offset) {
 
     // Return I/O result
     PRINT("Thread %d ready to read\n", uthread_self());
-    return aio_return(&async_read_req);
+    return nbytes;
 }
 
 // Carry out an asynchronous write request where this thread will be blocked
@@ -56,31 +176,53 @@ ssize_t async_read(int fd, void *buf, size_t count, int offset) {
 // - fd: File descriptor
 // - buf: Buffer containing data to write to file
 // - count: Number of bytes to write
-// - offset: File offset to start at
+// - offset: File offset to start at (-1 for the current file position)
+// - ctl: Deadline and cancellation token (optional)
 // Output:
 // - Number of bytes written on success, -1 on failure
-ssize_t async_write(int fd, void *buf, size_t count, int offset) {
+ssize_t async_pwrite(int fd, const void *buf, size_t count, off_t offset,
+                     const IoControl *ctl) {
+    if (uring_available()) {
+        return uring_rw(IORING_OP_WRITE, fd, buf, count, offset, ctl);
+    }
+    if (offset == -1) {
+        return syscall_rw(true, fd, (void *) buf, count, ctl);
+    }
+
+    // Otherwise fall back to POSIX aio
     // clang-format off
     struct aiocb async_write_req = {
         .aio_fildes = fd,
-        .aio_buf = buf,
+        .aio_buf = (void *) buf,
         .aio_nbytes = count,
         .aio_offset = offset
     };
     // clang-format on
 
     // Return immediately if initization fails
+    AioStats io_stats(fd);
     if (aio_write(&async_write_req) == -1) {
+        io_stats.complete(-errno);
         perror("aio_write");
         return -1;
     }
 
     // Polling until completion
     int ret_val;
+    int error = 0;
     while ((ret_val = aio_error(&async_write_req)) == EINPROGRESS) {
+        if (error == 0) {
+            error = aio_check_control(fd, &async_write_req, ctl);
+        }
         S_PRINT(5000, "Thread %d waiting in write\n", uthread_self());
         uthread_yield();
     }
+    ssize_t nbytes = aio_return(&async_write_req);
+    io_stats.complete(ret_val == 0 ? nbytes : -ret_val);
+    if (ret_val == ECANCELED && error != 0) {
+        errno = error;
+        return -1;
+    }
     // Check if there is an error
     if (ret_val != 0) {
         fprintf(stderr, "aio_error: %s\n", strerror(ret_val));
@@ -89,5 +231,469 @@ ssize_t async_write(int fd, void *buf, size_t count, int offset) {
 
     // Return I/O result
     PRINT("Thread %d ready to write\n", uthread_self());
-    return aio_return(&async_write_req);
+    return nbytes;
+}
+
+// Carry out a vectored read/write one buffer at a time (used without io_uring)
+static ssize_t rw_each(bool write, int fd, const struct iovec *iov, int iovcnt, off_t offset,
+                       const IoControl *ctl) {
+    ssize_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        void *buf = iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+        off_t at = offset == -1 ? -1 : offset + total;
+        ssize_t nbytes = write ? async_pwrite(fd, buf, len, at, ctl)
+                               : async_pread(fd, buf, len, at, ctl);
+        if (nbytes == -1) {
+            return total > 0 ? total : -1;
+        }
+        total += nbytes;
+        // Stop at a short transfer (e.g. end of file)
+        if ((size_t) nbytes < iov[i].iov_len) {
+            break;
+        }
+    }
+    return total;
+}
+
+// Carry out an asynchronous vectored read request (one submission for every
+// buffer) where this thread will be blocked while servicing the read but other
+// ready threads will be scheduled
+// Input:
+// - fd: File descriptor
+// - iov: Buffers to fill in order
+// - iovcnt: Number of buffers
+// - offset: File offset to start at (-1 for the current file position)
+// - ctl: Deadline and cancellation token (optional)
+// Output:
+// - Number of bytes read on success, -1 on failure
+ssize_t async_preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset,
+                     const IoControl *ctl) {
+    if (uring_available()) {
+        return uring_rw(IORING_OP_READV, fd, iov, iovcnt, offset, ctl);
+    }
+    return rw_each(false, fd, iov, iovcnt, offset, ctl);
+}
+
+// Carry out an asynchronous vectored write request (one submission for every
+// buffer) where this thread will be blocked while servicing the write but
+// other ready threads will be scheduled
+// Input:
+// - fd: File descriptor
+// - iov: Buffers to write in order
+// - iovcnt: Number of buffers
+// - offset: File offset to start at (-1 for the current file position)
+// - ctl: Deadline and cancellation token (optional)
+// Output:
+// - Number of bytes written on success, -1 on failure
+ssize_t async_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset,
+                      const IoControl *ctl) {
+    if (uring_available()) {
+        return uring_rw(IORING_OP_WRITEV, fd, iov, iovcnt, offset, ctl);
+    }
+    return rw_each(true, fd, iov, iovcnt, offset, ctl);
+}
+
+// Register a pool of buffers once so that fixed reads and writes can refer to
+// them by index
+int async_register_buffers(const struct iovec *iov, int count) {
+    if (fixed_buffers != nullptr) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (count <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct iovec *buffers = (struct iovec *) malloc(sizeof(struct iovec) * count);
+    if (buffers == nullptr) {
+        return -1;
+    }
+    memcpy(buffers, iov, sizeof(struct iovec) * count);
+    // Fixed I/O falls back to regular I/O if the kernel cannot register the
+    // pool (e.g. RLIMIT_MEMLOCK is too low)
+    if (uring_available()) {
+        int ret_val = uring_register_buffers(buffers, count);
+        fixed_in_kernel = ret_val == 0;
+        if (ret_val != 0) {
+            PRINT("io_uring buffer registration failed (%d)\n", -ret_val);
+        }
+    }
+    fixed_buffers = buffers;
+    num_fixed_buffers = count;
+    return 0;
+}
+
+// Unregister the buffer pool
+int async_unregister_buffers() {
+    if (fixed_buffers == nullptr) {
+        errno = ENXIO;
+        return -1;
+    }
+    if (fixed_in_kernel) {
+        int ret_val = uring_unregister_buffers();
+        if (ret_val != 0) {
+            errno = -ret_val;
+            return -1;
+        }
+    }
+    free(fixed_buffers);
+    fixed_buffers = nullptr;
+    num_fixed_buffers = 0;
+    fixed_in_kernel = false;
+    return 0;
+}
+
+// Returns true if count bytes fit in the registered buffer buf_index
+static bool fixed_valid(int buf_index, size_t count) {
+    if (buf_index < 0 || buf_index >= num_fixed_buffers ||
+        count > fixed_buffers[buf_index].iov_len) {
+        errno = EINVAL;
+        return false;
+    }
+    return true;
+}
+
+// Carry out an asynchronous read/write of count bytes at the start of the
+// registered buffer buf_index where this thread will be blocked while
+// servicing the I/O but other ready threads will be scheduled
+ssize_t async_pread_fixed(int fd, int buf_index, size_t count, off_t offset,
+                          const IoControl *ctl) {
+    if (!fixed_valid(buf_index, count)) {
+        return -1;
+    }
+    void *buf = fixed_buffers[buf_index].iov_base;
+    if (fixed_in_kernel) {
+        return uring_rw(IORING_OP_READ_FIXED, fd, buf, count, offset, ctl, buf_index);
+    }
+    return async_pread(fd, buf, count, offset, ctl);
+}
+
+ssize_t async_pwrite_fixed(int fd, int buf_index, size_t count, off_t offset,
+                           const IoControl *ctl) {
+    if (!fixed_valid(buf_index, count)) {
+        return -1;
+    }
+    void *buf = fixed_buffers[buf_index].iov_base;
+    if (fixed_in_kernel) {
+        return uring_rw(IORING_OP_WRITE_FIXED, fd, buf, count, offset, ctl, buf_index);
+    }
+    return async_pwrite(fd, buf, count, offset, ctl);
+}
+
+// Write all count bytes of buf to out_fd, blocking this thread while out_fd
+// would block. Returns 0 on success, -1 on failure
+static int write_all(int out_fd, const char *buf, size_t count, const IoControl *ctl) {
+    while (count > 0) {
+        ssize_t nbytes = write(out_fd, buf, count);
+        if (nbytes == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return -1;
+            }
+            if (reactor_wait(out_fd, EPOLLOUT, ctl) == -1) {
+                return -1;
+            }
+            continue;
+        }
+        buf += nbytes;
+        count -= nbytes;
+    }
+    return 0;
+}
+
+// Read up to count bytes from a non-seekable in_fd (e.g. a pipe), blocking
+// this thread while in_fd has no data. Returns the number of bytes read, 0 at
+// the end of in_fd, -1 on failure
+static ssize_t read_stream(int in_fd, char *buf, size_t count, const IoControl *ctl) {
+    while (true) {
+        ssize_t nbytes = read(in_fd, buf, count);
+        if (nbytes != -1 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            return nbytes;
+        }
+        if (reactor_wait(in_fd, EPOLLIN, ctl) == -1) {
+            return -1;
+        }
+    }
+}
+
+// Transfer count bytes by copying them through a buffer (used when the kernel
+// refuses sendfile()). Returns the number of bytes transferred, -1 on failure
+static ssize_t copy_file(int out_fd, int in_fd, off_t offset, size_t count,
+                         const IoControl *ctl) {
+    char buf[SENDFILE_CHUNK];
+    bool seekable = lseek(in_fd, 0, SEEK_CUR) != -1;
+    size_t total = 0;
+    while (total < count) {
+        size_t chunk = count - total < SENDFILE_CHUNK ? count - total : SENDFILE_CHUNK;
+        ssize_t nbytes = seekable ? async_pread(in_fd, buf, chunk, offset + total, ctl)
+                                  : read_stream(in_fd, buf, chunk, ctl);
+        if (nbytes <= 0) {
+            return nbytes == -1 && total == 0 ? -1 : total;
+        }
+        if (write_all(out_fd, buf, nbytes, ctl) == -1) {
+            return -1;
+        }
+        total += nbytes;
+    }
+    return total;
+}
+
+// Transfer count bytes starting at offset of in_fd to out_fd inside the kernel
+// with sendfile()
+ssize_t async_sendfile(int out_fd, int in_fd, off_t offset, size_t count,
+                       const IoControl *ctl) {
+    size_t total = 0;
+    while (total < count) {
+        ssize_t nbytes = sendfile(out_fd, in_fd, &offset, count - total);
+        if (nbytes == 0) {
+            break;    // End of in_fd
+        }
+        if (nbytes > 0) {
+            total += nbytes;
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // Park until out_fd has room
+            PRINT("Thread %d waiting in sendfile\n", uthread_self());
+            if (reactor_wait(out_fd, EPOLLOUT, ctl) == -1) {
+                return -1;
+            }
+            continue;
+        }
+        if (errno != EINVAL && errno != ESPIPE && errno != ENOSYS && errno != EOPNOTSUPP) {
+            return -1;
+        }
+        // The kernel refused, copy the rest instead
+        PRINT("Thread %d sendfile refused (%d), copying\n", uthread_self(), errno);
+        ssize_t copied = copy_file(out_fd, in_fd, offset, count - total, ctl);
+        if (copied == -1) {
+            return -1;
+        }
+        total += copied;
+        break;
+    }
+    return total;
+}
+
+// Move up to len bytes between two fds, one of which must be a pipe, without
+// copying them through user space
+ssize_t async_splice(int in_fd, off_t *in_offset, int out_fd, off_t *out_offset, size_t len,
+                     unsigned int flags, const IoControl *ctl) {
+    while (true) {
+        ssize_t nbytes =
+            splice(in_fd, in_offset, out_fd, out_offset, len, flags | SPLICE_F_NONBLOCK);
+        if (nbytes != -1 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            return nbytes;
+        }
+        // Either in_fd has no data or out_fd has no room, park on the one that
+        // is not ready
+        struct pollfd pfds[2];
+        pfds[0].fd = in_fd;
+        pfds[0].events = POLLIN;
+        pfds[1].fd = out_fd;
+        pfds[1].events = POLLOUT;
+        if (poll(pfds, 2, 0) == -1) {
+            return -1;
+        }
+        bool in_ready = pfds[0].revents != 0;
+        PRINT("Thread %d waiting in splice\n", uthread_self());
+        int fd = in_ready ? out_fd : in_fd;
+        if (reactor_wait(fd, in_ready ? EPOLLOUT : EPOLLIN, ctl) == -1) {
+            return -1;
+        }
+    }
+}
+
+// Previous generation of async_pread()/async_pwrite() limited to offsets below
+// 2 GB. Kept for existing callers
+ssize_t async_read(int fd, void *buf, size_t count, int offset) {
+    return async_pread(fd, buf, count, offset);
+}
+
+ssize_t async_write(int fd, void *buf, size_t count, int offset) {
+    return async_pwrite(fd, buf, count, offset);
+}
+
+// Initialize an empty batch
+void uthread_io_batch_init(uthread_io_batch *batch) {
+    batch->count = 0;
+    batch->submitted = 0;
+    batch->reported = 0;
+    batch->group = UringGroup();
+}
+
+// Add an operation to the batch. Returns its index, -1 if the batch is full
+static int batch_add(uthread_io_batch *batch, int opcode, int fd, const void *addr, unsigned len,
+                     off_t offset) {
+    if (batch->count == IO_BATCH_MAX) {
+        return -1;
+    }
+    int index = batch->count++;
+    uring_prep_rw(&batch->sqes[index], opcode, fd, addr, len, offset);
+    batch->was_reported[index] = false;
+    return index;
+}
+
+// Add an operation to the batch. An offset of -1 uses the current file
+// position (use it for pipes and sockets)
+int uthread_io_batch_read(uthread_io_batch *batch, int fd, void *buf, size_t count, off_t offset) {
+    return batch_add(batch, IORING_OP_READ, fd, buf, count, offset);
+}
+
+int uthread_io_batch_write(uthread_io_batch *batch, int fd, const void *buf, size_t count,
+                           off_t offset) {
+    return batch_add(batch, IORING_OP_WRITE, fd, buf, count, offset);
+}
+
+int uthread_io_batch_readv(uthread_io_batch *batch, int fd, const struct iovec *iov, int iovcnt,
+                           off_t offset) {
+    return batch_add(batch, IORING_OP_READV, fd, iov, iovcnt, offset);
+}
+
+int uthread_io_batch_writev(uthread_io_batch *batch, int fd, const struct iovec *iov, int iovcnt,
+                            off_t offset) {
+    return batch_add(batch, IORING_OP_WRITEV, fd, iov, iovcnt, offset);
+}
+
+// Add a fixed read/write to the batch (a regular one if the pool is not
+// registered with the kernel)
+static int batch_add_fixed(uthread_io_batch *batch, bool write, int fd, int buf_index,
+                           size_t count, off_t offset) {
+    if (!fixed_valid(buf_index, count)) {
+        return -1;
+    }
+    void *buf = fixed_buffers[buf_index].iov_base;
+    if (!fixed_in_kernel) {
+        return batch_add(batch, write ? IORING_OP_WRITE : IORING_OP_READ, fd, buf, count, offset);
+    }
+    int opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    int index = batch_add(batch, opcode, fd, buf, count, offset);
+    if (index != -1) {
+        batch->sqes[index].buf_index = buf_index;
+    }
+    return index;
+}
+
+int uthread_io_batch_read_fixed(uthread_io_batch *batch, int fd, int buf_index, size_t count,
+                                off_t offset) {
+    return batch_add_fixed(batch, false, fd, buf_index, count, offset);
+}
+
+int uthread_io_batch_write_fixed(uthread_io_batch *batch, int fd, int buf_index, size_t count,
+                                 off_t offset) {
+    return batch_add_fixed(batch, true, fd, buf_index, count, offset);
+}
+
+// Carry out an operation of the batch right away (used without io_uring)
+static void batch_execute(uthread_io_batch *batch, int index, const IoControl *ctl) {
+    const struct io_uring_sqe &sqe = batch->sqes[index];
+    void *addr = (void *) sqe.addr;
+    off_t offset = (off_t) sqe.off;
+    ssize_t nbytes;
+    switch (sqe.opcode) {
+        case IORING_OP_READ:
+            nbytes = async_pread(sqe.fd, addr, sqe.len, offset, ctl);
+            break;
+        case IORING_OP_WRITE:
+            nbytes = async_pwrite(sqe.fd, addr, sqe.len, offset, ctl);
+            break;
+        case IORING_OP_READV:
+            nbytes = async_preadv(sqe.fd, (const struct iovec *) addr, sqe.len, offset, ctl);
+            break;
+        default:
+            nbytes = async_pwritev(sqe.fd, (const struct iovec *) addr, sqe.len, offset, ctl);
+            break;
+    }
+    UringOp *op = &batch->ops[index];
+    op->result = nbytes == -1 ? -errno : nbytes;
+    op->done = true;
+    op->group = &batch->group;
+    batch->group.completed++;
+}
+
+// Submit every operation added since the last submission (ctl only limits
+// operations carried out right away without io_uring)
+static void batch_submit(uthread_io_batch *batch, const IoControl *ctl) {
+    bool use_uring = uring_available();
+    for (int i = batch->submitted; i < batch->count; i++) {
+        if (use_uring) {
+            uring_submit(batch->sqes[i], &batch->ops[i], &batch->group);
+        } else {
+            batch_execute(batch, i, ctl);
+        }
+    }
+    PRINT("Thread %d submitted %d operations\n", uthread_self(), batch->count - batch->submitted);
+    batch->submitted = batch->count;
+}
+
+// Submit every operation added since the last submission without blocking
+void uthread_io_batch_submit(uthread_io_batch *batch) {
+    batch_submit(batch, nullptr);
+}
+
+// Block this thread until count operations of the batch completed. If ctl
+// aborts the wait, cancel the operations in flight and wait until the kernel
+// has dropped them. Returns 0 on success, ETIMEDOUT or ECANCELED if aborted
+static int batch_wait(uthread_io_batch *batch, unsigned count, const IoControl *ctl) {
+    int error = uring_wait(&batch->group, count, ctl);
+    if (error != 0) {
+        for (int i = 0; i < batch->submitted; i++) {
+            if (!batch->ops[i].done) {
+                uring_cancel(&batch->ops[i]);
+            }
+        }
+        uring_wait(&batch->group, batch->submitted);
+    }
+    return error;
+}
+
+// Submit the batch and block this thread until every operation completed
+int uthread_io_batch_wait_all(uthread_io_batch *batch, const IoControl *ctl) {
+    batch_submit(batch, ctl);
+    int error = batch_wait(batch, batch->count, ctl);
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    int ret_val = 0;
+    for (int i = 0; i < batch->count; i++) {
+        if (batch->ops[i].result < 0) {
+            ret_val = -1;
+        }
+    }
+    return ret_val;
+}
+
+// Submit the batch and block this thread until an operation not yet returned
+// by this function completed
+int uthread_io_batch_wait_any(uthread_io_batch *batch, const IoControl *ctl) {
+    batch_submit(batch, ctl);
+    if (batch->reported == batch->count) {
+        return -1;
+    }
+    // Every reported operation is complete, so one more completion means an
+    // unreported one
+    int error = batch_wait(batch, batch->reported + 1, ctl);
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    for (int i = 0; i < batch->count; i++) {
+        if (batch->ops[i].done && !batch->was_reported[i]) {
+            batch->was_reported[i] = true;
+            batch->reported++;
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Result of a completed operation
+ssize_t uthread_io_batch_result(uthread_io_batch *batch, int index) {
+    int result = batch->ops[index].result;
+    if (result < 0) {
+        errno = -result;
+        return -1;
+    }
+    return result;
 }
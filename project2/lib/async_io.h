@@ -2,6 +2,25 @@
 #define ASYNC_IO_H
 
 #include <sys/types.h>
+#include <sys/uio.h>
+
+#include "cancel.h"
+#include "uring.h"
+
+// The I/O is carried out by the io_uring engine (see uring.h), which parks the
+// thread until the completion is reaped. If io_uring is not available POSIX aio
+// is used instead and the thread yields until the request completes
+// Every operation takes an optional IoControl (see cancel.h) with a deadline
+// and a cancellation token. An aborted operation is cancelled in the kernel
+// and fails with ETIMEDOUT or ECANCELED once the kernel has dropped it (an
+// operation that completed before the cancellation reached it returns its
+// result instead)
+// NOTE: POSIX aio cannot cancel requests that already started, so without
+//       io_uring an aborted operation may still run to completion first.
+//       POSIX aio has no form for the current file position either, so
+//       without io_uring an offset of -1 is served by read()/write() on an
+//       async_syscall() helper (see async_syscall.h), where ctl is only
+//       checked before the call starts
 
 // Carry out an asynchronous read request where this thread will be blocked
 // while servicing the read but other ready threads will be scheduled
@@ -9,10 +28,11 @@
 // - fd: File descriptor
 // - buf: Buffer to store read in
 // - count: Number of bytes to read
-// - offset: File offset to start at
+// - offset: File offset to start at (-1 for the current file position)
+// - ctl: Deadline and cancellation token (optional)
 // Output:
 // - Number of bytes read on success, -1 on failure
-ssize_t async_read(int fd, void *buf, size_t count, int offset);
+ssize_t async_pread(int fd, void *buf, size_t count, off_t offset, const IoControl *ctl = nullptr);
 
 // Carry out an asynchronous write request where this thread will be blocked
 // while servicing the write but other ready threads will be scheduled
@@ -20,9 +40,162 @@ ssize_t async_read(int fd, void *buf, size_t count, int offset);
 // - fd: File descriptor
 // - buf: Buffer containing data to write to file
 // - count: Number of bytes to write
-// - offset: File offset to start at
+// - offset: File offset to start at (-1 for the current file position)
+// - ctl: Deadline and cancellation token (optional)
+// Output:
+// - Number of bytes written on success, -1 on failure
+ssize_t async_pwrite(int fd, const void *buf, size_t count, off_t offset,
+                     const IoControl *ctl = nullptr);
+
+// Carry out an asynchronous vectored read request (one submission for every
+// buffer) where this thread will be blocked while servicing the read but other
+// ready threads will be scheduled
+// Input:
+// - fd: File descriptor
+// - iov: Buffers to fill in order
+// - iovcnt: Number of buffers
+// - offset: File offset to start at (-1 for the current file position)
+// - ctl: Deadline and cancellation token (optional)
+// Output:
+// - Number of bytes read on success, -1 on failure
+ssize_t async_preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset,
+                     const IoControl *ctl = nullptr);
+
+// Carry out an asynchronous vectored write request (one submission for every
+// buffer) where this thread will be blocked while servicing the write but
+// other ready threads will be scheduled
+// Input:
+// - fd: File descriptor
+// - iov: Buffers to write in order
+// - iovcnt: Number of buffers
+// - offset: File offset to start at (-1 for the current file position)
+// - ctl: Deadline and cancellation token (optional)
 // Output:
 // - Number of bytes written on success, -1 on failure
+ssize_t async_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset,
+                      const IoControl *ctl = nullptr);
+
+// Register a pool of buffers once so that fixed reads and writes can refer to
+// them by index. When io_uring can register them the kernel pins their pages
+// once instead of on every I/O, otherwise fixed I/O works like regular I/O
+// Input:
+// - iov: Buffers of the pool (copied)
+// - count: Number of buffers
+// Output:
+// - 0 on success, -1 on failure (errno is EBUSY if a pool is registered)
+// NOTE: Register at startup, fixed I/O must not be in flight while the pool
+//       changes
+int async_register_buffers(const struct iovec *iov, int count);
+
+// Unregister the buffer pool
+// Output:
+// - 0 on success, -1 on failure (errno is ENXIO if no pool is registered)
+int async_unregister_buffers();
+
+// Carry out an asynchronous read/write of count bytes at the start of the
+// registered buffer buf_index where this thread will be blocked while
+// servicing the I/O but other ready threads will be scheduled
+// Output:
+// - Number of bytes transferred on success, -1 on failure (errno is EINVAL if
+//   buf_index is not registered or count exceeds its size)
+ssize_t async_pread_fixed(int fd, int buf_index, size_t count, off_t offset,
+                          const IoControl *ctl = nullptr);
+ssize_t async_pwrite_fixed(int fd, int buf_index, size_t count, off_t offset,
+                           const IoControl *ctl = nullptr);
+
+#define SENDFILE_CHUNK 65536    // Buffer size of the async_sendfile() copy fallback
+
+// Transfer count bytes starting at offset of in_fd (a file) to out_fd (e.g. a
+// socket) inside the kernel with sendfile(). If out_fd is non-blocking this
+// thread is blocked only while out_fd would block, but other ready threads
+// will be scheduled. Falls back to copying through a buffer if the kernel
+// refuses (e.g. in_fd is a pipe or socket)
+// Input:
+// - out_fd: File descriptor to write to
+// - in_fd: File descriptor to read from (its file position is not changed)
+// - offset: Offset of in_fd to start at (ignored if in_fd is not seekable)
+// - count: Number of bytes to transfer
+// - ctl: Deadline and cancellation token (optional)
+// Output:
+// - Number of bytes transferred (less than count only at the end of in_fd) on
+//   success, -1 on failure
+ssize_t async_sendfile(int out_fd, int in_fd, off_t offset, size_t count,
+                       const IoControl *ctl = nullptr);
+
+// Move up to len bytes between two fds, one of which must be a pipe, without
+// copying them through user space (see splice(2)). This thread is blocked
+// only while the pipe or the other fd is not ready, but other ready threads
+// will be scheduled
+// Output:
+// - Number of bytes moved (0 at the end of in_fd) on success, -1 on failure
+ssize_t async_splice(int in_fd, off_t *in_offset, int out_fd, off_t *out_offset, size_t len,
+                     unsigned int flags, const IoControl *ctl = nullptr);
+
+// Previous generation of async_pread()/async_pwrite() limited to offsets below
+// 2 GB. Kept for existing callers
+ssize_t async_read(int fd, void *buf, size_t count, int offset);
 ssize_t async_write(int fd, void *buf, size_t count, int offset);
 
+#define IO_BATCH_MAX 32    // Max operations in a batch
+
+// Independent I/O operations submitted together. Add operations, then wait for
+// all of them or for them one at a time as they complete
+// NOTE: A batch must not be reused or destroyed while operations are in flight.
+//       Without io_uring the operations are carried out one after another in
+//       the order they were added
+struct uthread_io_batch {
+    int count;                                 // Operations added
+    int submitted;                             // Operations submitted
+    int reported;                              // Operations returned by wait_any
+    UringGroup group;                          // Completion tracking
+    struct io_uring_sqe sqes[IO_BATCH_MAX];    // Operations
+    UringOp ops[IO_BATCH_MAX];                 // Their results
+    bool was_reported[IO_BATCH_MAX];           // true once returned by wait_any
+};
+
+// Initialize an empty batch
+void uthread_io_batch_init(uthread_io_batch *batch);
+
+// Add an operation to the batch. An offset of -1 uses the current file
+// position (use it for pipes and sockets)
+// Output:
+// - Index of the operation on success, -1 if the batch is full
+int uthread_io_batch_read(uthread_io_batch *batch, int fd, void *buf, size_t count, off_t offset);
+int uthread_io_batch_write(uthread_io_batch *batch, int fd, const void *buf, size_t count,
+                           off_t offset);
+int uthread_io_batch_readv(uthread_io_batch *batch, int fd, const struct iovec *iov, int iovcnt,
+                           off_t offset);
+int uthread_io_batch_writev(uthread_io_batch *batch, int fd, const struct iovec *iov, int iovcnt,
+                            off_t offset);
+int uthread_io_batch_read_fixed(uthread_io_batch *batch, int fd, int buf_index, size_t count,
+                                off_t offset);
+int uthread_io_batch_write_fixed(uthread_io_batch *batch, int fd, int buf_index, size_t count,
+                                 off_t offset);
+
+// Submit every operation added since the last submission without waiting for
+// them (the thread only blocks while the io_uring ring is full)
+void uthread_io_batch_submit(uthread_io_batch *batch);
+
+// Submit the batch and block this thread until every operation completed. If
+// ctl (optional) aborts the wait, the operations still in flight are
+// cancelled and the wait fails once the kernel has dropped them (their
+// results are -1 with errno ECANCELED)
+// Output:
+// - 0 if every operation succeeded, -1 otherwise (errno is ETIMEDOUT or
+//   ECANCELED if ctl aborted the wait)
+int uthread_io_batch_wait_all(uthread_io_batch *batch, const IoControl *ctl = nullptr);
+
+// Submit the batch and block this thread until an operation not yet returned
+// by this function completed. An abort by ctl (optional) is handled like in
+// uthread_io_batch_wait_all()
+// Output:
+// - Index of the completed operation, -1 once every operation was returned or
+//   if ctl aborted the wait (errno is ETIMEDOUT or ECANCELED)
+int uthread_io_batch_wait_any(uthread_io_batch *batch, const IoControl *ctl = nullptr);
+
+// Result of a completed operation
+// Output:
+// - Number of bytes transferred on success, -1 (with errno set) on failure
+ssize_t uthread_io_batch_result(uthread_io_batch *batch, int index);
+
 #endif    // ASYNC_IO_H
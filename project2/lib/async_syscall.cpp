@@ -0,0 +1,223 @@
+#include "async_syscall.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include "debug.cpp"
+#include "timer.h"
+#include "uthread_private.h"
+
+#define NSEC_PER_SEC 1000000000L
+
+// Offloaded call. Lives on the waiting thread's stack
+struct SyscallRequest {
+    long (*fn)(void *);      // Function run by a helper
+    void *arg;               // Argument passed to fn
+    long result;             // Return value of fn
+    int error;               // errno after fn returned
+    TCB *tcb;                // Thread to wake on completion
+    SyscallRequest *next;    // Next request in the submission queue or completed stack
+};
+
+static bool pool_tried = false;                             // true once setup was attempted
+static bool pool_running = false;                           // true if the helpers are running
+static int event_fd = -1;                                   // Written by helpers on completion
+static int outstanding = 0;                                 // Calls not yet completed
+static EventSource source;                                  // Registration with the service
+static SyscallRequest *queue_head = nullptr;                // Oldest submitted request
+static SyscallRequest *queue_tail = nullptr;                // Newest submitted request
+static std::atomic<SyscallRequest *> completed(nullptr);    // Completed requests (stack)
+
+// Submission queue lock shared with the helpers, and the condition variable
+// they wait on for submissions
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cv = PTHREAD_COND_INITIALIZER;
+
+// Helper thread: run submitted calls and report their completion
+static void *helper(void *arg) {
+    (void) arg;
+    while (true) {
+        pthread_mutex_lock(&queue_lock);
+        while (queue_head == nullptr) {
+            pthread_cond_wait(&queue_cv, &queue_lock);
+        }
+        SyscallRequest *request = queue_head;
+        queue_head = request->next;
+        if (queue_head == nullptr) {
+            queue_tail = nullptr;
+        }
+        pthread_mutex_unlock(&queue_lock);
+
+        errno = 0;
+        request->result = request->fn(request->arg);
+        request->error = errno;
+
+        // Publish the completion, then wake the service thread
+        request->next = completed.load(std::memory_order_relaxed);
+        while (!completed.compare_exchange_weak(request->next, request,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed));
+        uint64_t one = 1;
+        ssize_t ret_val = write(event_fd, &one, sizeof(one));
+        (void) ret_val;
+    }
+    return nullptr;
+}
+
+// Create the eventfd and start the helpers. Returns 0 on success, -1 on
+// failure
+// NOTE: Assumes interrupts are disabled
+static int pool_setup() {
+    event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (event_fd == -1) {
+        perror("eventfd");
+        return -1;
+    }
+    // Helpers must never take the uthread library's signals, and inherit the
+    // signal mask of the thread that creates them
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int num_started = 0;
+    for (int i = 0; i < ASYNC_SYSCALL_THREADS; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, nullptr, helper, nullptr) != 0) {
+            break;
+        }
+        pthread_detach(thread);
+        num_started++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+    if (num_started == 0) {
+        fprintf(stderr, "async_syscall: cannot start helper threads\n");
+        close(event_fd);
+        event_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+// Returns true while calls are outstanding
+static bool pool_pending() {
+    return outstanding > 0;
+}
+
+// Wake the thread of every completed call. Returns true if a thread was woken
+static bool pool_poll() {
+    // Drain the eventfd before taking the completions, so a completion
+    // published after the exchange leaves the eventfd readable
+    uint64_t count;
+    if (read(event_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        perror("read");
+    }
+    SyscallRequest *request = completed.exchange(nullptr, std::memory_order_acquire);
+    bool woken = request != nullptr;
+    while (request != nullptr) {
+        SyscallRequest *next = request->next;
+        outstanding--;
+        request->tcb->setState(READY);
+        addToReady(request->tcb);
+        PRINT("Thread %d offloaded call completed (%ld)\n", request->tcb->getId(), request->result);
+        request = next;
+    }
+    return woken;
+}
+
+// Sleep until a call completes or the deadline passes
+static void pool_wait(const struct timespec *deadline) {
+    struct timespec timeout;
+    if (deadline != nullptr) {
+        struct timespec now = timer_now();
+        long nsecs = (deadline->tv_sec - now.tv_sec) * NSEC_PER_SEC + deadline->tv_nsec -
+                     now.tv_nsec;
+        if (nsecs < 0) {
+            nsecs = 0;
+        }
+        timeout.tv_sec = nsecs / NSEC_PER_SEC;
+        timeout.tv_nsec = nsecs % NSEC_PER_SEC;
+    }
+    struct pollfd pfd;
+    pfd.fd = event_fd;
+    pfd.events = POLLIN;
+    if (ppoll(&pfd, 1, deadline != nullptr ? &timeout : nullptr, nullptr) == -1 &&
+        errno != EINTR) {
+        perror("ppoll");
+    }
+    pool_poll();
+}
+
+// Run fn(arg) on a helper thread, blocking this thread until it returns
+long async_syscall(long (*fn)(void *), void *arg) {
+    disableInterrupts();
+    bool first = !pool_tried;
+    pool_tried = true;
+    pool_running = first ? pool_setup() == 0 : pool_running;
+    bool ready = first && pool_running;
+    enableInterrupts();
+    if (ready) {
+        source.pending = pool_pending;
+        source.poll = pool_poll;
+        source.wait = pool_wait;
+        source.fd = event_fd;
+        timer_add_source(&source);
+    }
+    if (!pool_running) {
+        return fn(arg);
+    }
+
+    SyscallRequest request = { fn, arg, 0, 0, running, nullptr };
+    disableInterrupts();
+    // Interrupts stay disabled while the queue lock is held, so no other
+    // thread on this kernel thread can block on it
+    pthread_mutex_lock(&queue_lock);
+    if (queue_tail == nullptr) {
+        queue_head = &request;
+    } else {
+        queue_tail->next = &request;
+    }
+    queue_tail = &request;
+    pthread_cond_signal(&queue_cv);
+    pthread_mutex_unlock(&queue_lock);
+    outstanding++;
+    // Park until the service thread harvests the completion
+    running->setState(BLOCK);
+    timer_wake();
+    switchThreads();
+    enableInterrupts();
+    errno = request.error;
+    return request.result;
+}
+
+int async_open(const char *pathname, int flags, mode_t mode) {
+    return async_syscall([&]() -> long { return open(pathname, flags, mode); });
+}
+
+int async_close(int fd) {
+    return async_syscall([&]() -> long { return close(fd); });
+}
+
+int async_stat(const char *pathname, struct stat *statbuf) {
+    return async_syscall([&]() -> long { return stat(pathname, statbuf); });
+}
+
+int async_fstat(int fd, struct stat *statbuf) {
+    return async_syscall([&]() -> long { return fstat(fd, statbuf); });
+}
+
+int async_fsync(int fd) {
+    return async_syscall([&]() -> long { return fsync(fd); });
+}
+
+int async_getaddrinfo(const char *node, const char *service, const struct addrinfo *hints,
+                      struct addrinfo **res) {
+    return async_syscall([&]() -> long { return getaddrinfo(node, service, hints, res); });
+}
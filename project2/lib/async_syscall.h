@@ -0,0 +1,45 @@
+#ifndef ASYNC_SYSCALL_H
+#define ASYNC_SYSCALL_H
+
+#include <netdb.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <type_traits>
+
+// Offload pool for blocking system calls that have no asynchronous form (open,
+// stat, getaddrinfo, ...). The calling thread parks while one of a few helper
+// kernel threads makes the call. Helpers report completions through an
+// eventfd harvested by the timer service thread, which wakes exactly the
+// threads whose calls returned, so a slow call only stalls its own thread
+// NOTE: Helpers run outside the uthread library, so offloaded functions must
+//       not call uthread functions or use uthread synchronization
+
+#define ASYNC_SYSCALL_THREADS 4    // Helper kernel threads
+
+// Run fn(arg) on a helper thread, blocking this thread until it returns. The
+// helpers are started on the first call (fn runs inline if they cannot be)
+// Output:
+// - fn's return value, with errno as fn left it
+// NOTE: Must be called with interrupts enabled
+long async_syscall(long (*fn)(void *), void *arg);
+
+// Same as async_syscall() for a callable taking no arguments (e.g. a lambda)
+template <typename F>
+long async_syscall(F &&fn) {
+    return async_syscall(
+        [](void *f) -> long { return (*(typename std::remove_reference<F>::type *) f)(); },
+        (void *) &fn);
+}
+
+// Offloaded versions of common blocking system calls. Each takes the same
+// arguments and returns the same values as the system call it is named after
+int async_open(const char *pathname, int flags, mode_t mode = 0);
+int async_close(int fd);
+int async_stat(const char *pathname, struct stat *statbuf);
+int async_fstat(int fd, struct stat *statbuf);
+int async_fsync(int fd);
+int async_getaddrinfo(const char *node, const char *service, const struct addrinfo *hints,
+                      struct addrinfo **res);
+
+#endif    // ASYNC_SYSCALL_H
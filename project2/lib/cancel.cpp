@@ -0,0 +1,93 @@
+#include "cancel.h"
+
+#include <errno.h>
+
+#include "debug.cpp"
+#include "uthread_private.h"
+
+// Unlink a waiter from its token
+// NOTE: Assumes interrupts are disabled
+static void unlink(IoWaiter *waiter) {
+    if (waiter->token == nullptr) {
+        return;
+    }
+    if (waiter->token_prev != nullptr) {
+        waiter->token_prev->token_next = waiter->token_next;
+    } else {
+        waiter->token->waiters = waiter->token_next;
+    }
+    if (waiter->token_next != nullptr) {
+        waiter->token_next->token_prev = waiter->token_prev;
+    }
+    waiter->token = nullptr;
+}
+
+// Abort a waiter for the given reason
+// NOTE: Assumes interrupts are disabled
+static void abort_waiter(IoWaiter *waiter, int error) {
+    unlink(waiter);
+    if (waiter->abort(waiter)) {
+        waiter->error = error;
+    }
+}
+
+// Timer callback that aborts a waiter whose deadline passed
+static void expire(void *arg) {
+    abort_waiter((IoWaiter *) arg, ETIMEDOUT);
+}
+
+// Cancel every operation blocked on token and every later operation given it
+void io_cancel(IoCancelToken *token) {
+    disableInterrupts();
+    token->cancelled = true;
+    while (token->waiters != nullptr) {
+        IoWaiter *waiter = token->waiters;
+        timer_cancel(&waiter->timer);
+        abort_waiter(waiter, ECANCELED);
+    }
+    enableInterrupts();
+}
+
+// Check ctl before starting an operation
+int io_control_check(const IoControl *ctl) {
+    if (ctl->token != nullptr && ctl->token->cancelled) {
+        return ECANCELED;
+    }
+    if (ctl->deadline != nullptr) {
+        if (timer_compare(*ctl->deadline, timer_now()) <= 0) {
+            return ETIMEDOUT;
+        }
+        timer_init();
+    }
+    return 0;
+}
+
+// Arm the deadline and token of ctl for a thread about to park
+void io_waiter_arm(IoWaiter *waiter, const IoControl *ctl, bool (*abort)(IoWaiter *)) {
+    waiter->abort = abort;
+    waiter->error = 0;
+    if (ctl->token != nullptr) {
+        // Link at the front, the order in which waiters are aborted does not
+        // matter
+        waiter->token = ctl->token;
+        waiter->token_prev = nullptr;
+        waiter->token_next = ctl->token->waiters;
+        if (ctl->token->waiters != nullptr) {
+            ctl->token->waiters->token_prev = waiter;
+        }
+        ctl->token->waiters = waiter;
+    }
+    if (ctl->deadline != nullptr) {
+        timer_arm(&waiter->timer, *ctl->deadline, expire, waiter);
+    }
+}
+
+// Disarm a waiter once its thread runs again
+int io_waiter_disarm(IoWaiter *waiter) {
+    timer_cancel(&waiter->timer);
+    unlink(waiter);
+    if (waiter->error != 0) {
+        PRINT("Thread %d I/O aborted (%d)\n", running->getId(), waiter->error);
+    }
+    return waiter->error;
+}
@@ -0,0 +1,64 @@
+#ifndef CANCEL_H
+#define CANCEL_H
+
+#include <time.h>
+
+#include "timer.h"
+
+// Deadlines and cancellation for async I/O (see async_io.h and reactor.h)
+// An operation given an IoControl fails with ETIMEDOUT once the deadline
+// passes, or with ECANCELED once its token is cancelled. The engine carrying
+// out the operation asks the kernel to drop it and only returns once the
+// kernel no longer references the caller's buffers
+
+struct IoWaiter;
+
+// Token shared by any number of operations. Cancelling it aborts every
+// operation blocked on it and makes later operations given it fail at once
+struct IoCancelToken {
+    bool cancelled = false;         // true once io_cancel() was called
+    IoWaiter *waiters = nullptr;    // Operations blocked on the token
+};
+
+// Limits on how long an operation may block its thread (both are optional)
+struct IoControl {
+    const struct timespec *deadline = nullptr;    // Absolute deadline (see timer_deadline())
+    IoCancelToken *token = nullptr;               // Token that aborts the operation
+};
+
+// Cancel every operation blocked on token and every later operation given it
+// NOTE: Must be called with interrupts enabled
+void io_cancel(IoCancelToken *token);
+
+// Thread blocked in an I/O engine under an IoControl. Engines embed it in
+// their own waiter, which lives on the waiting thread's stack
+struct IoWaiter {
+    Timer timer;                                  // Fires at the deadline
+    IoCancelToken *token = nullptr;               // Token the waiter is linked on
+    IoWaiter *token_prev = nullptr;               // Previous waiter of the token
+    IoWaiter *token_next = nullptr;               // Next waiter of the token
+    int error = 0;                                // ETIMEDOUT or ECANCELED once aborted
+    bool (*abort)(IoWaiter *waiter) = nullptr;    // Wake the thread early, returns false if it
+                                                  // was already woken
+};
+
+// Check ctl before starting an operation (starts the timer service if ctl has
+// a deadline)
+// Output:
+// - ETIMEDOUT if the deadline passed, ECANCELED if the token was cancelled, 0
+//   otherwise
+// NOTE: Must be called with interrupts enabled
+int io_control_check(const IoControl *ctl);
+
+// Arm the deadline and token of ctl for a thread about to park. abort is
+// called (with interrupts disabled) if either fires first
+// NOTE: Assumes interrupts are disabled
+void io_waiter_arm(IoWaiter *waiter, const IoControl *ctl, bool (*abort)(IoWaiter *));
+
+// Disarm a waiter once its thread runs again
+// Output:
+// - ETIMEDOUT or ECANCELED if the waiter was aborted, 0 otherwise
+// NOTE: Assumes interrupts are disabled
+int io_waiter_disarm(IoWaiter *waiter);
+
+#endif    // CANCEL_H
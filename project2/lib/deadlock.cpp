@@ -0,0 +1,78 @@
+#include "deadlock.h"
+
+#ifdef DEADLOCK_DETECT
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Lock.h"
+#include "uthread_private.h"
+
+static Lock *waiting_for[MAX_THREAD_NUM];    // Lock each thread is blocked on (by tid)
+
+// Print the name of a lock (or its address if unnamed)
+static void print_lock(const char *name, const Lock *lock) {
+    if (name != nullptr) {
+        fprintf(stderr, "\"%s\"", name);
+    } else {
+        fprintf(stderr, "%p", (const void *) lock);
+    }
+}
+
+// Record that tcb is about to wait on lock and check whether this closes a
+// cycle in the wait-for graph
+void deadlock_block(TCB *tcb, Lock *lock) {
+    waiting_for[tcb->getId()] = lock;
+    // Follow owner -> lock the owner waits on -> its owner ...
+    // Each thread waits on at most one lock, so the chain has at most one
+    // step per thread
+    TCB *owner = lock->owner;
+    for (int steps = 0; owner != nullptr && steps < MAX_THREAD_NUM; steps++) {
+        if (owner == tcb) {
+            break;
+        }
+        Lock *next = waiting_for[owner->getId()];
+        owner = (next != nullptr ? next->owner : nullptr);
+    }
+    if (owner != tcb) {
+        return;
+    }
+    // Print the cycle starting from the waiting thread
+    fprintf(stderr, "deadlock detected:\n");
+    TCB *waiter = tcb;
+    do {
+        Lock *blocked_on = waiting_for[waiter->getId()];
+        fprintf(stderr, "  thread %d waits for lock ", waiter->getId());
+        print_lock(blocked_on->name, blocked_on);
+        fprintf(stderr, " held by thread %d\n", blocked_on->owner->getId());
+        waiter = blocked_on->owner;
+    } while (waiter != tcb);
+    abort();
+}
+
+// Record that tcb is no longer waiting on a lock
+void deadlock_unblock(TCB *tcb) {
+    waiting_for[tcb->getId()] = nullptr;
+}
+
+// Report that no thread is ready and nothing is pending that could wake one up
+void deadlock_all_blocked() {
+    fprintf(stderr, "deadlock detected: every thread is blocked with no pending timers\n");
+    for (int tid = 0; tid < MAX_THREAD_NUM; tid++) {
+        Lock *lock = waiting_for[tid];
+        if (lock == nullptr) {
+            continue;
+        }
+        fprintf(stderr, "  thread %d waits for lock ", tid);
+        print_lock(lock->name, lock);
+        if (lock->owner != nullptr) {
+            fprintf(stderr, " held by thread %d\n", lock->owner->getId());
+        } else {
+            fprintf(stderr, "\n");
+        }
+    }
+    fprintf(stderr, "  (threads not listed are blocked on a condition variable or join)\n");
+    abort();
+}
+
+#endif    // DEADLOCK_DETECT
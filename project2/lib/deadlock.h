@@ -0,0 +1,34 @@
+#ifndef DEADLOCK_H
+#define DEADLOCK_H
+
+// Wait-for-graph deadlock detection for Lock
+// Build with DEADLOCK_DETECT=1 (implied by DEBUG=1) to enable. Every time a
+// thread blocks in Lock::lock() (or a condition variable waiter is queued to
+// reacquire its lock) the owner->waiter chain is followed from the lock's
+// owner; if it leads back to the waiting thread the cycle is printed and the
+// process aborts. The timer service thread also aborts if every thread
+// ends up blocked with no timer pending that could wake one of them
+
+#ifdef DEADLOCK_DETECT
+
+#include "TCB.h"
+
+class Lock;
+
+// Record that tcb is about to wait on lock and check whether this closes a
+// cycle in the wait-for graph
+// NOTE: Assumes interrupts are disabled
+void deadlock_block(TCB *tcb, Lock *lock);
+
+// Record that tcb is no longer waiting on a lock
+// NOTE: Assumes interrupts are disabled
+void deadlock_unblock(TCB *tcb);
+
+// Report that no thread is ready and nothing is pending that could wake one up.
+// Prints the threads blocked on locks and aborts
+// NOTE: Assumes interrupts are disabled
+void deadlock_all_blocked();
+
+#endif    // DEADLOCK_DETECT
+
+#endif    // DEADLOCK_H
@@ -0,0 +1,202 @@
+#include "io_stats.h"
+
+#include <errno.h>
+#include <stdio.h>
+
+#ifdef IO_STATS
+
+#include <string.h>
+#include <sys/stat.h>
+
+#include "timer.h"
+#include "uthread_private.h"
+
+static IoStats stats;                   // Statistics since the last reset
+static uint64_t reset_ns = 0;           // Time of the last reset
+static uint64_t depth_change_ns = 0;    // Time the in-flight depth last changed
+static Timer dump_timer;                // Fires the periodic dumps
+static long dump_interval = 0;          // Periodic dump interval (usecs), 0 if off
+
+static const char *class_names[IO_FD_CLASSES] = { "file", "pipe", "socket", "other" };
+
+// Get the latency bucket of ns (floor of its base 2 logarithm)
+static int bucket(uint64_t ns) {
+    int index = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+    return index < IO_STATS_BUCKETS ? index : IO_STATS_BUCKETS - 1;
+}
+
+// Account the time spent at the current in-flight depth
+// NOTE: Assumes interrupts are disabled
+static void integrate_depth(uint64_t now_ns) {
+    if (reset_ns == 0) {
+        reset_ns = now_ns;
+    }
+    if (depth_change_ns != 0) {
+        stats.depth_ns += stats.in_flight * (now_ns - depth_change_ns);
+    }
+    depth_change_ns = now_ns;
+}
+
+// Get the class of fd
+IoFdClass io_stats_classify(int fd) {
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) == -1) {
+        return IO_FD_OTHER;
+    }
+    if (S_ISREG(statbuf.st_mode) || S_ISBLK(statbuf.st_mode)) {
+        return IO_FD_FILE;
+    }
+    if (S_ISFIFO(statbuf.st_mode)) {
+        return IO_FD_PIPE;
+    }
+    return S_ISSOCK(statbuf.st_mode) ? IO_FD_SOCKET : IO_FD_OTHER;
+}
+
+// Record the submission of an operation
+uint64_t io_stats_submit(IoFdClass fd_class) {
+    uint64_t now_ns = io_stats_now();
+    integrate_depth(now_ns);
+    stats.classes[fd_class].submitted++;
+    stats.in_flight++;
+    if (stats.in_flight > stats.max_in_flight) {
+        stats.max_in_flight = stats.in_flight;
+    }
+    return now_ns;
+}
+
+// Record the completion of an operation
+void io_stats_complete(IoFdClass fd_class, uint64_t submit_ns, uint64_t now_ns, bool succeeded) {
+    integrate_depth(now_ns);
+    if (succeeded) {
+        stats.classes[fd_class].completed++;
+    } else {
+        stats.classes[fd_class].failed++;
+    }
+    if (stats.in_flight > 0) {
+        stats.in_flight--;
+    }
+    stats.service[bucket(now_ns - submit_ns)]++;
+}
+
+// Record a thread resuming after being woken by a completion
+void io_stats_resumed(uint64_t complete_ns) {
+    stats.resume[bucket(io_stats_now() - complete_ns)]++;
+}
+
+// Copy the statistics into stats
+int uthread_get_io_stats(IoStats *snapshot) {
+    disableInterrupts();
+    uint64_t now_ns = io_stats_now();
+    integrate_depth(now_ns);
+    *snapshot = stats;
+    snapshot->elapsed_ns = now_ns - reset_ns;
+    enableInterrupts();
+    return 0;
+}
+
+// Clear the statistics
+// NOTE: Assumes interrupts are disabled
+static void reset() {
+    unsigned in_flight = stats.in_flight;
+    memset(&stats, 0, sizeof(stats));
+    stats.in_flight = in_flight;
+    stats.max_in_flight = in_flight;
+    reset_ns = depth_change_ns = io_stats_now();
+}
+
+void uthread_reset_io_stats() {
+    disableInterrupts();
+    reset();
+    enableInterrupts();
+}
+
+// Print a latency histogram, skipping empty buckets
+static void dump_histogram(const char *title, const unsigned long *buckets) {
+    unsigned long total = 0;
+    for (int i = 0; i < IO_STATS_BUCKETS; i++) {
+        total += buckets[i];
+    }
+    fprintf(stderr, "%s (%lu samples)\n", title, total);
+    for (int i = 0; i < IO_STATS_BUCKETS; i++) {
+        if (buckets[i] != 0) {
+            fprintf(stderr, "  %12.3f - %12.3f us %10lu %5.1f%%\n", (1ULL << i) / 1000.0,
+                    (2ULL << i) / 1000.0, buckets[i], 100.0 * buckets[i] / total);
+        }
+    }
+}
+
+// Print a snapshot
+static void dump(const IoStats &snapshot) {
+    fprintf(stderr, "%-8s %10s %10s %10s\n", "class", "submitted", "completed", "failed");
+    for (int i = 0; i < IO_FD_CLASSES; i++) {
+        const IoClassStats &counts = snapshot.classes[i];
+        if (counts.submitted != 0 || counts.completed != 0 || counts.failed != 0) {
+            fprintf(stderr, "%-8s %10lu %10lu %10lu\n", class_names[i], counts.submitted,
+                    counts.completed, counts.failed);
+        }
+    }
+    double avg_depth =
+        snapshot.elapsed_ns != 0 ? (double) snapshot.depth_ns / snapshot.elapsed_ns : 0;
+    fprintf(stderr, "in flight: %u now, %u max, %.2f average over %.3f s\n", snapshot.in_flight,
+            snapshot.max_in_flight, avg_depth, snapshot.elapsed_ns / 1e9);
+    dump_histogram("submit to complete", snapshot.service);
+    dump_histogram("complete to resumed", snapshot.resume);
+}
+
+// Print the statistics to stderr
+void uthread_dump_io_stats() {
+    IoStats snapshot;
+    uthread_get_io_stats(&snapshot);
+    dump(snapshot);
+}
+
+// Timer callback that prints and resets the statistics, then rearms itself
+static void periodic_dump(void *arg) {
+    (void) arg;
+    uint64_t now_ns = io_stats_now();
+    integrate_depth(now_ns);
+    IoStats snapshot = stats;
+    snapshot.elapsed_ns = now_ns - reset_ns;
+    fprintf(stderr, "==== I/O stats ====\n");
+    dump(snapshot);
+    reset();
+    timer_arm(&dump_timer, timer_deadline(dump_interval), periodic_dump, nullptr);
+}
+
+// Print and reset the statistics every interval_usecs
+int uthread_dump_io_stats_every(long interval_usecs) {
+    timer_init();
+    disableInterrupts();
+    timer_cancel(&dump_timer);
+    dump_interval = interval_usecs;
+    if (interval_usecs > 0) {
+        reset();
+        timer_arm(&dump_timer, timer_deadline(interval_usecs), periodic_dump, nullptr);
+    }
+    enableInterrupts();
+    return 0;
+}
+
+#else    // IO_STATS
+
+int uthread_get_io_stats(IoStats *stats) {
+    (void) stats;
+    errno = ENOSYS;
+    return -1;
+}
+
+void uthread_reset_io_stats() {}
+
+// Print a notice that instrumentation is compiled out
+void uthread_dump_io_stats() {
+    fprintf(stderr, "uthread_dump_io_stats: rebuild with IO_STATS=1 to collect I/O stats\n");
+}
+
+int uthread_dump_io_stats_every(long interval_usecs) {
+    (void) interval_usecs;
+    uthread_dump_io_stats();
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif    // IO_STATS
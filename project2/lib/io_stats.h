@@ -0,0 +1,87 @@
+#ifndef IO_STATS_H
+#define IO_STATS_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Opt-in instrumentation of the async I/O operations (see async_io.h)
+// Build with IO_STATS=1 (make IO_STATS=1) to enable. When disabled none of the
+// bookkeeping below is compiled into the I/O engines
+// Latencies are split in two to tell a slow device from a slow scheduler:
+// - submit to complete: from queueing the operation until its completion is
+//   reaped (time spent in the kernel and the device)
+// - complete to resumed: from reaping the completion until the waiting thread
+//   runs again (time spent waiting for the scheduler)
+// NOTE: POSIX aio requests are polled by their thread, so without io_uring the
+//       scheduler delay is part of submit to complete and complete to resumed
+//       stays empty
+
+// Kind of file an operation was carried out on
+enum IoFdClass { IO_FD_FILE, IO_FD_PIPE, IO_FD_SOCKET, IO_FD_OTHER, IO_FD_CLASSES };
+
+#define IO_STATS_BUCKETS 40    // Latency buckets, bucket i counts [2^i, 2^(i+1)) ns
+
+// Operation counts of one fd class
+struct IoClassStats {
+    unsigned long submitted;    // Operations submitted
+    unsigned long completed;    // Operations that succeeded
+    unsigned long failed;       // Operations that failed (including cancelled ones)
+};
+
+// Snapshot of the statistics since they were last reset
+struct IoStats {
+    IoClassStats classes[IO_FD_CLASSES];        // Counts per fd class
+    unsigned long service[IO_STATS_BUCKETS];    // Submit to complete latencies
+    unsigned long resume[IO_STATS_BUCKETS];     // Complete to resumed latencies
+    unsigned in_flight;                         // Operations in flight now
+    unsigned max_in_flight;                     // Most operations in flight at once
+    uint64_t depth_ns;                          // In-flight depth integrated over time
+    uint64_t elapsed_ns;                        // Time covered by the snapshot
+};
+
+#ifdef IO_STATS
+
+// Get a CLOCK_MONOTONIC timestamp in nanoseconds
+inline uint64_t io_stats_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Get the class of fd (costs an fstat())
+IoFdClass io_stats_classify(int fd);
+
+// Record the submission of an operation. Returns its submission timestamp
+// NOTE: Assumes interrupts are disabled
+uint64_t io_stats_submit(IoFdClass fd_class);
+
+// Record the completion at now_ns of an operation submitted at submit_ns
+// NOTE: Assumes interrupts are disabled
+void io_stats_complete(IoFdClass fd_class, uint64_t submit_ns, uint64_t now_ns, bool succeeded);
+
+// Record a thread resuming after being woken by a completion at complete_ns
+// NOTE: Assumes interrupts are disabled
+void io_stats_resumed(uint64_t complete_ns);
+
+#endif    // IO_STATS
+
+// Copy the statistics into stats
+// Output:
+// - 0 on success, -1 if the library was built without IO_STATS
+int uthread_get_io_stats(IoStats *stats);
+
+// Clear the statistics (operations in flight stay counted as in flight)
+void uthread_reset_io_stats();
+
+// Print the statistics to stderr. Prints a notice if the library was built
+// without IO_STATS
+void uthread_dump_io_stats();
+
+// Print and reset the statistics every interval_usecs from the timer service
+// thread, so every dump covers one interval. An interval of 0 stops the dumps
+// Output:
+// - 0 on success, -1 if the library was built without IO_STATS
+// NOTE: Must be called with interrupts enabled
+int uthread_dump_io_stats_every(long interval_usecs);
+
+#endif    // IO_STATS_H
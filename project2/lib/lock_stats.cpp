@@ -0,0 +1,139 @@
+#include "lock_stats.h"
+
+#include <errno.h>
+#include <stdio.h>
+
+#ifdef LOCK_STATS
+
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+static LockStats *registry = nullptr;                        // All live objects
+static std::atomic_flag registry_lock = ATOMIC_FLAG_INIT;    // Guards the registry
+
+// NOTE: A raw flag is used instead of SpinLock since SpinLock itself registers
+//       here. Objects are created rarely so spinning is fine
+static void registry_acquire() {
+    while (registry_lock.test_and_set(std::memory_order_acquire));
+}
+
+static void registry_release() {
+    registry_lock.clear(std::memory_order_release);
+}
+
+LockStats::LockStats(const char *name, const char *type)
+    : name(name),
+      type(type),
+      acquisitions(0),
+      contended(0),
+      total_wait_ns(0),
+      max_wait_ns(0),
+      total_hold_ns(0),
+      max_hold_ns(0),
+      prev(nullptr) {
+    registry_acquire();
+    next = registry;
+    if (registry != nullptr) {
+        registry->prev = this;
+    }
+    registry = this;
+    registry_release();
+}
+
+LockStats::~LockStats() {
+    registry_acquire();
+    if (prev != nullptr) {
+        prev->next = next;
+    } else {
+        registry = next;
+    }
+    if (next != nullptr) {
+        next->prev = prev;
+    }
+    registry_release();
+}
+
+// Record an acquisition that waited wait_ns nanoseconds
+void LockStats::record_wait(uint64_t wait_ns, bool was_contended) {
+    acquisitions++;
+    if (was_contended) {
+        contended++;
+    }
+    total_wait_ns += wait_ns;
+    max_wait_ns = std::max(max_wait_ns, wait_ns);
+}
+
+// Record a release after holding for hold_ns nanoseconds
+void LockStats::record_hold(uint64_t hold_ns) {
+    total_hold_ns += hold_ns;
+    max_hold_ns = std::max(max_hold_ns, hold_ns);
+}
+
+// Copy the counters of the live object named name
+int uthread_get_lock_stats(const char *name, LockCounters *counters) {
+    registry_acquire();
+    for (LockStats *stats = registry; stats != nullptr; stats = stats->next) {
+        if (stats->name != nullptr && strcmp(stats->name, name) == 0) {
+            *counters = { stats->acquisitions, stats->contended, stats->total_wait_ns,
+                          stats->max_wait_ns, stats->total_hold_ns, stats->max_hold_ns };
+            registry_release();
+            return 0;
+        }
+    }
+    registry_release();
+    errno = ENOENT;
+    return -1;
+}
+
+// Print the statistics of every live object sorted by total wait time
+void uthread_dump_lock_stats() {
+    // Copy the counters out so printing does not hold the registry lock
+    struct Row {
+        const char *name;
+        const char *type;
+        unsigned long acquisitions;
+        unsigned long contended;
+        uint64_t total_wait_ns;
+        uint64_t max_wait_ns;
+        uint64_t total_hold_ns;
+        uint64_t max_hold_ns;
+    };
+    std::vector<Row> rows;
+    registry_acquire();
+    for (LockStats *stats = registry; stats != nullptr; stats = stats->next) {
+        rows.push_back({ stats->name, stats->type, stats->acquisitions, stats->contended,
+                         stats->total_wait_ns, stats->max_wait_ns, stats->total_hold_ns,
+                         stats->max_hold_ns });
+    }
+    registry_release();
+    std::sort(rows.begin(), rows.end(),
+              [](const Row &a, const Row &b) { return a.total_wait_ns > b.total_wait_ns; });
+
+    fprintf(stderr, "%-24s %-8s %10s %10s %12s %12s %12s %12s\n", "name", "type", "acquired",
+            "contended", "wait(us)", "maxwait(us)", "hold(us)", "maxhold(us)");
+    for (const Row &row : rows) {
+        fprintf(stderr, "%-24s %-8s %10lu %10lu %12.1f %12.1f %12.1f %12.1f\n",
+                row.name != nullptr ? row.name : "<unnamed>", row.type, row.acquisitions,
+                row.contended, row.total_wait_ns / 1000.0, row.max_wait_ns / 1000.0,
+                row.total_hold_ns / 1000.0, row.max_hold_ns / 1000.0);
+    }
+}
+
+#else    // LOCK_STATS
+
+int uthread_get_lock_stats(const char *name, LockCounters *counters) {
+    (void) name;
+    (void) counters;
+    errno = ENOSYS;
+    return -1;
+}
+
+// Print a notice that profiling is compiled out
+void uthread_dump_lock_stats() {
+    fprintf(stderr, "uthread_dump_lock_stats: rebuild with LOCK_STATS=1 to collect lock stats\n");
+}
+
+#endif    // LOCK_STATS
@@ -0,0 +1,74 @@
+#ifndef LOCK_STATS_H
+#define LOCK_STATS_H
+
+// Opt-in contention profiling for Lock, SpinLock, CondVar and Combiner
+// Build with LOCK_STATS=1 (make LOCK_STATS=1) to enable. When disabled none of
+// the bookkeeping below is compiled into the synchronization primitives
+
+#include <stdint.h>
+
+// Counters of one synchronization object, as copied out by
+// uthread_get_lock_stats() (see LockStats for their meaning)
+struct LockCounters {
+    unsigned long acquisitions;    // Number of times acquired
+    unsigned long contended;       // Number of acquisitions that had to wait
+    uint64_t total_wait_ns;        // Total time spent waiting to acquire
+    uint64_t max_wait_ns;          // Longest single wait
+    uint64_t total_hold_ns;        // Total time the lock was held
+    uint64_t max_hold_ns;          // Longest single hold
+};
+
+#ifdef LOCK_STATS
+
+#include <time.h>
+
+// Contention statistics for a single synchronization object
+// NOTE: For a CondVar, acquisitions counts completed waits, contended counts
+//       waits that timed out, and the wait time is the time spent blocked.
+//       For a Combiner, acquisitions counts batches, contended counts batches
+//       that ran more than one operation, and the hold time is the batch time
+struct LockStats {
+    const char *name;              // User supplied name (may be nullptr)
+    const char *type;              // "Lock", "SpinLock", "CondVar" or "Combiner"
+    unsigned long acquisitions;    // Number of times acquired
+    unsigned long contended;       // Number of acquisitions that had to wait
+    uint64_t total_wait_ns;        // Total time spent waiting to acquire
+    uint64_t max_wait_ns;          // Longest single wait
+    uint64_t total_hold_ns;        // Total time the lock was held
+    uint64_t max_hold_ns;          // Longest single hold
+    LockStats *prev;               // Previous object in the registry
+    LockStats *next;               // Next object in the registry
+
+    // Register/unregister the object so it shows up in uthread_dump_lock_stats()
+    LockStats(const char *name, const char *type);
+    ~LockStats();
+
+    // Record an acquisition that waited wait_ns nanoseconds
+    void record_wait(uint64_t wait_ns, bool was_contended);
+
+    // Record a release after holding for hold_ns nanoseconds
+    void record_hold(uint64_t hold_ns);
+};
+
+// Get a CLOCK_MONOTONIC timestamp in nanoseconds
+inline uint64_t lock_stats_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+#endif    // LOCK_STATS
+
+// Copy the counters of the live Lock, SpinLock, CondVar or Combiner named name
+// (the first one found if several share it) into counters
+// Output:
+// - 0 on success, -1 with errno ENOENT if no live object has the name, or
+//   ENOSYS if the library was built without LOCK_STATS
+int uthread_get_lock_stats(const char *name, LockCounters *counters);
+
+// Print the statistics of every live Lock, SpinLock, CondVar and Combiner to stderr,
+// sorted by total wait time (hottest first). Prints a notice if the library
+// was built without LOCK_STATS
+void uthread_dump_lock_stats();
+
+#endif    // LOCK_STATS_H
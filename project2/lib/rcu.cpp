@@ -0,0 +1,108 @@
+#include "rcu.h"
+
+#include <atomic>
+#include <climits>
+
+#include "debug.cpp"
+#include "uthread.h"
+#include "uthread_private.h"
+
+// Read-side state of one thread, padded so readers never share a cache line
+struct alignas(64) RcuReader {
+    std::atomic<unsigned long> epoch;    // Epoch the outermost section began in, 0 if quiescent
+    int nesting;                         // Read-side critical section depth
+};
+
+static RcuReader readers[MAX_THREAD_NUM];             // Indexed by thread id
+static std::atomic<unsigned long> global_epoch(1);    // Advanced by retire/synchronize
+
+static RcuHead *retired = nullptr;       // Objects waiting to be reclaimed
+static int retired_since_reclaim = 0;    // Retired objects since the last rcu_reclaim()
+
+// Get the oldest epoch a reader is still in, ULONG_MAX if every thread is
+// quiescent
+static unsigned long oldest_reader() {
+    unsigned long oldest = ULONG_MAX;
+    for (int i = 0; i < MAX_THREAD_NUM; i++) {
+        unsigned long epoch = readers[i].epoch.load(std::memory_order_acquire);
+        if (epoch != 0 && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+    return oldest;
+}
+
+// Enter a read-side critical section
+void rcu_read_lock() {
+    RcuReader &reader = readers[running->getId()];
+    if (reader.nesting++ == 0) {
+        // Pointer loads in the section must not move above this store
+        reader.epoch.store(global_epoch.load(std::memory_order_relaxed),
+                           std::memory_order_seq_cst);
+    }
+}
+
+// Leave a read-side critical section
+void rcu_read_unlock() {
+    RcuReader &reader = readers[running->getId()];
+    if (--reader.nesting == 0) {
+        reader.epoch.store(0, std::memory_order_release);
+    }
+}
+
+// Wait until every read-side critical section that started before the call
+// has finished
+void rcu_synchronize() {
+    unsigned long target = global_epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+    // Readers in an older epoch may still see the old version
+    while (oldest_reader() < target) {
+        uthread_yield();
+    }
+    PRINT("Thread %d synchronized epoch %lu\n", running->getId(), target);
+    rcu_reclaim();
+}
+
+// Queue an object to be reclaimed once no reader can see it
+void rcu_retire(RcuHead *head, void (*free_fn)(RcuHead *head)) {
+    head->free_fn = free_fn;
+    // Readers that enter after the increment cannot see the unlinked object
+    head->epoch = global_epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+    disableInterrupts();
+    head->next = retired;
+    retired = head;
+    bool reclaim = ++retired_since_reclaim >= RCU_RECLAIM_BATCH;
+    enableInterrupts();
+    if (reclaim) {
+        rcu_reclaim();
+    }
+}
+
+// Reclaim every retired object that no reader can see anymore
+int rcu_reclaim() {
+    unsigned long oldest = oldest_reader();
+    // Detach the reclaimable objects so the callbacks run with interrupts enabled
+    RcuHead *done = nullptr;
+    disableInterrupts();
+    RcuHead **link = &retired;
+    while (*link != nullptr) {
+        RcuHead *head = *link;
+        if (head->epoch <= oldest) {
+            *link = head->next;
+            head->next = done;
+            done = head;
+        } else {
+            link = &head->next;
+        }
+    }
+    retired_since_reclaim = 0;
+    enableInterrupts();
+
+    int count = 0;
+    while (done != nullptr) {
+        RcuHead *next = done->next;
+        done->free_fn(done);
+        done = next;
+        count++;
+    }
+    return count;
+}
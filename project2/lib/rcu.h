@@ -0,0 +1,45 @@
+#ifndef RCU_H
+#define RCU_H
+
+// Epoch based read-copy-update for read-mostly data
+// Writers publish a new version with an atomic pointer store, then either wait
+// in rcu_synchronize() or hand the old version to rcu_retire(). Readers only
+// write their own (cache line padded) per-thread slot, never shared memory. A
+// thread outside a read-side critical section is in a quiescent state, so a
+// retired object is reclaimed once every thread that could have seen it has
+// left its read-side critical section
+
+#define RCU_RECLAIM_BATCH 32    // Retired objects between reclaim attempts
+
+// Intrusive link for an object waiting to be reclaimed. Embed it in the object
+// and recover the object in the free callback
+struct RcuHead {
+    RcuHead *next = nullptr;                     // Next retired object
+    unsigned long epoch = 0;                     // Epoch the object was retired in
+    void (*free_fn)(RcuHead *head) = nullptr;    // Called once no reader can see it
+};
+
+// Enter a read-side critical section. Pointers loaded inside the section stay
+// valid until the matching rcu_read_unlock(). Sections may be nested
+// NOTE: Threads may be preempted inside a read-side critical section but must
+//       not block on something a writer in rcu_synchronize() is waiting for
+void rcu_read_lock();
+
+// Leave a read-side critical section
+void rcu_read_unlock();
+
+// Wait until every read-side critical section that started before the call
+// has finished. Yields to the readers while waiting
+// NOTE: Must not be called inside a read-side critical section
+void rcu_synchronize();
+
+// Reclaim the object that contains head with free_fn(head) once every
+// read-side critical section that may still see it has finished. Does not
+// block
+void rcu_retire(RcuHead *head, void (*free_fn)(RcuHead *head));
+
+// Reclaim every retired object that no reader can see anymore. Returns the
+// number of objects reclaimed
+int rcu_reclaim();
+
+#endif    // RCU_H
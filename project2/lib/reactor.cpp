@@ -0,0 +1,288 @@
+#include "reactor.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "WaitQueue.h"
+#include "debug.cpp"
+#include "timer.h"
+#include "uthread_private.h"
+
+#define NSEC_PER_MSEC 1000000L
+
+// Thread blocked in reactor_wait(). Lives on the waiting thread's stack
+struct ReactorWaiter : WaitNode, IoWaiter {
+    unsigned events;    // Events the thread is waiting for
+    int revents;        // Ready events, -1 if woken by reactor_shutdown() or
+                        // aborted
+};
+
+static int epoll_fd = -1;                      // epoll instance, -1 if not set up
+static int wake_fd = -1;                       // eventfd written by reactor_shutdown()
+static bool setup_tried = false;               // true once setup has been attempted
+static volatile sig_atomic_t shut_down = 0;    // Set by reactor_shutdown()
+static int num_waiters = 0;                    // Threads blocked in reactor_wait()
+static EventSource source;                     // Registration with the service thread
+
+// Waiters of every fd in lazily allocated chunks (tag bit: fd is registered)
+static WaitQueue *chunks[REACTOR_MAX_FDS / REACTOR_CHUNK];
+
+// Create the epoll instance. Returns 0 on success, -1 on failure
+// NOTE: Assumes interrupts are disabled
+static int reactor_setup() {
+    int fd = epoll_create1(EPOLL_CLOEXEC);
+    if (fd == -1) {
+        perror("epoll_create1");
+        return -1;
+    }
+    wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wake_fd == -1) {
+        perror("eventfd");
+        close(fd);
+        return -1;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = wake_fd;
+    if (epoll_ctl(fd, EPOLL_CTL_ADD, wake_fd, &event) == -1) {
+        perror("epoll_ctl");
+        close(wake_fd);
+        close(fd);
+        wake_fd = -1;
+        return -1;
+    }
+    epoll_fd = fd;
+    return 0;
+}
+
+// Get the waiters of fd, allocating its table chunk if needed
+// NOTE: Must be called with interrupts enabled
+static WaitQueue *fd_waiters(int fd) {
+    WaitQueue *&chunk = chunks[fd / REACTOR_CHUNK];
+    if (chunk == nullptr) {
+        WaitQueue *new_chunk = new WaitQueue[REACTOR_CHUNK];
+        disableInterrupts();
+        if (chunk == nullptr) {
+            chunk = new_chunk;
+            new_chunk = nullptr;
+        }
+        enableInterrupts();
+        delete[] new_chunk;
+    }
+    return &chunk[fd % REACTOR_CHUNK];
+}
+
+// (Re)arm the one-shot registration of fd with the events of its waiters
+// Returns 0 on success, -1 on failure
+// NOTE: Assumes interrupts are disabled
+static int arm(int fd, WaitQueue *waiters) {
+    struct epoll_event event;
+    event.events = EPOLLONESHOT;
+    event.data.fd = fd;
+    WaitNode *node = waiters->front();
+    do {
+        event.events |= ((ReactorWaiter *) node)->events;
+        node = node->next;
+    } while (node != waiters->front());
+    int ret_val = epoll_ctl(epoll_fd, waiters->tag() ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event);
+    // Closing an fd removes it from the epoll set, so the fd may have been
+    // reused since it was registered
+    if (ret_val == -1 && errno == ENOENT) {
+        ret_val = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    } else if (ret_val == -1 && errno == EEXIST) {
+        ret_val = epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+    }
+    if (ret_val == 0) {
+        waiters->set_tag(true);
+    }
+    return ret_val;
+}
+
+// Unlink a waiter and make it ready
+// NOTE: Assumes interrupts are disabled
+static void wake(WaitQueue *waiters, ReactorWaiter *waiter, int revents) {
+    waiters->remove(waiter);
+    waiter->revents = revents;
+    num_waiters--;
+    waiter->tcb->setState(READY);
+    addToReady(waiter->tcb);
+    PRINT("Thread %d woken by reactor (%d)\n", waiter->tcb->getId(), revents);
+}
+
+// Wake a thread blocked in reactor_wait() before its fd became ready
+// NOTE: Assumes interrupts are disabled
+static bool abort_wait(IoWaiter *io_waiter) {
+    ReactorWaiter *waiter = static_cast<ReactorWaiter *>(io_waiter);
+    if (waiter->revents != 0) {
+        return false;    // Already woken
+    }
+    wake(waiter->queue, waiter, -1);
+    return true;
+}
+
+// Wake every waiter after reactor_shutdown()
+// NOTE: Assumes interrupts are disabled
+static void wake_all() {
+    uint64_t count;
+    if (read(wake_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        perror("read");
+    }
+    for (int i = 0; i < REACTOR_MAX_FDS / REACTOR_CHUNK && num_waiters > 0; i++) {
+        if (chunks[i] == nullptr) {
+            continue;
+        }
+        for (int j = 0; j < REACTOR_CHUNK; j++) {
+            while (!chunks[i][j].empty()) {
+                wake(&chunks[i][j], (ReactorWaiter *) chunks[i][j].front(), -1);
+            }
+        }
+    }
+}
+
+// Wake the threads waiting for the harvested events. Returns true if a thread
+// was woken
+// NOTE: Assumes interrupts are disabled
+static bool dispatch(struct epoll_event *events, int num_events) {
+    bool woken = false;
+    for (int i = 0; i < num_events; i++) {
+        int fd = events[i].data.fd;
+        if (fd == wake_fd) {
+            wake_all();
+            woken = true;
+            continue;
+        }
+        WaitQueue *waiters = &chunks[fd / REACTOR_CHUNK][fd % REACTOR_CHUNK];
+        unsigned ready = events[i].events;
+        // Wake every waiter interested in one of the ready events
+        WaitNode *node = waiters->front();
+        WaitNode *last = node != nullptr ? node->prev : nullptr;
+        while (node != nullptr) {
+            WaitNode *next = node->next;
+            bool is_last = node == last;
+            ReactorWaiter *waiter = (ReactorWaiter *) node;
+            unsigned revents = ready & (waiter->events | EPOLLERR | EPOLLHUP);
+            if (revents != 0) {
+                wake(waiters, waiter, revents);
+                woken = true;
+            }
+            node = is_last ? nullptr : next;
+        }
+        // Keep watching for the remaining waiters
+        if (!waiters->empty() && arm(fd, waiters) == -1) {
+            perror("epoll_ctl");
+        }
+    }
+    return woken;
+}
+
+// Returns true while threads are waiting on fds
+static bool reactor_pending() {
+    return num_waiters > 0;
+}
+
+// Harvest ready events without blocking
+static bool reactor_poll() {
+    struct epoll_event events[REACTOR_EVENTS];
+    int num_events = epoll_wait(epoll_fd, events, REACTOR_EVENTS, 0);
+    return num_events > 0 && dispatch(events, num_events);
+}
+
+// Sleep until an fd is ready or the deadline passes
+static void reactor_idle(const struct timespec *deadline) {
+    int timeout_msecs = -1;
+    if (deadline != nullptr) {
+        // Round up so the deadline has passed when the wait times out
+        struct timespec now = timer_now();
+        long nsecs = (deadline->tv_sec - now.tv_sec) * 1000 * NSEC_PER_MSEC + deadline->tv_nsec -
+                     now.tv_nsec;
+        timeout_msecs = nsecs > 0 ? (nsecs + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC : 0;
+    }
+    struct epoll_event events[REACTOR_EVENTS];
+    int num_events = epoll_wait(epoll_fd, events, REACTOR_EVENTS, timeout_msecs);
+    if (num_events > 0) {
+        dispatch(events, num_events);
+    } else if (num_events == -1 && errno != EINTR) {
+        perror("epoll_wait");
+    }
+}
+
+// Block the running thread until fd is ready for any of events
+int reactor_wait(int fd, unsigned events, const IoControl *ctl) {
+    if (fd < 0 || fd >= REACTOR_MAX_FDS) {
+        errno = EBADF;
+        return -1;
+    }
+    if (ctl != nullptr) {
+        int error = io_control_check(ctl);
+        if (error != 0) {
+            errno = error;
+            return -1;
+        }
+    }
+    disableInterrupts();
+    bool first = !setup_tried;
+    setup_tried = true;
+    bool ready = first && reactor_setup() == 0;
+    enableInterrupts();
+    if (ready) {
+        source.pending = reactor_pending;
+        source.poll = reactor_poll;
+        source.wait = reactor_idle;
+        source.fd = epoll_fd;
+        timer_add_source(&source);
+    }
+    if (epoll_fd == -1) {
+        errno = ENOSYS;
+        return -1;
+    }
+    WaitQueue *waiters = fd_waiters(fd);
+
+    disableInterrupts();
+    if (shut_down) {
+        enableInterrupts();
+        errno = EINTR;
+        return -1;
+    }
+    ReactorWaiter waiter;
+    waiter.tcb = running;
+    waiter.events = events;
+    waiter.revents = 0;
+    waiters->push(&waiter);
+    if (arm(fd, waiters) == -1) {
+        int error = errno;
+        waiters->remove(&waiter);
+        enableInterrupts();
+        errno = error;
+        return -1;
+    }
+    num_waiters++;
+    if (ctl != nullptr) {
+        io_waiter_arm(&waiter, ctl, abort_wait);
+    }
+    // Park until the service thread sees the fd become ready
+    running->setState(BLOCK);
+    PRINT("Thread %d waiting on fd %d\n", running->getId(), fd);
+    timer_wake();
+    switchThreads();
+    int error = ctl != nullptr ? io_waiter_disarm(&waiter) : 0;
+    enableInterrupts();
+    if (waiter.revents == -1) {
+        errno = error != 0 ? error : EINTR;
+        return -1;
+    }
+    return waiter.revents;
+}
+
+// Wake every thread blocked in reactor_wait()
+void reactor_shutdown() {
+    shut_down = 1;
+    if (wake_fd != -1) {
+        uint64_t one = 1;
+        ssize_t ret_val = write(wake_fd, &one, sizeof(one));
+        (void) ret_val;
+    }
+}
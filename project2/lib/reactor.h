@@ -0,0 +1,31 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <sys/epoll.h>
+
+#include "cancel.h"
+
+// epoll readiness reactor for sockets, pipes and other pollable fds
+// A thread registers interest in an fd and parks. The timer service thread
+// harvests events every time it runs (and sleeps in epoll_wait() when every
+// thread is waiting) and wakes exactly the threads whose fd became ready
+
+#define REACTOR_MAX_FDS 65536    // fds must be below this value
+#define REACTOR_CHUNK 1024       // fds per lazily allocated table chunk
+#define REACTOR_EVENTS 64        // Max events harvested per epoll_wait()
+
+// Block the running thread until fd is ready for any of events (e.g. EPOLLIN,
+// EPOLLOUT), or until ctl (optional) aborts the wait. Several threads may wait
+// on the same fd
+// Returns the ready events (EPOLLERR and EPOLLHUP are always reported) on
+// success, -1 on failure (errno is EINTR after reactor_shutdown(), ETIMEDOUT
+// or ECANCELED if ctl aborted the wait)
+// NOTE: Must be called with interrupts enabled
+int reactor_wait(int fd, unsigned events, const IoControl *ctl = nullptr);
+
+// Wake every thread blocked in reactor_wait() and make later calls fail with
+// EINTR (e.g. on SIGINT)
+// NOTE: Async-signal-safe
+void reactor_shutdown();
+
+#endif    // REACTOR_H
@@ -0,0 +1,273 @@
+#include "timer.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+
+#include "deadlock.h"
+#include "debug.cpp"
+#include "uthread_private.h"
+
+#define NSEC_PER_SEC 1000000000L
+#define NSEC_PER_USEC 1000L
+#define USEC_PER_SEC 1000000L
+
+#define MAX_EVENT_SOURCES 8    // Max sources waited on at once
+
+static Timer *timers = nullptr;           // Armed timers sorted by deadline
+static TCB *service = nullptr;            // The timer service thread
+static bool service_parked = false;       // true if the service thread is blocked
+static bool service_started = false;      // true once the service thread is created
+static EventSource *sources = nullptr;    // Registered event sources
+
+// Fire every timer whose deadline has passed
+// NOTE: Assumes interrupts are disabled
+static void fire_expired_timers() {
+    struct timespec now = timer_now();
+    while (timers != nullptr && timer_compare(timers->deadline, now) <= 0) {
+        Timer *timer = timers;
+        timer_cancel(timer);
+        PRINT("Timer %p fired\n", (void *) timer);
+        timer->callback(timer->arg);
+    }
+}
+
+// Get the first event source with outstanding events, nullptr if none
+// NOTE: Assumes interrupts are disabled
+static EventSource *pending_source() {
+    for (EventSource *source = sources; source != nullptr; source = source->next) {
+        if (source->pending()) {
+            return source;
+        }
+    }
+    return nullptr;
+}
+
+// Harvest ready events from every source. Returns true if a thread was woken
+// NOTE: Assumes interrupts are disabled
+static bool poll_sources() {
+    bool woken = false;
+    for (EventSource *source = sources; source != nullptr; source = source->next) {
+        woken |= source->poll();
+    }
+    return woken;
+}
+
+// Sleep until one of the pending sources is ready or the deadline (if not
+// nullptr) passes, then harvest the ready events
+// NOTE: Assumes interrupts are disabled
+static void wait_sources(const struct timespec *deadline) {
+    // Harvest first, the fds only report events that arrive from now on
+    if (poll_sources()) {
+        return;
+    }
+    struct pollfd pfds[MAX_EVENT_SOURCES];
+    int nfds = 0;
+    for (EventSource *source = sources; source != nullptr && nfds < MAX_EVENT_SOURCES;
+         source = source->next) {
+        if (source->pending()) {
+            pfds[nfds].fd = source->fd;
+            pfds[nfds].events = POLLIN;
+            nfds++;
+        }
+    }
+    struct timespec timeout;
+    if (deadline != nullptr) {
+        struct timespec now = timer_now();
+        long nsecs = (deadline->tv_sec - now.tv_sec) * NSEC_PER_SEC + deadline->tv_nsec -
+                     now.tv_nsec;
+        if (nsecs < 0) {
+            nsecs = 0;
+        }
+        timeout.tv_sec = nsecs / NSEC_PER_SEC;
+        timeout.tv_nsec = nsecs % NSEC_PER_SEC;
+    }
+    if (ppoll(pfds, nfds, deadline != nullptr ? &timeout : nullptr, nullptr) == -1 &&
+        errno != EINTR) {
+        perror("ppoll");
+    }
+    poll_sources();
+}
+
+// Sleep in the kernel until the earliest deadline or event. Only called when
+// every other thread is blocked, so nothing can become ready before a timer
+// fires, an event arrives (or a signal arrives)
+static void idle_wait() {
+    disableInterrupts();
+    EventSource *source = pending_source();
+    if (source != nullptr) {
+        const struct timespec *deadline = timers != nullptr ? &timers->deadline : nullptr;
+        // Block in the source itself if no other source is pending
+        bool others = false;
+        for (EventSource *other = source->next; other != nullptr; other = other->next) {
+            others |= other->pending();
+        }
+        if (others) {
+            wait_sources(deadline);
+        } else {
+            source->wait(deadline);
+        }
+        enableInterrupts();
+        return;
+    }
+    if (timers == nullptr) {
+#ifdef DEADLOCK_DETECT
+        // Nothing can ever wake the blocked threads
+        deadlock_all_blocked();
+#endif
+        enableInterrupts();
+        return;
+    }
+    struct timespec deadline = timers->deadline;
+    enableInterrupts();
+    int ret_val = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr);
+    if (ret_val != 0 && ret_val != EINTR) {
+        errno = ret_val;
+        perror("clock_nanosleep");
+    }
+}
+
+// Timer service thread. Fires expired timers, harvests events and keeps the
+// process asleep (instead of spinning) while every thread is waiting on a
+// timer or an event
+static void *timer_service(void *arg) {
+    (void) arg;
+    service = running;
+    while (true) {
+        disableInterrupts();
+        fire_expired_timers();
+        poll_sources();
+#ifndef DEADLOCK_DETECT
+        // Park until a timer is armed or an event source becomes pending if
+        // there is nothing to wait for
+        // NOTE: The deadlock detector keeps the thread running so it can notice
+        //       when every other thread is blocked
+        if (timers == nullptr && pending_source() == nullptr) {
+            service_parked = true;
+            running->setState(BLOCK);
+            switchThreads();
+            enableInterrupts();
+            continue;
+        }
+#endif
+        enableInterrupts();
+        // Let other threads run. If the yield came straight back (only our own
+        // switch was counted) no other thread is ready
+        int quantums = uthread_get_total_quantums();
+        uthread_yield();
+        if (uthread_get_total_quantums() - quantums <= 1) {
+            idle_wait();
+        }
+    }
+    return nullptr;
+}
+
+// Start the timer service thread if it is not already running
+void timer_init() {
+    disableInterrupts();
+    bool start = !service_started;
+    service_started = true;
+    enableInterrupts();
+    if (start && uthread_create(timer_service, nullptr) == -1) {
+        fprintf(stderr, "timer_init: uthread_create failed\n");
+        service_started = false;
+    }
+}
+
+// Have the service thread harvest events from source
+void timer_add_source(EventSource *source) {
+    disableInterrupts();
+    source->next = sources;
+    sources = source;
+    enableInterrupts();
+    timer_init();
+}
+
+// Wake the service thread if it is parked
+void timer_wake() {
+    if (service_parked) {
+        service_parked = false;
+        service->setState(READY);
+        addToReady(service);
+    }
+}
+
+// Arm a timer to call callback(arg) once the deadline passes
+void timer_arm(Timer *timer, const struct timespec &deadline, void (*callback)(void *), void *arg) {
+    timer->deadline = deadline;
+    timer->callback = callback;
+    timer->arg = arg;
+    timer->armed = true;
+    // Insert in deadline order (after timers with an equal deadline)
+    Timer *prev = nullptr;
+    Timer *next = timers;
+    while (next != nullptr && timer_compare(next->deadline, deadline) <= 0) {
+        prev = next;
+        next = next->next;
+    }
+    timer->prev = prev;
+    timer->next = next;
+    if (prev != nullptr) {
+        prev->next = timer;
+    } else {
+        timers = timer;
+    }
+    if (next != nullptr) {
+        next->prev = timer;
+    }
+    // Wake the service thread so it starts watching the deadline
+    timer_wake();
+}
+
+// Disarm a timer
+bool timer_cancel(Timer *timer) {
+    if (!timer->armed) {
+        return false;
+    }
+    if (timer->prev != nullptr) {
+        timer->prev->next = timer->next;
+    } else {
+        timers = timer->next;
+    }
+    if (timer->next != nullptr) {
+        timer->next->prev = timer->prev;
+    }
+    timer->prev = timer->next = nullptr;
+    timer->armed = false;
+    return true;
+}
+
+// Returns true if any timer is armed
+bool timer_pending() {
+    return timers != nullptr;
+}
+
+// Get the current CLOCK_MONOTONIC time
+struct timespec timer_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now;
+}
+
+// Get the absolute deadline timeout_usecs microseconds from now
+struct timespec timer_deadline(long timeout_usecs) {
+    struct timespec deadline = timer_now();
+    if (timeout_usecs < 0) {
+        timeout_usecs = 0;
+    }
+    long nsecs = deadline.tv_nsec + (timeout_usecs % USEC_PER_SEC) * NSEC_PER_USEC;
+    deadline.tv_sec += timeout_usecs / USEC_PER_SEC + nsecs / NSEC_PER_SEC;
+    deadline.tv_nsec = nsecs % NSEC_PER_SEC;
+    return deadline;
+}
+
+// Compare two times
+int timer_compare(const struct timespec &a, const struct timespec &b) {
+    if (a.tv_sec != b.tv_sec) {
+        return a.tv_sec < b.tv_sec ? -1 : 1;
+    }
+    if (a.tv_nsec != b.tv_nsec) {
+        return a.tv_nsec < b.tv_nsec ? -1 : 1;
+    }
+    return 0;
+}
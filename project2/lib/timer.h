@@ -0,0 +1,70 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <time.h>
+
+// One-shot timer fired by the timer service thread once its deadline passes
+// NOTE: Timers are intrusive and are normally embedded in a structure on the
+//       waiting thread's stack, so arming and cancelling never allocate memory
+struct Timer {
+    struct timespec deadline = {0, 0};        // Absolute CLOCK_MONOTONIC expiry time
+    void (*callback)(void *arg) = nullptr;    // Called with interrupts disabled on expiry
+    void *arg = nullptr;                      // Argument passed to the callback
+    Timer *prev = nullptr;                    // Previous timer in the deadline ordered list
+    Timer *next = nullptr;                    // Next timer in the deadline ordered list
+    bool armed = false;                       // true while the timer is in the list
+};
+
+// Source of events harvested by the timer service thread (e.g. I/O
+// completions). While a source is pending the service thread stays awake, and
+// when every other thread is blocked it sleeps in the source's wait() (or
+// ppoll() on the fds of every pending source) instead of clock_nanosleep()
+// NOTE: Every callback is called with interrupts disabled
+struct EventSource {
+    bool (*pending)() = nullptr;    // Returns true while events are outstanding
+    bool (*poll)() = nullptr;       // Harvest ready events without blocking,
+                                    // returns true if a thread was woken
+    // Block until an event arrives or the deadline (if not nullptr) passes,
+    // then harvest the ready events
+    void (*wait)(const struct timespec *deadline) = nullptr;
+    int fd = -1;                    // Readable when events are ready (used to
+                                    // wait on several pending sources at once)
+    EventSource *next = nullptr;    // Next registered source
+};
+
+// Start the timer service thread if it is not already running
+// NOTE: Must be called with interrupts enabled since it may create a thread
+void timer_init();
+
+// Have the service thread harvest events from source (starts the service
+// thread if needed)
+// NOTE: Must be called with interrupts enabled since it may create a thread
+void timer_add_source(EventSource *source);
+
+// Wake the service thread if it is parked, e.g. after a source became pending
+// NOTE: Assumes interrupts are disabled
+void timer_wake();
+
+// Arm a timer to call callback(arg) once the deadline passes
+// NOTE: Assumes interrupts are disabled
+void timer_arm(Timer *timer, const struct timespec &deadline, void (*callback)(void *), void *arg);
+
+// Disarm a timer. Returns true if the timer was armed, false if it already
+// fired or was never armed
+// NOTE: Assumes interrupts are disabled
+bool timer_cancel(Timer *timer);
+
+// Returns true if any timer is armed
+// NOTE: Assumes interrupts are disabled
+bool timer_pending();
+
+// Get the current CLOCK_MONOTONIC time
+struct timespec timer_now();
+
+// Get the absolute deadline timeout_usecs microseconds from now
+struct timespec timer_deadline(long timeout_usecs);
+
+// Compare two times. Returns <0, 0 or >0 like strcmp
+int timer_compare(const struct timespec &a, const struct timespec &b);
+
+#endif    // TIMER_H
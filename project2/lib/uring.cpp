@@ -0,0 +1,392 @@
+#include "uring.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "WaitQueue.h"
+#include "cancel.h"
+#include "debug.cpp"
+#include "timer.h"
+#include "uthread_private.h"
+
+#define NSEC_PER_SEC 1000000000L
+
+static int ring_fd = -1;              // io_uring file descriptor, -1 if unavailable
+static bool ring_tried = false;       // true once setup has been attempted
+static unsigned sq_entries;           // Number of submission queue entries
+static unsigned *sq_head;             // Submission queue head (advanced by the kernel)
+static unsigned *sq_tail;             // Submission queue tail
+static unsigned *sq_mask;             // Submission queue index mask
+static unsigned *sq_array;            // Submission queue indirection array
+static struct io_uring_sqe *sqes;     // Submission queue entries
+static unsigned cq_entries;           // Number of completion queue entries
+static unsigned *cq_head;             // Completion queue head
+static unsigned *cq_tail;             // Completion queue tail (advanced by the kernel)
+static unsigned *cq_mask;             // Completion queue index mask
+static struct io_uring_cqe *cqes;     // Completion queue entries
+static unsigned to_submit = 0;        // Queued submissions not yet passed to the kernel
+static unsigned in_flight = 0;        // Operations whose completion has not been reaped
+static WaitQueue room_queue;          // Threads waiting for room to queue an operation
+static EventSource source;            // Registration with the service thread
+
+// Create the ring and map its queues. Returns 0 on success, -1 on failure
+static int ring_setup() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (fd == -1) {
+        PRINT("io_uring_setup failed (%d), using POSIX aio\n", errno);
+        return -1;
+    }
+    // Timed waits need IORING_ENTER_EXT_ARG (Linux 5.11)
+    if (!(params.features & IORING_FEAT_EXT_ARG)) {
+        close(fd);
+        return -1;
+    }
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap && cq_size > sq_size) {
+        sq_size = cq_size;
+    }
+    char *sq = (char *) mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        return -1;
+    }
+    char *cq = sq;
+    if (!single_mmap) {
+        cq = (char *) mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                           IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) {
+            perror("mmap");
+            munmap(sq, sq_size);
+            close(fd);
+            return -1;
+        }
+    }
+    sqes = (struct io_uring_sqe *) mmap(nullptr, params.sq_entries * sizeof(struct io_uring_sqe),
+                                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                                        IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        perror("mmap");
+        munmap(sq, sq_size);
+        if (!single_mmap) {
+            munmap(cq, cq_size);
+        }
+        close(fd);
+        return -1;
+    }
+    sq_entries = params.sq_entries;
+    sq_head = (unsigned *) (sq + params.sq_off.head);
+    sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    sq_array = (unsigned *) (sq + params.sq_off.array);
+    cq_entries = params.cq_entries;
+    cq_head = (unsigned *) (cq + params.cq_off.head);
+    cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    ring_fd = fd;
+    return 0;
+}
+
+// Pass the queued submissions to the kernel and, if min_complete > 0, wait
+// until that many completions are available or the deadline (if not nullptr)
+// passes
+// NOTE: Assumes interrupts are disabled
+static void ring_enter(unsigned min_complete, const struct timespec *deadline) {
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    struct __kernel_timespec timeout;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if (min_complete > 0 && deadline != nullptr) {
+        // The timeout is relative
+        struct timespec now = timer_now();
+        long nsecs = (deadline->tv_sec - now.tv_sec) * NSEC_PER_SEC + deadline->tv_nsec -
+                     now.tv_nsec;
+        if (nsecs < 0) {
+            nsecs = 0;
+        }
+        timeout.tv_sec = nsecs / NSEC_PER_SEC;
+        timeout.tv_nsec = nsecs % NSEC_PER_SEC;
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = (unsigned long long) &timeout;
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+    int ret_val = syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags,
+                          (flags & IORING_ENTER_EXT_ARG) ? (void *) &arg : nullptr,
+                          (flags & IORING_ENTER_EXT_ARG) ? sizeof(arg) : 0);
+    if (ret_val >= 0) {
+        to_submit -= ret_val;
+    } else if (errno != EINTR && errno != ETIME && errno != EAGAIN && errno != EBUSY) {
+        perror("io_uring_enter");
+    }
+}
+
+// Wake the thread of every available completion. Returns true if a thread was
+// woken
+// NOTE: Assumes interrupts are disabled
+static bool ring_reap() {
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    bool woken = head != tail;
+#ifdef IO_STATS
+    uint64_t now_ns = woken ? io_stats_now() : 0;
+#endif
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+        UringOp *op = (UringOp *) cqe->user_data;
+        in_flight--;
+        // Cancel requests have no operation
+        if (op == nullptr) {
+            continue;
+        }
+        op->result = cqe->res;
+        op->done = true;
+#ifdef IO_STATS
+        io_stats_complete(op->fd_class, op->submit_ns, now_ns, cqe->res >= 0);
+#endif
+        // Wake the waiter once enough operations of its group completed
+        UringGroup *group = op->group;
+        group->completed++;
+        if (group->waiter != nullptr && group->completed >= group->wanted) {
+            group->waiter->setState(READY);
+            addToReady(group->waiter);
+            PRINT("Thread %d I/O completed (%d)\n", group->waiter->getId(), cqe->res);
+            group->waiter = nullptr;
+#ifdef IO_STATS
+            group->woken_ns = now_ns;
+#endif
+        }
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    return woken;
+}
+
+// Returns the number of operations that can be queued right now: the
+// submission queue needs a free entry and the completion queue must be able to
+// hold the completion of every operation in flight (the kernel refuses
+// submissions with EBUSY once completions overflow)
+// NOTE: Assumes interrupts are disabled
+static unsigned ring_room() {
+    unsigned sq_room = sq_entries - (*sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE));
+    unsigned cq_room = cq_entries - in_flight;
+    return sq_room < cq_room ? sq_room : cq_room;
+}
+
+// Wake a thread waiting for room in the ring for every operation that can be
+// queued. Returns true if a thread was woken
+// NOTE: Assumes interrupts are disabled
+static bool ring_wake_queued() {
+    bool woken = false;
+    for (unsigned room = ring_room(); room > 0 && !room_queue.empty(); room--) {
+        TCB *tcb = room_queue.pop()->tcb;
+        tcb->setState(READY);
+        addToReady(tcb);
+        woken = true;
+    }
+    return woken;
+}
+
+// Returns true while operations are queued or in flight
+static bool ring_pending() {
+    return to_submit > 0 || in_flight > 0;
+}
+
+// Submit the queued operations (in one batch) and reap completions
+static bool ring_poll() {
+    if (to_submit > 0) {
+        ring_enter(0, nullptr);
+    }
+    bool woken = ring_reap();
+    return ring_wake_queued() || woken;
+}
+
+// Submit the queued operations and sleep until a completion arrives
+static void ring_wait(const struct timespec *deadline) {
+    ring_enter(1, deadline);
+    ring_reap();
+    ring_wake_queued();
+}
+
+// Returns true if the io_uring engine is usable
+bool uring_available() {
+    disableInterrupts();
+    bool first = !ring_tried;
+    ring_tried = true;
+    bool ready = first && ring_setup() == 0;
+    enableInterrupts();
+    if (ready) {
+        source.pending = ring_pending;
+        source.poll = ring_poll;
+        source.wait = ring_wait;
+        source.fd = ring_fd;
+        timer_add_source(&source);
+    }
+    return ring_fd != -1;
+}
+
+// Register buffers with the ring
+int uring_register_buffers(const struct iovec *iov, unsigned count) {
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS, iov, count) == -1) {
+        return -errno;
+    }
+    return 0;
+}
+
+// Unregister the buffers
+int uring_unregister_buffers() {
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_UNREGISTER_BUFFERS, nullptr, 0) == -1) {
+        return -errno;
+    }
+    return 0;
+}
+
+// Queue a submission tagged with user_data. Blocks the running thread while
+// the ring has no room for it
+// NOTE: Assumes interrupts are disabled
+static void ring_queue(const struct io_uring_sqe &sqe, unsigned long long user_data) {
+    bool queued = false;
+    while (ring_room() == 0) {
+        // A full submission queue is passed to the kernel right away (it may
+        // refuse it for now, e.g. with EAGAIN)
+        if (in_flight < cq_entries) {
+            ring_enter(0, nullptr);
+            if (ring_room() > 0) {
+                break;
+            }
+        }
+        // Park until the service thread has submitted or reaped enough. A
+        // thread that lost its turn to another submitter stays first in line
+        WaitNode node;
+        node.tcb = running;
+        if (queued) {
+            room_queue.push_front(&node);
+        } else {
+            room_queue.push(&node);
+        }
+        queued = true;
+        PRINT("Thread %d waiting for room in the ring\n", running->getId());
+        running->setState(BLOCK);
+        timer_wake();
+        switchThreads();
+    }
+    unsigned tail = *sq_tail;
+    unsigned index = tail & *sq_mask;
+    sqes[index] = sqe;
+    sqes[index].user_data = user_data;
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    to_submit++;
+    in_flight++;
+}
+
+// Queue an operation of group without waiting for it
+void uring_submit(const struct io_uring_sqe &sqe, UringOp *op, UringGroup *group) {
+    op->result = 0;
+    op->done = false;
+    op->group = group;
+#ifdef IO_STATS
+    op->fd_class = io_stats_classify(sqe.fd);
+#endif
+    disableInterrupts();
+#ifdef IO_STATS
+    op->submit_ns = io_stats_submit(op->fd_class);
+#endif
+    ring_queue(sqe, (unsigned long long) op);
+    enableInterrupts();
+}
+
+// Ask the kernel to cancel a queued operation
+void uring_cancel(UringOp *op) {
+    struct io_uring_sqe sqe;
+    uring_prep_rw(&sqe, IORING_OP_ASYNC_CANCEL, -1, op, 0, 0);
+    disableInterrupts();
+    if (!op->done) {
+        ring_queue(sqe, 0);
+    }
+    enableInterrupts();
+}
+
+// Thread blocked in uring_wait() under an IoControl
+struct UringWaiter : IoWaiter {
+    UringGroup *group;    // Group the thread waits on
+};
+
+// Wake a thread blocked in uring_wait() before its operations completed
+// NOTE: Assumes interrupts are disabled
+static bool abort_wait(IoWaiter *waiter) {
+    UringGroup *group = ((UringWaiter *) waiter)->group;
+    if (group->waiter == nullptr) {
+        return false;    // Already woken by its completions
+    }
+    group->waiter->setState(READY);
+    addToReady(group->waiter);
+    group->waiter = nullptr;
+    return true;
+}
+
+// Block the running thread until count operations of group have completed
+int uring_wait(UringGroup *group, unsigned count, const IoControl *ctl) {
+    int error = 0;
+    if (ctl != nullptr && group->completed < count) {
+        error = io_control_check(ctl);
+    }
+    disableInterrupts();
+    if (group->completed < count && error == 0) {
+        group->waiter = running;
+        group->wanted = count;
+        UringWaiter waiter;
+        waiter.group = group;
+        if (ctl != nullptr) {
+            io_waiter_arm(&waiter, ctl, abort_wait);
+        }
+        // Park until the service thread reaps the completions
+        running->setState(BLOCK);
+        timer_wake();
+        switchThreads();
+        if (ctl != nullptr) {
+            error = io_waiter_disarm(&waiter);
+        }
+#ifdef IO_STATS
+        // Time spent ready before running again
+        if (group->woken_ns != 0) {
+            io_stats_resumed(group->woken_ns);
+            group->woken_ns = 0;
+        }
+#endif
+    }
+    enableInterrupts();
+    return group->completed >= count ? 0 : error;
+}
+
+// Submit one operation and block the running thread until it completes
+int uring_execute(const struct io_uring_sqe &sqe, const IoControl *ctl) {
+    if (ctl != nullptr) {
+        int error = io_control_check(ctl);
+        if (error != 0) {
+            return -error;
+        }
+    }
+    UringGroup group;
+    UringOp op;
+    uring_submit(sqe, &op, &group);
+    int error = uring_wait(&group, 1, ctl);
+    if (error != 0) {
+        // The buffers stay in use until the kernel drops the operation
+        uring_cancel(&op);
+        uring_wait(&group, 1);
+        // The operation may have completed before the cancellation reached it
+        if (op.result == -ECANCELED || op.result == -EINTR) {
+            return -error;
+        }
+    }
+    return op.result;
+}
@@ -0,0 +1,103 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "cancel.h"
+#include "io_stats.h"
+
+// io_uring engine for the async I/O functions
+// Threads queue a submission and park. The timer service thread passes every
+// queued submission to the kernel in one io_uring_enter() call, reaps the
+// completions and wakes exactly the threads they belong to. When every thread
+// is waiting it sleeps in io_uring_enter() until a completion arrives. No
+// more operations are in flight than the completion queue holds; submitters
+// past that (or facing a full submission queue) park until there is room
+// NOTE: The ring is driven with raw system calls (no liburing dependency)
+
+#define URING_ENTRIES 256    // Submission queue size
+
+class TCB;
+
+// Operations a thread submits together and waits on
+struct UringGroup {
+    TCB *waiter = nullptr;     // Thread blocked in uring_wait(), if any
+    unsigned wanted = 0;       // Completions the waiter needs
+    unsigned completed = 0;    // Operations of the group completed so far
+#ifdef IO_STATS
+    uint64_t woken_ns = 0;     // Time the waiter was woken by a completion
+#endif
+};
+
+// Operation queued with uring_submit(). Must stay alive until it completes
+struct UringOp {
+    int result;            // Completion result (>= 0 on success, -errno on failure)
+    bool done;             // true once the completion was reaped
+    UringGroup *group;     // Group the operation belongs to
+#ifdef IO_STATS
+    IoFdClass fd_class;    // Kind of file the operation is on
+    uint64_t submit_ns;    // Time the operation was queued
+#endif
+};
+
+// Returns true if the io_uring engine is usable. The ring (and the service
+// thread) is set up on the first call
+// NOTE: Must be called with interrupts enabled
+bool uring_available();
+
+// Submit one operation and block the running thread until it completes. The
+// sqe is copied, so it may live on the caller's stack (user_data is ignored)
+// If ctl (optional) aborts the wait, the operation is cancelled in the kernel
+// and the thread stays blocked until the kernel has dropped it
+// Returns the completion result (>= 0 on success, -errno on failure, i.e.
+// -ETIMEDOUT or -ECANCELED if the operation was cancelled)
+// NOTE: Must be called with interrupts enabled after uring_available()
+//       returned true
+int uring_execute(const struct io_uring_sqe &sqe, const IoControl *ctl = nullptr);
+
+// Queue an operation of group without waiting for it (the thread only blocks
+// while the ring is full). The sqe is copied (user_data is ignored). Queued
+// operations are passed to the kernel in one batch when a thread waits or the
+// service thread next runs
+// NOTE: Must be called with interrupts enabled after uring_available()
+//       returned true
+void uring_submit(const struct io_uring_sqe &sqe, UringOp *op, UringGroup *group);
+
+// Block the running thread until count operations of group have completed
+// (counting every completion since the group was created), or until ctl
+// (optional) aborts the wait. Operations still in flight after an abort must
+// be cancelled with uring_cancel() and waited for again before their buffers
+// are released
+// Returns 0 once count operations completed, ETIMEDOUT or ECANCELED if the
+// wait was aborted first
+// NOTE: Must be called with interrupts enabled
+int uring_wait(UringGroup *group, unsigned count, const IoControl *ctl = nullptr);
+
+// Ask the kernel to cancel a queued operation. Its completion still arrives
+// (normally with -ECANCELED) once the kernel no longer references its buffers
+// NOTE: Must be called with interrupts enabled after uring_available()
+//       returned true
+void uring_cancel(UringOp *op);
+
+// Register buffers with the ring so fixed reads/writes skip per-I/O page
+// pinning. Returns 0 on success, -errno on failure
+// NOTE: Must be called after uring_available() returned true
+int uring_register_buffers(const struct iovec *iov, unsigned count);
+
+// Unregister the buffers. Returns 0 on success, -errno on failure
+int uring_unregister_buffers();
+
+// Fill in sqe for a read/write style operation
+inline void uring_prep_rw(struct io_uring_sqe *sqe, int opcode, int fd, const void *addr,
+                          unsigned len, unsigned long long offset) {
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long) addr;
+    sqe->len = len;
+    sqe->off = offset;
+}
+
+#endif    // URING_H
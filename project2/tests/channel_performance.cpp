@@ -0,0 +1,157 @@
+#include <chrono>
+#include <iostream>
+
+#include "../lib/Channel.h"
+#include "../lib/CondVar.h"
+#include "../lib/Lock.h"
+#include "../lib/uthread.h"
+
+// Bounded buffer guarded by one Lock and two CondVars (the design the HTTP
+// server's connection_queue used before switching to Channel)
+class LockedQueue {
+public:
+    explicit LockedQueue(int capacity)
+        : items(new int[capacity]), capacity(capacity), length(0), read_idx(0), write_idx(0) {}
+    ~LockedQueue() { delete[] items; }
+
+    void send(int value) {
+        lock.lock();
+        while (length == capacity) {
+            full_cv.wait(lock);
+        }
+        items[write_idx] = value;
+        write_idx = (write_idx + 1) % capacity;
+        length++;
+        empty_cv.signal();
+        lock.unlock();
+    }
+
+    int recv() {
+        lock.lock();
+        while (length == 0) {
+            empty_cv.wait(lock);
+        }
+        int value = items[read_idx];
+        read_idx = (read_idx + 1) % capacity;
+        length--;
+        full_cv.signal();
+        lock.unlock();
+        return value;
+    }
+
+private:
+    int *items;
+    int capacity;
+    int length;
+    int read_idx;
+    int write_idx;
+    Lock lock;
+    CondVar empty_cv;
+    CondVar full_cv;
+};
+
+struct ThreadArgs {
+    int n_items;    // Items sent/received by each thread
+    LockedQueue *locked_queue;
+    Channel<int> *channel;
+};
+
+volatile long consumed_sum = 0;
+
+void *produce_locked(void *args) {
+    ThreadArgs *params = (ThreadArgs *) args;
+    for (int i = 0; i < params->n_items; i++) {
+        params->locked_queue->send(i);
+    }
+    return nullptr;
+}
+
+void *consume_locked(void *args) {
+    ThreadArgs *params = (ThreadArgs *) args;
+    long sum = 0;
+    for (int i = 0; i < params->n_items; i++) {
+        sum += params->locked_queue->recv();
+    }
+    consumed_sum += sum;
+    return nullptr;
+}
+
+void *produce_channel(void *args) {
+    ThreadArgs *params = (ThreadArgs *) args;
+    for (int i = 0; i < params->n_items; i++) {
+        params->channel->send(i);
+    }
+    return nullptr;
+}
+
+void *consume_channel(void *args) {
+    ThreadArgs *params = (ThreadArgs *) args;
+    long sum = 0;
+    int value;
+    for (int i = 0; i < params->n_items; i++) {
+        params->channel->recv(value);
+        sum += value;
+    }
+    consumed_sum += sum;
+    return nullptr;
+}
+
+void run_test(void *(*producer)(void *), void *(*consumer)(void *), const std::string &queue_type,
+              int nthreads, int nitems, ThreadArgs *args) {
+    consumed_sum = 0;
+    // Start timer
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    int *tids = (int *) malloc(sizeof(int) * nthreads * 2);
+    for (int i = 0; i < nthreads; ++i) {
+        tids[2 * i] = uthread_create(producer, args);
+        tids[2 * i + 1] = uthread_create(consumer, args);
+        if (tids[2 * i] == -1 || tids[2 * i + 1] == -1) {
+            std::cerr << "uthread_create\n";
+        }
+    }
+
+    for (int i = 0; i < nthreads * 2; ++i) {
+        if (uthread_join(tids[i], nullptr) != 0) {
+            std::cerr << "uthread_join\n";
+        }
+    }
+
+    // Stop timer
+    auto end_time = std::chrono::high_resolution_clock::now();
+    double duration = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+
+    long expected = (long) nthreads * nitems * (nitems - 1) / 2;
+    std::cout << queue_type << " with " << nthreads << " producers/consumers, " << nitems
+              << " items/thread completed in " << duration << " ms ("
+              << (consumed_sum == expected ? "correct" : "INCORRECT") << ")" << std::endl;
+
+    free(tids);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 5) {
+        std::cerr << "Usage: ./channelperformance <nthreads> <nitems> <capacity> <quantum>\n";
+        exit(1);
+    }
+
+    const int num_threads = atoi(argv[1]);
+    const int num_items = atoi(argv[2]);
+    const int capacity = atoi(argv[3]);
+
+    // Initialize thread library
+    uthread_init(atoi(argv[4]));
+
+    LockedQueue locked_queue(capacity);
+    Channel<int> channel(capacity);
+    ThreadArgs args = { .n_items = num_items, .locked_queue = &locked_queue, .channel = &channel };
+
+    std::cout << "Testing Lock + CondVar queue Performance...\n";
+    run_test(produce_locked, consume_locked, "LockedQueue", num_threads, num_items, &args);
+
+    std::cout << "Testing Channel Performance...\n";
+    run_test(produce_channel, consume_channel, "Channel", num_threads, num_items, &args);
+
+    uthread_exit(nullptr);
+    return 0;
+}
@@ -72,8 +72,8 @@ void *thread_io(void *args) {
         else {
             // Reserve space in file for id
             offset += length;
-            if (async_write(filedes, buf, length, offset) != length) {
-                perror("async_write");
+            if (async_pwrite(filedes, buf, length, offset) != length) {
+                perror("async_pwrite");
             }
         }
         add_workload(num_iters);
@@ -8,6 +8,7 @@
 #include <vector>
 
 #include "../lib/async_io.h"
+#include "../lib/io_stats.h"
 #include "../lib/uthread.h"
 
 enum IOType {
@@ -63,8 +64,8 @@ void *thread_io(void *args) {
         else {
             // Reserve space in file for id
             offset += length;
-            if (async_write(filedes, buf, length, offset) != length) {
-                perror("async_write");
+            if (async_pwrite(filedes, buf, length, offset) != length) {
+                perror("async_pwrite");
             }
         }
         add_workload(num_iters);
@@ -199,6 +200,11 @@ int main(int argc, char *argv[]) {
         std::cout << "Performance ratio: async is " << ratio << " times slower\n";
     }
 
+#ifdef IO_STATS
+    std::cout << "=================== I/O Stats ===================" << std::endl;
+    uthread_dump_io_stats();
+#endif
+
     // Close file
     if (close(filedes) == -1) {
         perror("close");
@@ -1,18 +1,23 @@
 #include <chrono>
 #include <iostream>
 
+#include "../lib/Combiner.h"
 #include "../lib/Lock.h"
 #include "../lib/SpinLock.h"
+#include "../lib/lock_stats.h"
 #include "../lib/uthread.h"
 
 struct ThreadArgs {
     int n_iterations;
     int n_loops;
     int workload;
+    Lock *lock;    // Lock used by the mutex lock tests
 };
 
-Lock mutex_lock;
-SpinLock spin_lock;
+Lock handoff_lock("handoff_lock", LOCK_HANDOFF);
+Lock barging_lock("barging_lock", LOCK_BARGING);
+SpinLock spin_lock("spin_lock");
+Combiner combiner("combiner");
 uint64_t shared_counter = 0;
 
 volatile uint64_t x = 0;
@@ -28,12 +33,13 @@ void *critical_section_with_mutexlock(void *args) {
     int iterations_size = params->n_iterations;
     int loop_size = params->n_loops;
     int workload = params->workload;
+    Lock *mutex_lock = params->lock;
     for (int i = 0; i < iterations_size; i++) {
-        mutex_lock.lock();
+        mutex_lock->lock();
         for (int j = 0; j < loop_size; j++) {
             shared_counter++;    // Critical section
         }
-        mutex_lock.unlock();
+        mutex_lock->unlock();
         add_workload(workload);
     }
     return nullptr;
@@ -55,13 +61,31 @@ void *critical_section_with_spinlock(void *args) {
     return nullptr;
 }
 
+void *critical_section_with_combiner(void *args) {
+    ThreadArgs *params = (ThreadArgs *) args;
+    int iterations_size = params->n_iterations;
+    int loop_size = params->n_loops;
+    int workload = params->workload;
+    for (int i = 0; i < iterations_size; i++) {
+        combiner.execute([loop_size]() {
+            for (int j = 0; j < loop_size; j++) {
+                shared_counter++;    // Critical section
+            }
+        });
+        add_workload(workload);
+    }
+    return nullptr;
+}
+
 void run_test(void *(*lock_func)(void *), const std::string &lock_type, int nthreads, int niters,
-              int nloops, int workload) {
+              int nloops, int workload, Lock *lock = nullptr) {
     // Start timer
     auto start_time = std::chrono::high_resolution_clock::now();
 
     int *tids = (int *) malloc(sizeof(int) * nthreads);
-    ThreadArgs args = { .n_iterations = niters, .n_loops = nloops, .workload = workload };
+    ThreadArgs args = {
+        .n_iterations = niters, .n_loops = nloops, .workload = workload, .lock = lock
+    };
 
     for (int i = 0; i < nthreads; ++i) {
         tids[i] = uthread_create(lock_func, &args);
@@ -108,14 +132,23 @@ int main(int argc, char *argv[]) {
      *  lock type,
      *  number of threads,
      *  number of iterations,
-     *  number of inner loops
+     *  number of inner loops,
+     *  workload between critical sections,
+     *  lock (mutex lock tests only)
      * )
      */
 
     std::cout << "==================== Test 1 ====================\n";
 
     std::cout << "Testing MutexLock Performance...\n";
-    run_test(critical_section_with_mutexlock, "MutexLock", num_threads, iterations, 1, 0);
+    run_test(critical_section_with_mutexlock, "MutexLock (handoff)", num_threads, iterations, 1, 0,
+             &handoff_lock);
+
+    // Reset shared counter
+    shared_counter = 0;
+
+    run_test(critical_section_with_mutexlock, "MutexLock (barging)", num_threads, iterations, 1, 0,
+             &barging_lock);
 
     // Reset shared counter
     shared_counter = 0;
@@ -126,11 +159,23 @@ int main(int argc, char *argv[]) {
     // Reset shared counter
     shared_counter = 0;
 
+    std::cout << "Testing Combiner Performance...\n";
+    run_test(critical_section_with_combiner, "Combiner", num_threads, iterations, 1, 0);
+
+    // Reset shared counter
+    shared_counter = 0;
+
     std::cout << "==================== Test 2 ====================\n";
 
     std::cout << "Testing MutexLock Performance...\n";
-    run_test(critical_section_with_mutexlock, "MutexLock", num_threads, iterations, num_loops,
-             workload);
+    run_test(critical_section_with_mutexlock, "MutexLock (handoff)", num_threads, iterations,
+             num_loops, workload, &handoff_lock);
+
+    // Reset shared counter
+    shared_counter = 0;
+
+    run_test(critical_section_with_mutexlock, "MutexLock (barging)", num_threads, iterations,
+             num_loops, workload, &barging_lock);
 
     // Reset shared counter
     shared_counter = 0;
@@ -139,6 +184,18 @@ int main(int argc, char *argv[]) {
     run_test(critical_section_with_spinlock, "SpinLock", num_threads, iterations, num_loops,
              workload);
 
+    // Reset shared counter
+    shared_counter = 0;
+
+    std::cout << "Testing Combiner Performance...\n";
+    run_test(critical_section_with_combiner, "Combiner", num_threads, iterations, num_loops,
+             workload);
+
+#ifdef LOCK_STATS
+    std::cout << "================== Lock Stats ==================" << std::endl;
+    uthread_dump_lock_stats();
+#endif
+
     uthread_exit(nullptr);
     return 0;
 }
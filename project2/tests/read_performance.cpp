@@ -0,0 +1,187 @@
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+
+#include "../lib/Lock.h"
+#include "../lib/SeqLock.h"
+#include "../lib/rcu.h"
+#include "../lib/uthread.h"
+
+#define WRITE_YIELDS 10    // Times the writer yields between two updates
+
+// Read-mostly data, e.g. server configuration. checksum lets readers detect a
+// torn snapshot
+struct Config {
+    long version;
+    long max_connections;
+    long timeout_usecs;
+    long checksum;
+};
+
+// Configuration published through RCU
+struct RcuConfig {
+    Config config;
+    RcuHead head;
+};
+
+struct ThreadArgs {
+    int n_reads;
+    Config (*read_config)();
+};
+
+Lock config_lock("config_lock");
+Config locked_config;
+SeqLock<Config> seq_config;
+std::atomic<RcuConfig *> rcu_config;
+
+std::atomic<bool> readers_done;
+std::atomic<long> torn_reads;
+
+Config make_config(long version) {
+    Config config;
+    config.version = version;
+    config.max_connections = 100 + version;
+    config.timeout_usecs = 1000 * version;
+    config.checksum = config.version + config.max_connections + config.timeout_usecs;
+    return config;
+}
+
+Config read_locked() {
+    config_lock.lock();
+    Config config = locked_config;
+    config_lock.unlock();
+    return config;
+}
+
+void write_locked(const Config &config) {
+    config_lock.lock();
+    locked_config = config;
+    config_lock.unlock();
+}
+
+Config read_seqlock() {
+    return seq_config.load();
+}
+
+void write_seqlock(const Config &config) {
+    seq_config.store(config);
+}
+
+Config read_rcu() {
+    rcu_read_lock();
+    Config config = rcu_config.load(std::memory_order_acquire)->config;
+    rcu_read_unlock();
+    return config;
+}
+
+void free_rcu_config(RcuHead *head) {
+    delete (RcuConfig *) ((char *) head - offsetof(RcuConfig, head));
+}
+
+void write_rcu(const Config &config) {
+    RcuConfig *new_config = new RcuConfig;
+    new_config->config = config;
+    RcuConfig *old_config = rcu_config.exchange(new_config, std::memory_order_acq_rel);
+    rcu_retire(&old_config->head, free_rcu_config);
+}
+
+void *reader(void *args) {
+    ThreadArgs *params = (ThreadArgs *) args;
+    long torn = 0;
+    for (int i = 0; i < params->n_reads; i++) {
+        Config config = params->read_config();
+        if (config.version + config.max_connections + config.timeout_usecs != config.checksum) {
+            torn++;
+        }
+    }
+    torn_reads += torn;
+    return nullptr;
+}
+
+void *writer(void *args) {
+    void (*write_config)(const Config &) = (void (*)(const Config &)) args;
+    long version = 1;
+    while (!readers_done) {
+        write_config(make_config(++version));
+        for (int i = 0; i < WRITE_YIELDS && !readers_done; i++) {
+            uthread_yield();
+        }
+    }
+    return nullptr;
+}
+
+void run_test(Config (*read_config)(), void (*write_config)(const Config &),
+              const std::string &sync_type, int nthreads, int nreads) {
+    readers_done = false;
+    torn_reads = 0;
+    // Start timer
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    ThreadArgs args = { .n_reads = nreads, .read_config = read_config };
+    int *tids = (int *) malloc(sizeof(int) * nthreads);
+    for (int i = 0; i < nthreads; ++i) {
+        tids[i] = uthread_create(reader, &args);
+        if (tids[i] == -1) {
+            std::cerr << "uthread_create\n";
+        }
+    }
+    int writer_tid = uthread_create(writer, (void *) write_config);
+    if (writer_tid == -1) {
+        std::cerr << "uthread_create\n";
+    }
+
+    for (int i = 0; i < nthreads; ++i) {
+        if (uthread_join(tids[i], nullptr) != 0) {
+            std::cerr << "uthread_join\n";
+        }
+    }
+
+    // Stop timer
+    auto end_time = std::chrono::high_resolution_clock::now();
+    double duration = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+
+    readers_done = true;
+    if (uthread_join(writer_tid, nullptr) != 0) {
+        std::cerr << "uthread_join\n";
+    }
+
+    std::cout << sync_type << " with " << nthreads << " readers, " << nreads
+              << " reads/thread completed in " << duration << " ms ("
+              << (torn_reads == 0 ? "consistent" : "TORN READS") << ")" << std::endl;
+
+    free(tids);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 4) {
+        std::cerr << "Usage: ./readperformance <nthreads> <nreads> <quantum>\n";
+        exit(1);
+    }
+
+    const int max_threads = atoi(argv[1]);
+    const int num_reads = atoi(argv[2]);
+
+    // Initialize thread library
+    uthread_init(atoi(argv[3]));
+
+    locked_config = make_config(1);
+    seq_config.store(make_config(1));
+    RcuConfig *initial = new RcuConfig;
+    initial->config = make_config(1);
+    rcu_config = initial;
+
+    // Double the number of readers each round
+    for (int nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+        std::cout << "==================== " << nthreads << " Readers ====================\n";
+        run_test(read_locked, write_locked, "Lock", nthreads, num_reads);
+        run_test(read_seqlock, write_seqlock, "SeqLock", nthreads, num_reads);
+        run_test(read_rcu, write_rcu, "RCU", nthreads, num_reads);
+    }
+
+    rcu_synchronize();
+    delete rcu_config.load();
+
+    uthread_exit(nullptr);
+    return 0;
+}
@@ -1,42 +1,172 @@
 #include "async_socket.h"
 
 #include <errno.h>
-#include <poll.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/socket.h>
 
 #include "../../lib/debug.cpp"
+#include "../../lib/reactor.h"
 #include "../../lib/uthread.h"
 
 extern int keep_going;
 
+// Make fd non-blocking. Returns 0 on success, -1 on failure
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1) {
+        return -1;
+    }
+    if (flags & O_NONBLOCK) {
+        return 0;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
 int async_accept(int sockfd, struct sockaddr *addr, unsigned int *addrlen) {
-    // Create pollfds array
-    struct pollfd pfds;
-    pfds.fd = sockfd;
-    pfds.events = POLLIN;
-
-    // Poll sockfd and yield thread until it is ready
-    int ret_val;
-    while ((ret_val = poll(&pfds, 1, POLL_TIMEOUT)) != 1) {
-        S_PRINT(5000, "Thread %d waiting in accept\n", uthread_self());
-        // Check if poll returned an error
-        if (ret_val == -1 && errno != EINTR) {
-            perror("poll");
-            return -1;
+    if (set_nonblocking(sockfd) == -1) {
+        perror("fcntl");
+        return -1;
+    }
+    while (true) {
+        // Try to accept before waiting
+        int client_fd = accept4(sockfd, addr, addrlen, SOCK_NONBLOCK);
+        if (client_fd != -1 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            PRINT("Thread %d accepted %d\n", uthread_self(), client_fd);
+            return client_fd;
         }
         // Check if SIGINT recieved
         if (keep_going != 1) {
+            errno = EINTR;
             return -1;
         }
-        // Yield the thread
-        if (uthread_yield() != 0) {
-            fprintf(stderr, "uthread_yield\n");
+        // Park until a connection arrives
+        S_PRINT(5000, "Thread %d waiting in accept\n", uthread_self());
+        if (reactor_wait(sockfd, EPOLLIN) == -1) {
             return -1;
         }
     }
+}
+
+int async_connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen,
+                  const IoControl *ctl) {
+    if (set_nonblocking(sockfd) == -1) {
+        return -1;
+    }
+    if (connect(sockfd, addr, addrlen) == 0) {
+        return 0;
+    }
+    if (errno != EINPROGRESS) {
+        return -1;
+    }
+    // Park until the handshake completes, then collect its result
+    PRINT("Thread %d waiting in connect\n", uthread_self());
+    if (reactor_wait(sockfd, EPOLLOUT, ctl) == -1) {
+        return -1;
+    }
+    int error;
+    socklen_t len = sizeof(error);
+    if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &error, &len) == -1) {
+        return -1;
+    }
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
 
-    // Call accept and return result
-    PRINT("Thread %d ready to accept\n", uthread_self());
-    return accept(sockfd, addr, addrlen);
+ssize_t async_recv(int sockfd, void *buf, size_t len, int flags, const IoControl *ctl) {
+    while (true) {
+        // MSG_DONTWAIT makes the call non-blocking whatever the socket's mode
+        ssize_t nbytes = recv(sockfd, buf, len, flags | MSG_DONTWAIT);
+        if (nbytes != -1 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            return nbytes;
+        }
+        PRINT("Thread %d waiting in recv\n", uthread_self());
+        if (reactor_wait(sockfd, EPOLLIN | EPOLLRDHUP, ctl) == -1) {
+            return -1;
+        }
+    }
+}
+
+ssize_t async_send(int sockfd, const void *buf, size_t len, int flags,
+                   const IoControl *ctl) {
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t nbytes = send(sockfd, (const char *) buf + sent, len - sent,
+                              flags | MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (nbytes != -1) {
+            sent += nbytes;
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return -1;
+        }
+        PRINT("Thread %d waiting in send\n", uthread_self());
+        if (reactor_wait(sockfd, EPOLLOUT, ctl) == -1) {
+            return -1;
+        }
+    }
+    return len;
+}
+
+ssize_t async_sendv(int sockfd, struct iovec *iov, int iovcnt, const IoControl *ctl) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+    ssize_t sent = 0;
+    while (msg.msg_iovlen > 0) {
+        ssize_t nbytes = sendmsg(sockfd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (nbytes == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return -1;
+            }
+            PRINT("Thread %d waiting in sendmsg\n", uthread_self());
+            if (reactor_wait(sockfd, EPOLLOUT, ctl) == -1) {
+                return -1;
+            }
+            continue;
+        }
+        sent += nbytes;
+        // Skip the buffers that were sent completely and trim the partial one
+        while (msg.msg_iovlen > 0 && (size_t) nbytes >= msg.msg_iov->iov_len) {
+            nbytes -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (char *) msg.msg_iov->iov_base + nbytes;
+            msg.msg_iov->iov_len -= nbytes;
+        }
+    }
+    return sent;
+}
+
+ssize_t async_recv_until(int sockfd, char *buf, size_t size, size_t *buffered,
+                         const char *delim, const IoControl *ctl) {
+    size_t delim_len = strlen(delim);
+    // Bytes before this index were already searched
+    size_t searched = 0;
+    while (true) {
+        char *found = (char *) memmem(buf + searched, *buffered - searched, delim, delim_len);
+        if (found != nullptr) {
+            return found + delim_len - buf;
+        }
+        // The delimiter may straddle the next read
+        if (*buffered >= delim_len) {
+            searched = *buffered - delim_len + 1;
+        }
+        if (*buffered == size) {
+            errno = EMSGSIZE;
+            return -1;
+        }
+        ssize_t nbytes = async_recv(sockfd, buf + *buffered, size - *buffered, 0, ctl);
+        if (nbytes <= 0) {
+            return nbytes;
+        }
+        *buffered += nbytes;
+    }
 }
@@ -1,8 +1,65 @@
 #ifndef ASYNC_SOCKET_H
 #define ASYNC_SOCKET_H
 
-#define POLL_TIMEOUT 1    // Timeout in ms
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
+#include "../../lib/cancel.h"
+
+// Socket I/O for uthreads. Every call tries the system call first and only
+// parks the thread on the reactor if the socket is not ready, so the common
+// case costs no extra system calls. Calls that wait for the peer take an
+// optional IoControl (see cancel.h) and fail with ETIMEDOUT or ECANCELED if it
+// aborts the wait
+
+// Accept a connection on a listening socket where this thread will be blocked
+// (parked on the reactor) until a connection arrives but other ready threads
+// will be scheduled
+// NOTE: Makes sockfd non-blocking. The client socket is non-blocking as well
+// Output:
+// - Client socket on success, -1 on failure (errno is EINTR once the server is
+//   shutting down)
 int async_accept(int sockfd, struct sockaddr *addr, unsigned int *addrlen);
 
+// Connect sockfd to addr, blocking this thread until the connection is
+// established
+// NOTE: Makes sockfd non-blocking
+// Output:
+// - 0 on success, -1 on failure
+int async_connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen,
+                  const IoControl *ctl = nullptr);
+
+// Receive up to len bytes into buf, blocking this thread until data arrives
+// Output:
+// - Bytes received on success, 0 if the peer closed the connection, -1 on
+//   failure
+ssize_t async_recv(int sockfd, void *buf, size_t len, int flags, const IoControl *ctl = nullptr);
+
+// Send all len bytes of buf, blocking this thread while the socket buffer is
+// full. Never raises SIGPIPE
+// Output:
+// - len on success, -1 on failure
+ssize_t async_send(int sockfd, const void *buf, size_t len, int flags,
+                   const IoControl *ctl = nullptr);
+
+// Send all bytes of the iovcnt buffers in iov with as few system calls as
+// possible, blocking this thread while the socket buffer is full. Never
+// raises SIGPIPE
+// NOTE: May modify iov
+// Output:
+// - Bytes sent on success, -1 on failure
+ssize_t async_sendv(int sockfd, struct iovec *iov, int iovcnt, const IoControl *ctl = nullptr);
+
+// Receive into buf until it contains delim. buf holds *buffered bytes on entry
+// (left over from an earlier call) and *buffered is updated to the number of
+// bytes buffered on return. Bytes after the delimiter stay in buf for the
+// next message
+// Output:
+// - Length of the message up to and including delim on success, 0 if the peer
+//   closed the connection first, -1 on failure (errno is EMSGSIZE if size
+//   bytes hold no delimiter)
+ssize_t async_recv_until(int sockfd, char *buf, size_t size, size_t *buffered,
+                         const char *delim, const IoControl *ctl = nullptr);
+
 #endif    // ASYNC_SOCKET_H
@@ -1,17 +1,34 @@
 #include "http.h"
 
 #include <assert.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <zlib.h>
 
 #include "../../lib/async_io.h"
+#include "../../lib/async_syscall.h"
 #include "../../lib/debug.cpp"
+#include "../../lib/timer.h"
+#include "async_socket.h"
+#include "http_cache.h"
 
 #define BUFSIZE 512
+#define REQUEST_TIMEOUT 10000000L      // Time a client has to send its request (usecs)
+#define ETAG_SIZE 64                   // Max bytes of an entity tag, terminator included
+#define VALIDATORS_SIZE 192            // Max bytes of the validator fields of a response
+#define PART_HEADER_SIZE 192           // Max bytes of the header of a multipart/byteranges part
+#define BOUNDARY "3d6b6a416f9b5c2e"    // Separates the parts of a multipart/byteranges body
+#define GZIP_MIN_SIZE 256              // Smaller text files are always sent as is
+#define GZIP_KEY_SUFFIX " gzip"        // Cache key suffix of gzip variants (paths have no spaces)
 
 const char *get_mime_type(const char *file_extension) {
     if (strcmp(".txt", file_extension) == 0) {
@@ -31,122 +48,900 @@ const char *get_mime_type(const char *file_extension) {
     return NULL;
 }
 
-int read_http_request(int fd, char *resource_name) {
-    // Create buffer and variables for read
-    char buf[BUFSIZE];
-    char *saveptr = buf;
-    int nbytes, offset = 0;
-    // Read in the first line of http request (and extra)
-    if ((nbytes = async_read(fd, buf, BUFSIZE, offset)) > 0) {
-        // Extract the resoure name given by the second word
-        strtok_r(saveptr, " ", &saveptr);
-        char *token = strtok_r(saveptr, " ", &saveptr);
-        strcat(resource_name, token);
-        // Read in the rest of the http request
-        while (nbytes == BUFSIZE) {
-            PRINT("Thread %d reading in rest of http request\n", uthread_self())
-            offset += nbytes;
-            nbytes = async_read(fd, buf, BUFSIZE, offset);
-        }
-    }
-    // Check if read errored
+// Get the file extension of a path (from its last '.'), NULL if it has none
+static const char *get_extension(const char *path) {
+    const char *dot = strrchr(path, '.');
+    return dot != NULL && dot != path ? dot : NULL;
+}
+
+// Text compresses several times over, the other types are compressed already
+static bool is_compressible(const char *mime_type) {
+    return mime_type != NULL && strncmp(mime_type, "text/", 5) == 0;
+}
+
+// Whether gzip variants of text files missing a sidecar are built into the
+// cache (see http_precompress())
+static bool precompress = false;
+
+// Endings of the response headers. HTTP/1.1 connections stay open unless
+// closed explicitly, HTTP/1.0 ones only if the client asked for keep-alive
+static const char CLOSE_END[] = "Connection: close\r\n\r\n";
+static const char KEEP_ALIVE_END[] = "Connection: keep-alive\r\n\r\n";
+static const char HEADER_END[] = "\r\n";
+static const char NOT_FOUND[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n";
+static const char LAST_BOUNDARY[] = "\r\n--" BOUNDARY "--\r\n";
+static const char UNAVAILABLE[] =
+    "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nRetry-After: 1\r\n"
+    "Connection: close\r\n\r\n";
+
+// Get the response header for a request the parser rejected
+static const char *error_header(int status) {
+    switch (status) {
+    case 414:
+        return "HTTP/1.1 414 URI Too Long\r\nContent-Length: 0\r\n";
+    case 431:
+        return "HTTP/1.1 431 Request Header Fields Too Large\r\nContent-Length: 0\r\n";
+    case 505:
+        return "HTTP/1.1 505 HTTP Version Not Supported\r\nContent-Length: 0\r\n";
+    default:
+        return "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n";
+    }
+}
+
+void http_connection_init(HttpConnection *conn, int fd) {
+    conn->fd = fd;
+    conn->keep_alive = false;
+    conn->http10 = false;
+    conn->buffered = 0;
+    conn->request_len = 0;
+    http_parser_init(&conn->parser);
+    conn->iovcnt = 0;
+    conn->num_entries = 0;
+    conn->num_responses = 0;
+    conn->scratch_len = 0;
+}
+
+// Drop the last request from the buffer, keeping the bytes pipelined after it
+static void consume_request(HttpConnection *conn) {
+    if (conn->request_len == 0) {
+        return;
+    }
+    conn->buffered -= conn->request_len;
+    memmove(conn->buf, conn->buf + conn->request_len, conn->buffered);
+    conn->request_len = 0;
+    http_parser_init(&conn->parser);
+}
+
+// Get the end of the header of the last request
+static const char *response_end(const HttpConnection *conn) {
+    if (!conn->keep_alive) {
+        return CLOSE_END;
+    }
+    return conn->http10 ? KEEP_ALIVE_END : HEADER_END;
+}
+
+// Make room for a response of niov buffers and scratch_size bytes of headers,
+// sending the queued responses if needed. Returns 0 on success, -1 on error
+static int reserve(HttpConnection *conn, int niov, size_t scratch_size) {
+    int max_iov = sizeof(conn->iov) / sizeof(conn->iov[0]);
+    if (conn->num_responses == RESPONSE_BATCH || conn->iovcnt + niov > max_iov ||
+        conn->scratch_len + scratch_size > RESPONSE_SCRATCH) {
+        return http_flush(conn);
+    }
+    return 0;
+}
+
+// Format text into the scratch space of a connection (see reserve())
+// Output:
+// - The text and its length in len, NULL if it does not fit
+static const char *scratch_printf(HttpConnection *conn, size_t *len, const char *format, ...) {
+    char *text = conn->scratch + conn->scratch_len;
+    size_t room = RESPONSE_SCRATCH - conn->scratch_len;
+    va_list args;
+    va_start(args, format);
+    int ret_val = vsnprintf(text, room, format, args);
+    va_end(args);
+    if (ret_val < 0 || (size_t) ret_val >= room) {
+        fprintf(stderr, "Response header too large\n");
+        return NULL;
+    }
+    conn->scratch_len += ret_val;
+    *len = ret_val;
+    return text;
+}
+
+static void push_iov(HttpConnection *conn, const void *base, size_t len) {
+    conn->iov[conn->iovcnt].iov_base = (void *) base;
+    conn->iov[conn->iovcnt++].iov_len = len;
+}
+
+// Queue a response made of a header, the header's end and an optional body
+// (entry, released once the response is sent)
+static int queue_response(HttpConnection *conn, const char *header, size_t header_len,
+                          CacheEntry *entry) {
+    if (reserve(conn, 3, 0) == -1) {
+        if (entry != NULL) {
+            http_cache_release(entry);
+        }
+        return -1;
+    }
+    const char *end = response_end(conn);
+    push_iov(conn, header, header_len);
+    push_iov(conn, end, strlen(end));
+    if (entry != NULL) {
+        push_iov(conn, entry->body, entry->body_len);
+        conn->entries[conn->num_entries++] = entry;
+    }
+    conn->num_responses++;
+    return 0;
+}
+
+int http_flush(HttpConnection *conn) {
+    if (conn->num_responses == 0) {
+        return 0;
+    }
+    PRINT("Sending %d responses on fd %d\n", conn->num_responses, conn->fd);
+    ssize_t nbytes = async_sendv(conn->fd, conn->iov, conn->iovcnt);
+    for (int i = 0; i < conn->num_entries; i++) {
+        http_cache_release(conn->entries[i]);
+    }
+    conn->iovcnt = 0;
+    conn->num_entries = 0;
+    conn->num_responses = 0;
+    conn->scratch_len = 0;
     if (nbytes == -1) {
-        perror("read");
+        perror("writev");
         return -1;
     }
     return 0;
 }
 
-int write_http_response(int fd, const char *resource_path) {
-    // Create buffer for write
-    char buf[BUFSIZE];
-    memset(buf, 0, BUFSIZE);
-    // Call stat to get file properties and check if resource path is valid
-    struct stat statbuf;
-    if (stat(resource_path, &statbuf) == -1) {
-        // Check if stat failed from something other than ENOENT
-        if (errno != ENOENT) {
-            perror("stat");
+int http_connection_idle(HttpConnection *conn) {
+    consume_request(conn);
+    if (conn->buffered > 0) {
+        return 0;
+    }
+    if (http_flush(conn) == -1) {
+        return -1;
+    }
+    // The next request may already be waiting in the socket
+    ssize_t nbytes = recv(conn->fd, conn->buf, REQUEST_BUFSIZE, MSG_DONTWAIT);
+    if (nbytes > 0) {
+        conn->buffered = nbytes;
+        return 0;
+    }
+    if (nbytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return 1;
+    }
+    return -1;
+}
+
+int http_send_unavailable(int fd) {
+    // Best effort without blocking, the connection is closed right after
+    ssize_t nbytes = send(fd, UNAVAILABLE, sizeof(UNAVAILABLE) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    return nbytes == (ssize_t) sizeof(UNAVAILABLE) - 1 ? 0 : -1;
+}
+
+// Returns true if the comma separated header value contains token
+static bool has_token(const HttpView *value, const char *token) {
+    size_t token_len = strlen(token);
+    for (size_t i = 0; i + token_len <= value->len; i++) {
+        if (strncasecmp(value->data + i, token, token_len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Answer a request the parser rejected and close the connection
+static int reject_request(HttpConnection *conn) {
+    fprintf(stderr, "Rejected http request (%d)\n", conn->parser.error);
+    conn->keep_alive = false;
+    const char *header = error_header(conn->parser.error);
+    queue_response(conn, header, strlen(header), NULL);
+    http_flush(conn);
+    return -1;
+}
+
+int read_http_request(HttpConnection *conn, char *resource_name, size_t size) {
+    consume_request(conn);
+    // Drop clients that are too slow instead of letting them hold the worker
+    struct timespec deadline = timer_deadline(REQUEST_TIMEOUT);
+    IoControl ctl;
+    ctl.deadline = &deadline;
+    // Parse what is buffered and receive more until the request header is
+    // complete. Lines parsed once are not parsed again
+    HttpParseStatus status;
+    while ((status = http_parse(&conn->parser, conn->buf, conn->buffered)) ==
+           HTTP_PARSE_INCOMPLETE) {
+        // Answer the pipelined requests before waiting for more of them
+        if (http_flush(conn) == -1) {
             return -1;
         }
-        // Otherwise resource path doesn't exist
-        // Write the response header to buffer
-        int ret_val = snprintf(buf, BUFSIZE, "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n");
-        if (ret_val < 0) {
-            fprintf(stderr, "snprintf failed\n");
+        ssize_t nbytes = async_recv(conn->fd, conn->buf + conn->buffered,
+                                    REQUEST_BUFSIZE - conn->buffered, 0, &ctl);
+        if (nbytes == -1) {
+            perror("recv");
             return -1;
         }
-        // Write the response header to socket
-        if (async_write(fd, buf, strlen(buf), 0) == -1) {
-            perror("write");
+        if (nbytes == 0) {
+            // Closing between two requests is how clients end a kept alive
+            // connection
+            if (conn->buffered > 0) {
+                fprintf(stderr, "Connection closed before end of http request\n");
+            }
             return -1;
         }
-        return 0;
+        conn->buffered += nbytes;
     }
-    // Otherwise resource path exists
-    // Extract file extension from resource path
-    char *extension = NULL;
-    strcpy(buf, resource_path);
-    for (int i = strlen(resource_path); i > 0; i--) {
-        if (buf[i] == '.') {
-            extension = buf + i;
-            break;
+    if (status == HTTP_PARSE_ERROR) {
+        return reject_request(conn);
+    }
+    const HttpRequest *request = &conn->parser.request;
+    conn->request_len = request->length;
+    // The resource is named by the path without its query
+    const char *query = (const char *) memchr(request->path.data, '?', request->path.len);
+    size_t path_len = query != NULL ? query - request->path.data : request->path.len;
+    size_t name_len = strlen(resource_name);
+    if (name_len + path_len >= size) {
+        conn->parser.error = 414;
+        return reject_request(conn);
+    }
+    memcpy(resource_name + name_len, request->path.data, path_len);
+    resource_name[name_len + path_len] = '\0';
+    // HTTP/1.1 connections persist by default, older ones must ask
+    conn->http10 = request->minor_version == 0;
+    conn->keep_alive = !conn->http10;
+    const HttpView *connection = http_find_header(request, "Connection");
+    if (connection != NULL) {
+        if (has_token(connection, "close")) {
+            conn->keep_alive = false;
+        } else if (has_token(connection, "keep-alive")) {
+            conn->keep_alive = true;
         }
     }
-    // Check for no extension
-    if (extension == NULL) {
-        // Do something
-        return 0;
+    return 0;
+}
+
+// Piece of a response: header text, or a range of the resource file
+struct Piece {
+    const char *text;    // The text, NULL for a range of the file
+    size_t offset;       // Start of the range in the file
+    size_t len;          // Bytes of text or of the range
+};
+
+// Format the validators of a representation of a file. The entity tag changes
+// with the file's modification time, the representation's size and its coding
+// Input:
+// - coding: The content coding of the representation, NULL for the file as is
+// - negotiated: true if the representation was chosen by Accept-Encoding
+// Output:
+// - etag: The quoted entity tag (ETAG_SIZE bytes)
+// - fields: The header fields naming the coding, the validators and range
+//           support (VALIDATORS_SIZE bytes)
+static void format_validators(const struct timespec &mtime, size_t size, const char *coding,
+                              bool negotiated, char *etag, char *fields) {
+    snprintf(etag, ETAG_SIZE, "\"%lx.%lx-%zx%s%s\"", (unsigned long) mtime.tv_sec,
+             (unsigned long) mtime.tv_nsec, size, coding != NULL ? "-" : "",
+             coding != NULL ? coding : "");
+    char encoding[32] = "";
+    if (coding != NULL) {
+        snprintf(encoding, sizeof(encoding), "Content-Encoding: %s\r\n", coding);
     }
-    // Get Content-Type and Content-Length
-    long file_size = statbuf.st_size;
-    const char *mime_type = get_mime_type(extension);
-    if (mime_type == NULL) {
-        fprintf(stderr, "Failed to get content-type: invalid file extension\n");
+    char last_modified[HTTP_DATE_SIZE];
+    http_format_date(mtime.tv_sec, last_modified);
+    // Caches must not hand one client's representation to a client that
+    // accepts other codings
+    snprintf(fields, VALIDATORS_SIZE,
+             "%sAccept-Ranges: bytes\r\nETag: %s\r\nLast-Modified: %s\r\n%s", encoding, etag,
+             last_modified, negotiated ? "Vary: Accept-Encoding\r\n" : "");
+}
+
+// Format the header of a 200 response, but its end (added when sending)
+// Output:
+// - The header's length, -1 on failure
+static int format_header(char *buf, const char *mime_type, size_t size, const char *fields) {
+    int ret_val = snprintf(buf, BUFSIZE,
+                           "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %zu\r\n%s",
+                           mime_type, size, fields);
+    if (ret_val < 0 || ret_val >= BUFSIZE) {
+        fprintf(stderr, "snprintf failed\n");
         return -1;
     }
-    // Write the repsonse header to buffer
-    int ret_val =
-        snprintf(buf, BUFSIZE, "HTTP/1.0 200 OK\r\nContent-Type: %s\r\nContent-Length: %ld\r\n\r\n",
-                 mime_type, file_size);
-    if (ret_val < 0) {
-        fprintf(stderr, "snprintf failed\n");
+    return ret_val;
+}
+
+// Returns true if the client's copy is current. If-Modified-Since only counts
+// without If-None-Match (RFC 9110 13.2.2)
+static bool not_modified(const HttpRequest *request, const char *etag, time_t mtime) {
+    const HttpView *if_none_match = http_find_header(request, "If-None-Match");
+    if (if_none_match != NULL) {
+        return http_etag_matches(*if_none_match, etag);
+    }
+    const HttpView *if_modified_since = http_find_header(request, "If-Modified-Since");
+    if (if_modified_since != NULL) {
+        time_t since = http_parse_date(*if_modified_since);
+        return since != -1 && mtime <= since;
+    }
+    return false;
+}
+
+// Returns true if the Range field of a request applies: there is no If-Range,
+// or it names the current version of the file (its entity tag, compared
+// strongly, or its modification time)
+static bool range_applies(const HttpRequest *request, const char *etag, time_t mtime) {
+    const HttpView *if_range = http_find_header(request, "If-Range");
+    if (if_range == NULL) {
+        return true;
+    }
+    if ((if_range->len > 0 && if_range->data[0] == '"') ||
+        (if_range->len > 1 && strncmp(if_range->data, "W/", 2) == 0)) {
+        return if_range->len == strlen(etag) && memcmp(if_range->data, etag, if_range->len) == 0;
+    }
+    return http_parse_date(*if_range) == mtime;
+}
+
+// Queue a response without a body, its header formatted into the scratch space
+static int queue_formatted(HttpConnection *conn, const char *status, const char *fields) {
+    const char *end = response_end(conn);
+    if (reserve(conn, 1, strlen(status) + strlen(fields) + strlen(end) + 1) == -1) {
         return -1;
     }
-    // Write the response header to socket
-    int header_len = strlen(buf);
-    if (async_write(fd, buf, header_len, 0) == -1) {
-        perror("write");
+    size_t len;
+    const char *header = scratch_printf(conn, &len, "%s%s%s", status, fields, end);
+    if (header == NULL) {
         return -1;
     }
-    // Open the resource file
-    int resource_fd = open(resource_path, O_RDONLY, S_IRUSR);
+    push_iov(conn, header, len);
+    conn->num_responses++;
+    return 0;
+}
+
+// Send the pieces of a response right away, the ranges of the file with
+// sendfile()
+static int send_pieces(HttpConnection *conn, const char *resource_path, const Piece *pieces,
+                       int num_pieces) {
+    int resource_fd = async_open(resource_path, O_RDONLY);
     if (resource_fd == -1) {
         perror("open");
         return -1;
     }
-    // Write response body
-    int nbytes, offset = 0;
-    while ((nbytes = async_read(resource_fd, buf, BUFSIZE, offset)) > 0) {
-        // Write contents of buffer into socket
-        if (async_write(fd, buf, nbytes, header_len + offset) == -1) {
-            perror("write");
-            close(resource_fd);
+    int ret = 0;
+    for (int i = 0; i < num_pieces && ret == 0; i++) {
+        if (pieces[i].text != NULL) {
+            // Corked, so the text leaves with the data after it
+            int flags = i < num_pieces - 1 ? MSG_MORE : 0;
+            if (async_send(conn->fd, pieces[i].text, pieces[i].len, flags) == -1) {
+                perror("write");
+                ret = -1;
+            }
+            continue;
+        }
+        ssize_t nbytes = async_sendfile(conn->fd, resource_fd, pieces[i].offset, pieces[i].len);
+        if (nbytes == -1) {
+            perror("sendfile");
+            ret = -1;
+        } else if ((size_t) nbytes < pieces[i].len) {
+            // The file shrank, the connection cannot carry another response
+            fprintf(stderr, "Resource file shrank while sending\n");
+            conn->keep_alive = false;
+            ret = -1;
+        }
+    }
+    conn->scratch_len = 0;
+    if (async_close(resource_fd) == -1) {
+        perror("close");
+        return -1;
+    }
+    return ret;
+}
+
+// Answer with the given byte ranges of a file (206 Partial Content): one range
+// as the body, several as the parts of a multipart/byteranges body. The ranges
+// of a cached file are queued straight from the entry (released once sent),
+// other files' are sent right away with sendfile()
+static int write_ranges(HttpConnection *conn, const char *resource_path, CacheEntry *entry,
+                        const char *mime_type, size_t file_size, const char *validators,
+                        const HttpRange *ranges, int num_ranges) {
+    int niov = num_ranges == 1 ? 2 : 2 * num_ranges + 2;
+    size_t scratch_size = BUFSIZE + num_ranges * PART_HEADER_SIZE;
+    if ((entry != NULL ? reserve(conn, niov, scratch_size) : http_flush(conn)) == -1) {
+        if (entry != NULL) {
+            http_cache_release(entry);
+        }
+        return -1;
+    }
+    const char *end = response_end(conn);
+    size_t scratch_len = conn->scratch_len;
+    Piece pieces[2 * HTTP_MAX_RANGES + 2];
+    int num_pieces = 0;
+    const char *header;
+    size_t header_len;
+    if (num_ranges == 1) {
+        size_t len = ranges[0].last - ranges[0].first + 1;
+        header = scratch_printf(conn, &header_len,
+                                "HTTP/1.1 206 Partial Content\r\nContent-Type: %s\r\n"
+                                "Content-Range: bytes %zu-%zu/%zu\r\nContent-Length: %zu\r\n%s%s",
+                                mime_type, ranges[0].first, ranges[0].last, file_size, len,
+                                validators, end);
+        pieces[1] = { NULL, ranges[0].first, len };
+        num_pieces = 2;
+    } else {
+        // The part headers are formatted first, they add up to the length
+        size_t body_len = 0;
+        num_pieces = 1;
+        for (int i = 0; i < num_ranges; i++) {
+            size_t len = ranges[i].last - ranges[i].first + 1;
+            size_t part_len;
+            const char *part = scratch_printf(
+                conn, &part_len, "\r\n--" BOUNDARY "\r\nContent-Type: %s\r\n"
+                "Content-Range: bytes %zu-%zu/%zu\r\n\r\n",
+                mime_type, ranges[i].first, ranges[i].last, file_size);
+            if (part == NULL) {
+                break;
+            }
+            pieces[num_pieces++] = { part, 0, part_len };
+            pieces[num_pieces++] = { NULL, ranges[i].first, len };
+            body_len += part_len + len;
+        }
+        pieces[num_pieces++] = { LAST_BOUNDARY, 0, sizeof(LAST_BOUNDARY) - 1 };
+        body_len += sizeof(LAST_BOUNDARY) - 1;
+        header = scratch_printf(conn, &header_len,
+                                "HTTP/1.1 206 Partial Content\r\n"
+                                "Content-Type: multipart/byteranges; boundary=" BOUNDARY "\r\n"
+                                "Content-Length: %zu\r\n%s%s",
+                                body_len, validators, end);
+        if (num_pieces != 2 * num_ranges + 2) {
+            header = NULL;
+        }
+    }
+    if (header == NULL) {
+        conn->scratch_len = scratch_len;
+        if (entry != NULL) {
+            http_cache_release(entry);
+        }
+        return -1;
+    }
+    pieces[0] = { header, 0, header_len };
+    if (entry == NULL) {
+        return send_pieces(conn, resource_path, pieces, num_pieces);
+    }
+    for (int i = 0; i < num_pieces; i++) {
+        if (pieces[i].text != NULL) {
+            push_iov(conn, pieces[i].text, pieces[i].len);
+        } else {
+            push_iov(conn, (char *) entry->body + pieces[i].offset, pieces[i].len);
+        }
+    }
+    conn->entries[conn->num_entries++] = entry;
+    conn->num_responses++;
+    return 0;
+}
+
+// Answer with a representation of a resource: the file of path (described by
+// statbuf) as is or as a gzip sidecar, or a body built into the cache from it
+// Input:
+// - key: Cache key of the representation
+// - entry: Cached representation, released once sent. If NULL, the file is
+//          cached under key if possible, otherwise sent with sendfile()
+// - coding: The content coding of the representation, NULL for none
+// - negotiated: true if the representation was chosen by Accept-Encoding
+// Output:
+// - 0 on success, -1 on error
+static int write_representation(HttpConnection *conn, const char *key, const char *path,
+                                CacheEntry *entry, const struct stat *statbuf,
+                                const char *mime_type, const char *coding, bool negotiated) {
+    const HttpRequest *request = &conn->parser.request;
+    const HttpView *range = http_find_header(request, "Range");
+    bool conditional = http_find_header(request, "If-None-Match") != NULL ||
+                       http_find_header(request, "If-Modified-Since") != NULL;
+    long file_size = statbuf->st_size;
+    char etag[ETAG_SIZE];
+    char validators[VALIDATORS_SIZE];
+    format_validators(statbuf->st_mtim, file_size, coding, negotiated, etag, validators);
+    // The client's copy is current
+    if (conditional && not_modified(request, etag, statbuf->st_mtim.tv_sec)) {
+        if (entry != NULL) {
+            http_cache_release(entry);
+        }
+        return queue_formatted(conn, "HTTP/1.1 304 Not Modified\r\n", validators);
+    }
+    // Ranges are only served if the Range field is valid and asks for the
+    // current version of the file. Otherwise the whole file is sent
+    HttpRange ranges[HTTP_MAX_RANGES];
+    int num_ranges = -1;
+    if (range != NULL && range_applies(request, etag, statbuf->st_mtim.tv_sec)) {
+        num_ranges = http_parse_ranges(*range, file_size, ranges);
+    }
+    if (num_ranges == 0) {
+        if (entry != NULL) {
+            http_cache_release(entry);
+        }
+        char fields[64];
+        snprintf(fields, sizeof(fields), "Content-Range: bytes */%ld\r\nContent-Length: 0\r\n",
+                 file_size);
+        return queue_formatted(conn, "HTTP/1.1 416 Range Not Satisfiable\r\n", fields);
+    }
+    // Create buffer for write
+    char buf[BUFSIZE];
+    if (entry == NULL) {
+        // Write the repsonse header to buffer (its end is added when sending)
+        if (format_header(buf, mime_type, file_size, validators) == -1) {
             return -1;
         }
-        // Add bytes read to offset
-        offset += nbytes;
+        // Keep the response for later requests. Files that cannot be cached
+        // are sent straight from disk
+        entry = http_cache_insert(key, path, statbuf, buf, strlen(buf));
+    }
+    if (num_ranges > 0) {
+        return write_ranges(conn, path, entry, mime_type, file_size, validators, ranges,
+                            num_ranges);
+    }
+    if (entry != NULL) {
+        return queue_response(conn, entry->header, entry->header_len, entry);
+    }
+    // Send the earlier pipelined responses first
+    if (http_flush(conn) == -1) {
+        return -1;
+    }
+    strcat(buf, response_end(conn));
+    // Open the resource file
+    int resource_fd = async_open(path, O_RDONLY, S_IRUSR);
+    if (resource_fd == -1) {
+        perror("open");
+        return -1;
+    }
+    // Send the header, corked so it leaves in the same segment as the start
+    // of the body, then have the kernel send the file without copying it
+    if (async_send(conn->fd, buf, strlen(buf), MSG_MORE) == -1) {
+        perror("write");
+        async_close(resource_fd);
+        return -1;
     }
-    // Check if read errored
+    ssize_t nbytes = async_sendfile(conn->fd, resource_fd, 0, file_size);
     if (nbytes == -1) {
-        perror("read");
-        close(resource_fd);
+        perror("sendfile");
+        async_close(resource_fd);
         return -1;
     }
+    // The file shrank, the client will notice the short body (and the
+    // connection cannot carry another response)
+    if (nbytes < file_size) {
+        fprintf(stderr, "Resource file shrank while sending\n");
+        conn->keep_alive = false;
+    }
     // Close resource file
-    if (close(resource_fd) == -1) {
+    if (async_close(resource_fd) == -1) {
         perror("close");
         return -1;
     }
     return 0;
 }
+
+// Returns true if the gzip sidecar of a file (described by file_stat) exists
+// and is at least as new as the file (gzip -k keeps the file's mtime)
+// Output:
+// - sidecar_stat: The sidecar's properties
+static bool has_current_sidecar(const char *sidecar, const struct stat *file_stat,
+                                struct stat *sidecar_stat) {
+    return async_stat(sidecar, sidecar_stat) == 0 && S_ISREG(sidecar_stat->st_mode) &&
+           timer_compare(sidecar_stat->st_mtim, file_stat->st_mtim) >= 0;
+}
+
+// Read size bytes of the file of path into memory
+// Output:
+// - The malloc()ed contents, NULL on failure (including a file shorter than
+//   size)
+static char *read_file(const char *path, size_t size) {
+    int fd = async_open(path, O_RDONLY);
+    if (fd == -1) {
+        perror("open");
+        return NULL;
+    }
+    char *data = (char *) malloc(size > 0 ? size : 1);
+    size_t loaded = 0;
+    while (data != NULL && loaded < size) {
+        ssize_t nbytes = async_pread(fd, data + loaded, size - loaded, loaded);
+        if (nbytes <= 0) {
+            free(data);
+            data = NULL;
+        } else {
+            loaded += nbytes;
+        }
+    }
+    async_close(fd);
+    if (data == NULL) {
+        fprintf(stderr, "Failed to read %s\n", path);
+    }
+    return data;
+}
+
+// Cache the gzip variant (body, malloc()ed) of the file of path (described
+// by statbuf) under key. The entry is checked against the file like any other,
+// so the variant is loaded again only once the file changes (or the entry is
+// evicted)
+// Output:
+// - Referenced entry (release with http_cache_release()), NULL on failure
+static CacheEntry *cache_gzip(const char *key, const char *path, const struct stat *statbuf,
+                              const char *mime_type, void *body, size_t body_len) {
+    char etag[ETAG_SIZE];
+    char validators[VALIDATORS_SIZE];
+    format_validators(statbuf->st_mtim, body_len, "gzip", true, etag, validators);
+    char header[BUFSIZE];
+    int header_len = format_header(header, mime_type, body_len, validators);
+    if (header_len == -1) {
+        free(body);
+        return NULL;
+    }
+    return http_cache_insert_built(key, path, statbuf, header, header_len, body, body_len);
+}
+
+// Compress the file of path (described by statbuf) with gzip and cache the
+// result under key
+// Output:
+// - Referenced entry (release with http_cache_release()), NULL on failure
+static CacheEntry *build_gzip(const char *key, const char *path, const struct stat *statbuf,
+                              const char *mime_type) {
+    size_t size = statbuf->st_size;
+    // zlib takes the input length as an unsigned int
+    if (size > UINT_MAX) {
+        return NULL;
+    }
+    char *data = read_file(path, size);
+    if (data == NULL) {
+        return NULL;
+    }
+    // The file is compressed once, so the best compression is worth its CPU.
+    // 16 + 15 window bits writes the gzip header and trailer
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 16 + 15, 8, Z_DEFAULT_STRATEGY) !=
+        Z_OK) {
+        fprintf(stderr, "deflateInit2 failed\n");
+        free(data);
+        return NULL;
+    }
+    size_t bound = deflateBound(&stream, size);
+    unsigned char *body = (unsigned char *) malloc(bound);
+    int ret_val = Z_MEM_ERROR;
+    if (body != NULL) {
+        stream.next_in = (unsigned char *) data;
+        stream.avail_in = size;
+        stream.next_out = body;
+        stream.avail_out = bound;
+        ret_val = deflate(&stream, Z_FINISH);
+    }
+    size_t body_len = stream.total_out;
+    deflateEnd(&stream);
+    free(data);
+    if (ret_val != Z_STREAM_END) {
+        fprintf(stderr, "Failed to compress %s\n", path);
+        free(body);
+        return NULL;
+    }
+    PRINT("Compressed %s from %zu to %zu bytes\n", path, size, body_len);
+    return cache_gzip(key, path, statbuf, mime_type, body, body_len);
+}
+
+// Load the gzip variant of the file of path (described by statbuf) into the
+// cache under key: its current sidecar (of sidecar_size bytes) if has_sidecar,
+// otherwise the file compressed now
+// Output:
+// - Referenced entry (release with http_cache_release()), NULL if it cannot be
+//   cached
+static CacheEntry *load_gzip(const char *key, const char *path, const struct stat *statbuf,
+                             const char *mime_type, bool has_sidecar, const char *sidecar,
+                             size_t sidecar_size) {
+    if (!has_sidecar) {
+        return build_gzip(key, path, statbuf, mime_type);
+    }
+    if (!http_cache_can_hold(sidecar_size)) {
+        return NULL;
+    }
+    char *body = read_file(sidecar, sidecar_size);
+    if (body == NULL) {
+        return NULL;
+    }
+    return cache_gzip(key, path, statbuf, mime_type, body, sidecar_size);
+}
+
+// Record on the cached entry of a file (if any) that it has no gzip variant,
+// so the next requests skip looking for one until the entry is checked again
+// Output:
+// - 1 (no gzip variant)
+static int no_gzip_variant(CacheEntry *identity) {
+    if (identity != NULL) {
+        http_cache_set_no_variant(identity);
+    }
+    return 1;
+}
+
+// Answer with the gzip variant of a text file: the cached one, the file's .gz
+// sidecar, or (with precompression) one built now. The variant is described
+// by the file's modification time, so it is current as long as the file is
+// Output:
+// - 0 on success, -1 on error, 1 if the file has no gzip variant (the caller
+//   sends it as is)
+// - identity: If 1, the cached entry of the file as is (release with
+//             http_cache_release()), NULL if not cached
+static int write_gzip_response(HttpConnection *conn, const char *resource_path,
+                               const char *mime_type, CacheEntry **identity) {
+    const HttpRequest *request = &conn->parser.request;
+    char key[BUFSIZE + sizeof(GZIP_KEY_SUFFIX)];
+    char sidecar[BUFSIZE + sizeof(".gz")];
+    snprintf(key, sizeof(key), "%s" GZIP_KEY_SUFFIX, resource_path);
+    snprintf(sidecar, sizeof(sidecar), "%s.gz", resource_path);
+    struct stat statbuf;
+    *identity = NULL;
+    // Most text files have no variant, so a miss here is not counted
+    CacheEntry *entry = http_cache_lookup(key, true);
+    if (entry != NULL) {
+        if (http_find_header(request, "Range") == NULL &&
+            http_find_header(request, "If-None-Match") == NULL &&
+            http_find_header(request, "If-Modified-Since") == NULL) {
+            return queue_response(conn, entry->header, entry->header_len, entry);
+        }
+        // Only the size and modification time are used for a cached variant
+        statbuf.st_size = entry->body_len;
+        statbuf.st_mtim = entry->mtime;
+        return write_representation(conn, key, sidecar, entry, &statbuf, mime_type, "gzip", true);
+    }
+    // The file decides whether a variant is worth it and whether the sidecar
+    // is current
+    *identity = http_cache_lookup(resource_path);
+    if (*identity != NULL && (*identity)->no_variant) {
+        return 1;
+    }
+    if (*identity != NULL) {
+        statbuf.st_mode = S_IFREG;
+        statbuf.st_size = (*identity)->file_size;
+        statbuf.st_mtim = (*identity)->mtime;
+    } else if (async_stat(resource_path, &statbuf) == -1) {
+        return 1;
+    }
+    if (!S_ISREG(statbuf.st_mode) || statbuf.st_size < GZIP_MIN_SIZE) {
+        return no_gzip_variant(*identity);
+    }
+    struct stat sidecar_stat;
+    bool has_sidecar = has_current_sidecar(sidecar, &statbuf, &sidecar_stat);
+    if (!has_sidecar && (!precompress || !http_cache_can_hold(statbuf.st_size))) {
+        return no_gzip_variant(*identity);
+    }
+    entry = load_gzip(key, resource_path, &statbuf, mime_type, has_sidecar, sidecar,
+                      has_sidecar ? sidecar_stat.st_size : 0);
+    if (entry == NULL && !has_sidecar) {
+        return no_gzip_variant(*identity);
+    }
+    if (*identity != NULL) {
+        http_cache_release(*identity);
+        *identity = NULL;
+    }
+    if (entry != NULL) {
+        statbuf.st_size = entry->body_len;
+        return write_representation(conn, key, sidecar, entry, &statbuf, mime_type, "gzip", true);
+    }
+    // Too large for the cache, the sidecar is sent from disk
+    sidecar_stat.st_mtim = statbuf.st_mtim;
+    return write_representation(conn, key, sidecar, NULL, &sidecar_stat, mime_type, "gzip", true);
+}
+
+int write_http_response(HttpConnection *conn, const char *resource_path) {
+    const HttpRequest *request = &conn->parser.request;
+    const char *extension = get_extension(resource_path);
+    const char *mime_type = extension != NULL ? get_mime_type(extension) : NULL;
+    // Text files are also sent gzip-compressed to the clients accepting it,
+    // so their responses depend on Accept-Encoding
+    bool negotiated = is_compressible(mime_type);
+    CacheEntry *entry;
+    const HttpView *accept_encoding = http_find_header(request, "Accept-Encoding");
+    if (negotiated && accept_encoding != NULL && http_accepts_coding(*accept_encoding, "gzip")) {
+        int ret_val = write_gzip_response(conn, resource_path, mime_type, &entry);
+        if (ret_val != 1) {
+            return ret_val;
+        }
+    } else {
+        entry = http_cache_lookup(resource_path);
+    }
+    // Serve the response from the cache if possible (its header carries the
+    // validators already)
+    if (entry != NULL && http_find_header(request, "Range") == NULL &&
+        http_find_header(request, "If-None-Match") == NULL &&
+        http_find_header(request, "If-Modified-Since") == NULL) {
+        return queue_response(conn, entry->header, entry->header_len, entry);
+    }
+    // Call stat to get file properties and check if resource path is valid
+    struct stat statbuf;
+    if (entry != NULL) {
+        // Only the size and modification time are used for a cached file
+        statbuf.st_size = entry->body_len;
+        statbuf.st_mtim = entry->mtime;
+    } else if (async_stat(resource_path, &statbuf) == -1) {
+        // Check if stat failed from something other than ENOENT
+        if (errno != ENOENT) {
+            perror("stat");
+            return -1;
+        }
+        // Otherwise resource path doesn't exist
+        return queue_response(conn, NOT_FOUND, strlen(NOT_FOUND), NULL);
+    }
+    // Otherwise resource path exists
+    // Check for no extension
+    if (extension == NULL) {
+        // Do something
+        conn->keep_alive = false;
+        return 0;
+    }
+    // Check the Content-Type
+    if (mime_type == NULL) {
+        fprintf(stderr, "Failed to get content-type: invalid file extension\n");
+        return -1;
+    }
+    return write_representation(conn, resource_path, resource_path, entry, &statbuf, mime_type,
+                                NULL, negotiated);
+}
+
+// Cache the gzip variants of the text files under dir and its subdirectories
+// Output:
+// - Number of variants cached, -1 if dir cannot be read
+static int precompress_dir(const char *dir) {
+    DIR *stream = opendir(dir);
+    if (stream == NULL) {
+        perror("opendir");
+        return -1;
+    }
+    int cached = 0;
+    struct dirent *file;
+    while ((file = readdir(stream)) != NULL) {
+        // Skips hidden files, "." and ".."
+        if (file->d_name[0] == '.') {
+            continue;
+        }
+        // Named as a request for the file would name it
+        char path[BUFSIZE];
+        char key[BUFSIZE + sizeof(GZIP_KEY_SUFFIX)];
+        char sidecar[BUFSIZE + sizeof(".gz")];
+        if (snprintf(path, sizeof(path), "%s/%s", dir, file->d_name) >= (int) sizeof(path)) {
+            continue;
+        }
+        snprintf(key, sizeof(key), "%s" GZIP_KEY_SUFFIX, path);
+        snprintf(sidecar, sizeof(sidecar), "%s.gz", path);
+        struct stat statbuf;
+        struct stat sidecar_stat;
+        if (async_stat(path, &statbuf) == -1) {
+            continue;
+        }
+        if (S_ISDIR(statbuf.st_mode)) {
+            int ret_val = precompress_dir(path);
+            cached += ret_val > 0 ? ret_val : 0;
+            continue;
+        }
+        const char *extension = get_extension(file->d_name);
+        const char *mime_type = extension != NULL ? get_mime_type(extension) : NULL;
+        if (!is_compressible(mime_type) || !S_ISREG(statbuf.st_mode) ||
+            statbuf.st_size < GZIP_MIN_SIZE) {
+            continue;
+        }
+        bool has_sidecar = has_current_sidecar(sidecar, &statbuf, &sidecar_stat);
+        if (!has_sidecar && !http_cache_can_hold(statbuf.st_size)) {
+            continue;
+        }
+        CacheEntry *entry = load_gzip(key, path, &statbuf, mime_type, has_sidecar, sidecar,
+                                      has_sidecar ? sidecar_stat.st_size : 0);
+        if (entry != NULL) {
+            http_cache_release(entry);
+            cached++;
+        }
+    }
+    closedir(stream);
+    return cached;
+}
+
+int http_precompress(const char *dir) {
+    precompress = true;
+    int cached = precompress_dir(dir);
+    if (cached == -1) {
+        return -1;
+    }
+    printf("Cached gzip variants of %d text files\n", cached);
+    return 0;
+}
@@ -3,20 +3,106 @@
 #ifndef HTTP_H
 #define HTTP_H
 
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include "http_parser.h"
+
+#define REQUEST_BUFSIZE HTTP_MAX_REQUEST_SIZE    // Max http request header size
+#define RESPONSE_BATCH 16                        // Max pipelined responses sent with one write
+#define RESPONSE_SCRATCH 4096                    // Bytes for the headers of queued responses
+
+struct CacheEntry;
+
+/*
+ * An HTTP/1.1 client connection and the state kept across its requests
+ * Requests the client pipelined arrive in buf together. Their responses are
+ * queued in iov and sent with one write once no complete request is left in
+ * buf (or the batch is full). Headers built for one response (e.g. of a 206 or
+ * 304) are kept in scratch until then
+ */
+struct HttpConnection {
+    int fd;                                  // The socket's file descriptor
+    bool keep_alive;                         // false if the last request closes the connection
+    bool http10;                             // true if the last request was HTTP/1.0
+    char buf[REQUEST_BUFSIZE];               // Received bytes
+    size_t buffered;                         // Number of bytes in buf
+    size_t request_len;                      // Bytes of buf taken by the last request
+    HttpParser parser;                       // Parser of the request at the start of buf
+    struct iovec iov[3 * RESPONSE_BATCH];    // Queued responses
+    int iovcnt;                              // Number of buffers in iov
+    CacheEntry *entries[RESPONSE_BATCH];     // Cache entries referenced by iov
+    int num_entries;                         // Number of entries
+    int num_responses;                       // Number of responses queued
+    char scratch[RESPONSE_SCRATCH];          // Headers referenced by iov
+    size_t scratch_len;                      // Bytes of scratch in use
+};
+
 /*
- * Read an HTTP request from an active TCP connection socket
+ * Set up the state of a new connection
+ * conn: The connection
  * fd: The socket's file descriptor
- * resource_name: Set to the name of the requested resource on success
+ */
+void http_connection_init(HttpConnection *conn, int fd);
+
+/*
+ * Read the next HTTP request from a connection. Queued responses are sent
+ * first if the request has not been received completely yet. Malformed or
+ * too large requests are answered with an error status
+ * conn: The connection
+ * resource_name: The name of the requested resource is appended to it on
+ *                success
+ * size: Size of the resource_name buffer
+ * Returns 0 on success or -1 on error (or if the client closed the connection)
+ */
+int read_http_request(HttpConnection *conn, char *resource_name, size_t size);
+
+/*
+ * Queue (or send) the HTTP response to the last request of a connection.
+ * Requests with a Range field get the requested byte ranges (206 Partial
+ * Content), and conditional requests (If-None-Match, If-Modified-Since) whose
+ * copy is current get 304 Not Modified. Text files are sent gzip-compressed to
+ * clients accepting it if a current .gz sidecar file exists next to them (the
+ * sidecar is cached like the file), or if precompression is on (see
+ * http_precompress())
+ * conn: The connection
+ * resource_path: The path to the requested resource in the server's file system
  * Returns 0 on success or -1 on error
  */
-int read_http_request(int fd, char *resource_name);
+int write_http_response(HttpConnection *conn, const char *resource_path);
 
 /*
- * Write an HTTP response to an active TCP connection socket
+ * Send the queued responses of a connection
+ * conn: The connection
+ * Returns 0 on success or -1 on error
+ */
+int http_flush(HttpConnection *conn);
+
+/*
+ * Check whether a kept alive connection has gone idle, i.e. no request bytes
+ * are buffered or waiting in the socket. Queued responses are sent first
+ * conn: The connection
+ * Returns 1 if idle, 0 if there is more to serve, -1 on error or if the
+ * client closed the connection
+ */
+int http_connection_idle(HttpConnection *conn);
+
+/*
+ * Tell a client the server is too busy to serve its connection (503 Service
+ * Unavailable) without blocking. The caller closes the connection
  * fd: The socket's file descriptor
- * resource_path: The path to the requested resource in the server's file system
  * Returns 0 on success or -1 on error
  */
-int write_http_response(int fd, const char *resource_path);
+int http_send_unavailable(int fd);
+
+/*
+ * Cache gzip variants of the text files under a directory now, and of text
+ * files added or changed later once requested. Each file is compressed once
+ * per version, or not at all if it has a current .gz sidecar (then the sidecar
+ * is cached)
+ * dir: The directory, named as in resource paths
+ * Returns 0 on success or -1 on error
+ */
+int http_precompress(const char *dir);
 
 #endif    // HTTP_H
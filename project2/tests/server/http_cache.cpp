@@ -0,0 +1,282 @@
+#include "http_cache.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <string>
+#include <unordered_map>
+
+#include "../../lib/Lock.h"
+#include "../../lib/async_io.h"
+#include "../../lib/async_syscall.h"
+#include "../../lib/debug.cpp"
+#include "../../lib/timer.h"
+
+static Lock cache_lock("http_cache");    // Guards everything below
+static std::unordered_map<std::string, CacheEntry *> table;
+static CacheEntry *lru_head = nullptr;    // Most recently used entry
+static CacheEntry *lru_tail = nullptr;    // Least recently used entry
+static size_t budget = CACHE_BUDGET;
+static long revalidate_usecs = CACHE_REVALIDATE;
+static HttpCacheStats stats;
+
+// Set the cache budget and revalidation interval
+void http_cache_init(size_t cache_budget, long revalidate_interval) {
+    budget = cache_budget;
+    revalidate_usecs = revalidate_interval;
+}
+
+// Microseconds from start to end
+static long usecs_between(const struct timespec &start, const struct timespec &end) {
+    return (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000;
+}
+
+static void lru_unlink(CacheEntry *entry) {
+    if (entry->lru_prev != nullptr) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        lru_head = entry->lru_next;
+    }
+    if (entry->lru_next != nullptr) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        lru_tail = entry->lru_prev;
+    }
+}
+
+static void lru_push(CacheEntry *entry) {
+    entry->lru_prev = nullptr;
+    entry->lru_next = lru_head;
+    if (lru_head != nullptr) {
+        lru_head->lru_prev = entry;
+    } else {
+        lru_tail = entry;
+    }
+    lru_head = entry;
+}
+
+// Drop a reference, freeing the entry with the last one
+// NOTE: Assumes the lock is held
+static void put(CacheEntry *entry) {
+    if (--entry->refs > 0) {
+        return;
+    }
+    if (entry->mapped) {
+        munmap(entry->body, entry->body_len);
+    } else {
+        free(entry->body);
+    }
+    if (entry->file != entry->path) {
+        free(entry->file);
+    }
+    free(entry->path);
+    delete entry;
+}
+
+// Take an entry out of the cache. Threads still sending it keep it alive
+// NOTE: Assumes the lock is held
+static void drop(CacheEntry *entry) {
+    table.erase(entry->path);
+    lru_unlink(entry);
+    stats.entries--;
+    stats.bytes -= entry->body_len;
+    put(entry);
+}
+
+// Find the entry of path, checking it against the file if needed
+CacheEntry *http_cache_lookup(const char *path, bool probe) {
+    if (budget == 0) {
+        return nullptr;
+    }
+    cache_lock.lock();
+    auto it = table.find(path);
+    if (it == table.end()) {
+        if (!probe) {
+            stats.misses++;
+        }
+        cache_lock.unlock();
+        return nullptr;
+    }
+    CacheEntry *entry = it->second;
+    entry->refs++;
+    lru_unlink(entry);
+    lru_push(entry);
+    stats.hits++;
+    // Only one thread checks an entry per interval, the others use it as is
+    struct timespec now = timer_now();
+    bool check = usecs_between(entry->checked, now) >= revalidate_usecs;
+    if (check) {
+        // A variant may have appeared without the file changing
+        entry->checked = now;
+        entry->no_variant = false;
+    }
+    cache_lock.unlock();
+    if (!check) {
+        return entry;
+    }
+    // Check the file without holding the lock
+    struct stat statbuf;
+    if (async_stat(entry->file, &statbuf) == 0 && statbuf.st_mtim.tv_sec == entry->mtime.tv_sec &&
+        statbuf.st_mtim.tv_nsec == entry->mtime.tv_nsec &&
+        (size_t) statbuf.st_size == entry->file_size) {
+        return entry;
+    }
+    // The file changed or is gone, the caller rebuilds the response
+    PRINT("Cache entry of %s is stale\n", path);
+    cache_lock.lock();
+    auto current = table.find(path);
+    if (current != table.end() && current->second == entry) {
+        drop(entry);
+        stats.invalidations++;
+    }
+    stats.hits--;
+    if (!probe) {
+        stats.misses++;
+    }
+    put(entry);
+    cache_lock.unlock();
+    return nullptr;
+}
+
+// Copy (or map) size bytes of the file fd into memory
+// Output:
+// - The contents, nullptr on failure (including a file shorter than size)
+static void *load_body(int fd, size_t size, bool *mapped) {
+    *mapped = size >= CACHE_MMAP_MIN;
+    if (*mapped) {
+        void *body = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        return body == MAP_FAILED ? nullptr : body;
+    }
+    // malloc(0) may return nullptr
+    char *body = (char *) malloc(size > 0 ? size : 1);
+    if (body == nullptr) {
+        return nullptr;
+    }
+    size_t loaded = 0;
+    while (loaded < size) {
+        ssize_t nbytes = async_pread(fd, body + loaded, size - loaded, loaded);
+        if (nbytes <= 0) {
+            free(body);
+            return nullptr;
+        }
+        loaded += nbytes;
+    }
+    return body;
+}
+
+// Create an entry for key holding body, checked against the file of path
+// (described by statbuf)
+static CacheEntry *new_entry(const char *key, const char *path, const struct stat *statbuf,
+                             const char *header, size_t header_len, void *body, size_t body_len,
+                             bool mapped) {
+    CacheEntry *entry = new CacheEntry;
+    entry->path = strdup(key);
+    entry->file = strcmp(key, path) == 0 ? entry->path : strdup(path);
+    memcpy(entry->header, header, header_len);
+    entry->header_len = header_len;
+    entry->body = body;
+    entry->body_len = body_len;
+    entry->mapped = mapped;
+    entry->file_size = statbuf->st_size;
+    entry->mtime = statbuf->st_mtim;
+    entry->checked = timer_now();
+    entry->no_variant = false;
+    entry->refs = 2;    // The cache's and the caller's
+    return entry;
+}
+
+// Cache an entry, evicting least recently used entries to stay within the
+// budget
+static void publish(CacheEntry *entry) {
+    cache_lock.lock();
+    // Another thread may have cached the file meanwhile, the newer entry wins
+    auto it = table.find(entry->path);
+    if (it != table.end()) {
+        drop(it->second);
+    }
+    table[entry->path] = entry;
+    lru_push(entry);
+    stats.entries++;
+    stats.bytes += entry->body_len;
+    while (stats.bytes > budget && lru_tail != entry) {
+        drop(lru_tail);
+        stats.evictions++;
+    }
+    cache_lock.unlock();
+}
+
+bool http_cache_can_hold(size_t size) {
+    // Files that take a large part of the budget are sent with sendfile()
+    // instead, so they do not flush everything else out of the cache
+    return budget != 0 && size <= budget / 4;
+}
+
+// Read (or map) the file of path into a new entry and cache it under key
+CacheEntry *http_cache_insert(const char *key, const char *path, const struct stat *statbuf,
+                              const char *header, size_t header_len) {
+    size_t size = statbuf->st_size;
+    if (!http_cache_can_hold(size) || !S_ISREG(statbuf->st_mode) ||
+        header_len > CACHE_HEADER_SIZE) {
+        return nullptr;
+    }
+    int fd = async_open(path, O_RDONLY);
+    if (fd == -1) {
+        return nullptr;
+    }
+    // The header was built from statbuf, give up if the file changed since
+    struct stat current;
+    bool mapped = false;
+    void *body = nullptr;
+    if (fstat(fd, &current) == 0 && current.st_size == statbuf->st_size &&
+        current.st_mtim.tv_sec == statbuf->st_mtim.tv_sec &&
+        current.st_mtim.tv_nsec == statbuf->st_mtim.tv_nsec) {
+        body = load_body(fd, size, &mapped);
+    }
+    // A mapping stays valid after the file is closed
+    async_close(fd);
+    if (body == nullptr) {
+        return nullptr;
+    }
+    CacheEntry *entry = new_entry(key, path, statbuf, header, header_len, body, size, mapped);
+    PRINT("Caching %s (%zu bytes%s)\n", key, size, mapped ? ", mapped" : "");
+    publish(entry);
+    return entry;
+}
+
+// Cache a body built from the file of path under key
+CacheEntry *http_cache_insert_built(const char *key, const char *path, const struct stat *statbuf,
+                                    const char *header, size_t header_len, void *body,
+                                    size_t body_len) {
+    if (!http_cache_can_hold(body_len) || header_len > CACHE_HEADER_SIZE) {
+        free(body);
+        return nullptr;
+    }
+    CacheEntry *entry = new_entry(key, path, statbuf, header, header_len, body, body_len, false);
+    PRINT("Caching %s (%zu bytes built from %s)\n", key, body_len, path);
+    publish(entry);
+    return entry;
+}
+
+// Record that the file of entry has no variant
+void http_cache_set_no_variant(CacheEntry *entry) {
+    cache_lock.lock();
+    entry->no_variant = true;
+    cache_lock.unlock();
+}
+
+// Release a reference to an entry
+void http_cache_release(CacheEntry *entry) {
+    cache_lock.lock();
+    put(entry);
+    cache_lock.unlock();
+}
+
+// Copy the cache counters into stats
+void http_cache_get_stats(HttpCacheStats *snapshot) {
+    cache_lock.lock();
+    *snapshot = stats;
+    cache_lock.unlock();
+}
@@ -0,0 +1,95 @@
+#ifndef HTTP_CACHE_H
+#define HTTP_CACHE_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define CACHE_BUDGET (32 * 1024 * 1024)    // Default bytes of file data kept in memory
+#define CACHE_REVALIDATE 1000000L          // Default usecs between mtime checks of an entry
+#define CACHE_MMAP_MIN (64 * 1024)         // Files at least this large are mapped, not copied
+#define CACHE_HEADER_SIZE 256              // Max size of a prebuilt response header
+
+// Cached response for one resource: the prebuilt response header followed by
+// the whole file, either copied into memory or mapped, or by a body built from
+// the file (e.g. a compressed copy)
+// Entries are reference counted, so an entry that is evicted or invalidated
+// while it is being sent stays valid until it is released
+struct CacheEntry {
+    char *path;                         // Resource path (the key), e.g. of a .gz variant
+    char *file;                         // File the entry is checked against
+    char header[CACHE_HEADER_SIZE];     // Prebuilt response header
+    size_t header_len;                  // Length of header
+    void *body;                         // File contents, or the body built from them
+    size_t body_len;                    // Length of body
+    bool mapped;                        // true if body is an mmap() of the file
+    size_t file_size;                   // Size of file when the entry was built
+    struct timespec mtime;              // Modification time the entry was built from
+    struct timespec checked;            // Last time mtime was checked
+    bool no_variant;                    // true if no variant (e.g. gzip) existed when checked
+    int refs;                           // References held, including the cache's own
+    CacheEntry *lru_prev, *lru_next;    // LRU list, most recently used first
+};
+
+// Counters since the server started
+struct HttpCacheStats {
+    unsigned long hits;             // Lookups served from the cache
+    unsigned long misses;           // Lookups that found no (valid) entry
+    unsigned long invalidations;    // Entries dropped because their file changed
+    unsigned long evictions;        // Entries dropped to stay within the budget
+    unsigned long entries;          // Entries cached now
+    size_t bytes;                   // Bytes of file data cached now
+};
+
+// Set the cache budget and how often entries are checked against their file
+// Input:
+// - budget: Bytes of file data to keep in memory, 0 disables the cache
+// - revalidate_usecs: An entry older than this is checked with stat() before
+//                     it is used again (0 checks on every use)
+// NOTE: Must be called before the cache is used
+void http_cache_init(size_t budget, long revalidate_usecs);
+
+// Find the entry of path, checking it against the file if it was not checked
+// for revalidate_usecs (which also clears its no_variant flag)
+// Input:
+// - probe: If true a miss is not counted (for optional entries, e.g. variants)
+// Output:
+// - Referenced entry (release with http_cache_release()), nullptr on a miss
+CacheEntry *http_cache_lookup(const char *path, bool probe = false);
+
+// Record that the file of entry has no variant, so that lookups of the
+// variant can be skipped until the entry is checked again
+void http_cache_set_no_variant(CacheEntry *entry);
+
+// Read (or map) the file of path, described by statbuf, into a new entry with
+// the given response header and cache it under key (usually path), evicting
+// least recently used entries to stay within the budget
+// Output:
+// - Referenced entry (release with http_cache_release()), nullptr if the file
+//   cannot be cached (too large, too long a header, cache disabled or an error)
+CacheEntry *http_cache_insert(const char *key, const char *path, const struct stat *statbuf,
+                              const char *header, size_t header_len);
+
+// Cache a body built in memory from the file of path (e.g. a compressed copy)
+// under key, with the given response header. The entry is checked against
+// the file, described by statbuf, like any other
+// Input:
+// - body: malloc()ed, the cache takes it over (it is freed if the entry
+//   cannot be cached)
+// Output:
+// - Referenced entry (release with http_cache_release()), nullptr if it
+//   cannot be cached
+CacheEntry *http_cache_insert_built(const char *key, const char *path, const struct stat *statbuf,
+                                    const char *header, size_t header_len, void *body,
+                                    size_t body_len);
+
+// Returns true if a body of size bytes may be cached
+bool http_cache_can_hold(size_t size);
+
+// Release a reference returned by http_cache_lookup() or an insert
+void http_cache_release(CacheEntry *entry);
+
+// Copy the cache counters into stats
+void http_cache_get_stats(HttpCacheStats *stats);
+
+#endif    // HTTP_CACHE_H
@@ -0,0 +1,423 @@
+#include "http_parser.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Parser states
+enum { PARSE_REQUEST_LINE, PARSE_HEADERS, PARSE_DONE, PARSE_ERROR };
+
+// Bitmap of the characters allowed in methods and field names (RFC 7230
+// tchar: letters, digits and !#$%&'*+-.^_`|~), one bit per ASCII character
+static const uint64_t token_chars[2] = { 0x03ff6cfa00000000ULL, 0x57ffffffc7fffffeULL };
+
+static bool is_token_char(unsigned char c) {
+    return c < 128 && ((token_chars[c >> 6] >> (c & 63)) & 1) != 0;
+}
+
+// Returns true if c ends a line or is not allowed in a request header (control
+// characters other than tab and carriage return)
+static bool is_stop_char(unsigned char c) {
+    return (c < 0x20 && c != '\t' && c != '\r') || c == 0x7f;
+}
+
+size_t http_scan_scalar(const char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (is_stop_char(data[i])) {
+            return i;
+        }
+    }
+    return len;
+}
+
+#ifdef __SSE2__
+size_t http_scan(const char *data, size_t len) {
+    const __m128i max_control = _mm_set1_epi8(0x1f);
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i carriage_return = _mm_set1_epi8('\r');
+    const __m128i del = _mm_set1_epi8(0x7f);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *) (data + i));
+        // Unsigned bytes <= 0x1f, except tab and carriage return, or DEL
+        __m128i stop = _mm_cmpeq_epi8(_mm_min_epu8(bytes, max_control), bytes);
+        __m128i allowed =
+            _mm_or_si128(_mm_cmpeq_epi8(bytes, tab), _mm_cmpeq_epi8(bytes, carriage_return));
+        stop = _mm_or_si128(_mm_andnot_si128(allowed, stop), _mm_cmpeq_epi8(bytes, del));
+        int mask = _mm_movemask_epi8(stop);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + http_scan_scalar(data + i, len - i);
+}
+#else
+size_t http_scan(const char *data, size_t len) {
+    return http_scan_scalar(data, len);
+}
+#endif
+
+void http_parser_init(HttpParser *parser) {
+    parser->state = PARSE_REQUEST_LINE;
+    parser->offset = 0;
+    parser->scanned = 0;
+    parser->error = 0;
+    parser->request.num_headers = 0;
+    parser->request.length = 0;
+}
+
+// Fail the request with the given HTTP status
+static HttpParseStatus fail(HttpParser *parser, int status) {
+    parser->state = PARSE_ERROR;
+    parser->error = status;
+    return HTTP_PARSE_ERROR;
+}
+
+// Parse "<method> <target> HTTP/1.<minor>". Returns 0 or the HTTP status to
+// fail with
+static int parse_request_line(HttpRequest *request, const char *line, size_t len) {
+    const char *end = line + len;
+    const char *space = (const char *) memchr(line, ' ', len);
+    if (space == NULL || space == line) {
+        return 400;
+    }
+    for (const char *c = line; c < space; c++) {
+        if (!is_token_char(*c)) {
+            return 400;
+        }
+    }
+    request->method.data = line;
+    request->method.len = space - line;
+    const char *target = space + 1;
+    space = (const char *) memchr(target, ' ', end - target);
+    if (space == NULL || space == target) {
+        return 400;
+    }
+    request->path.data = target;
+    request->path.len = space - target;
+    request->version.data = space + 1;
+    request->version.len = end - (space + 1);
+    const char *version = request->version.data;
+    if (request->version.len != 8 || strncmp(version, "HTTP/", 5) != 0 || version[6] != '.' ||
+        version[5] < '0' || version[5] > '9' || version[7] < '0' || version[7] > '9') {
+        return 400;
+    }
+    if (version[5] != '1') {
+        return 505;
+    }
+    request->minor_version = version[7] - '0';
+    return 0;
+}
+
+// Parse "<name>:<value>". Returns 0 or the HTTP status to fail with
+static int parse_header_line(HttpRequest *request, const char *line, size_t len) {
+    if (request->num_headers == HTTP_MAX_HEADERS) {
+        return 431;
+    }
+    const char *colon = (const char *) memchr(line, ':', len);
+    if (colon == NULL || colon == line) {
+        return 400;
+    }
+    // No whitespace is allowed between the name and the colon
+    for (const char *c = line; c < colon; c++) {
+        if (!is_token_char(*c)) {
+            return 400;
+        }
+    }
+    const char *value = colon + 1;
+    const char *end = line + len;
+    while (value < end && (*value == ' ' || *value == '\t')) {
+        value++;
+    }
+    while (end > value && (end[-1] == ' ' || end[-1] == '\t')) {
+        end--;
+    }
+    HttpHeader *header = &request->headers[request->num_headers++];
+    header->name.data = line;
+    header->name.len = colon - line;
+    header->value.data = value;
+    header->value.len = end - value;
+    return 0;
+}
+
+HttpParseStatus http_parse(HttpParser *parser, const char *buf, size_t len) {
+    if (parser->state == PARSE_DONE) {
+        return HTTP_PARSE_DONE;
+    }
+    if (parser->state == PARSE_ERROR) {
+        return HTTP_PARSE_ERROR;
+    }
+    HttpRequest *request = &parser->request;
+    while (true) {
+        // Find the end of the current line, continuing where the last call
+        // stopped
+        size_t line_start = parser->offset;
+        size_t limit = len < HTTP_MAX_REQUEST_SIZE ? len : HTTP_MAX_REQUEST_SIZE;
+        size_t stop = parser->scanned + http_scan(buf + parser->scanned, limit - parser->scanned);
+        if (stop == limit) {
+            parser->scanned = limit;
+            if (parser->state == PARSE_REQUEST_LINE &&
+                limit - line_start > HTTP_MAX_REQUEST_LINE) {
+                return fail(parser, 414);
+            }
+            if (limit == HTTP_MAX_REQUEST_SIZE) {
+                return fail(parser, 431);
+            }
+            return HTTP_PARSE_INCOMPLETE;
+        }
+        if (buf[stop] != '\n') {
+            return fail(parser, 400);
+        }
+        // Lines end with CRLF, a bare LF is accepted as well
+        size_t line_end = stop > line_start && buf[stop - 1] == '\r' ? stop - 1 : stop;
+        size_t line_len = line_end - line_start;
+        parser->offset = parser->scanned = stop + 1;
+        int status;
+        if (parser->state == PARSE_REQUEST_LINE) {
+            // Empty lines before the request line are ignored (RFC 7230 3.5)
+            if (line_len == 0) {
+                continue;
+            }
+            if (line_len > HTTP_MAX_REQUEST_LINE) {
+                return fail(parser, 414);
+            }
+            status = parse_request_line(request, buf + line_start, line_len);
+            parser->state = PARSE_HEADERS;
+        } else if (line_len == 0) {
+            request->length = parser->offset;
+            parser->state = PARSE_DONE;
+            return HTTP_PARSE_DONE;
+        } else {
+            status = parse_header_line(request, buf + line_start, line_len);
+        }
+        if (status != 0) {
+            return fail(parser, status);
+        }
+    }
+}
+
+bool http_view_equals(const HttpView &view, const char *str) {
+    return strlen(str) == view.len && strncasecmp(view.data, str, view.len) == 0;
+}
+
+const HttpView *http_find_header(const HttpRequest *request, const char *name) {
+    for (int i = 0; i < request->num_headers; i++) {
+        if (http_view_equals(request->headers[i].name, name)) {
+            return &request->headers[i].value;
+        }
+    }
+    return nullptr;
+}
+
+// Skip spaces and tabs
+static const char *skip_whitespace(const char *c, const char *end) {
+    while (c < end && (*c == ' ' || *c == '\t')) {
+        c++;
+    }
+    return c;
+}
+
+// Parse the decimal number at *pos and move *pos past it. Returns false if
+// there is no digit at *pos or the number overflows
+static bool parse_number(const char **pos, const char *end, size_t *number) {
+    const char *c = *pos;
+    if (c == end || *c < '0' || *c > '9') {
+        return false;
+    }
+    size_t n = 0;
+    for (; c < end && *c >= '0' && *c <= '9'; c++) {
+        size_t digit = *c - '0';
+        if (n > (SIZE_MAX - digit) / 10) {
+            return false;
+        }
+        n = n * 10 + digit;
+    }
+    *pos = c;
+    *number = n;
+    return true;
+}
+
+int http_parse_ranges(const HttpView &value, size_t size, HttpRange *ranges) {
+    const char *c = value.data;
+    const char *end = value.data + value.len;
+    if (value.len < 6 || strncasecmp(c, "bytes=", 6) != 0) {
+        return -1;
+    }
+    c += 6;
+    int num_specs = 0;
+    int num_ranges = 0;
+    while (true) {
+        // Empty list elements are allowed, e.g. "bytes=0-1,,5-6"
+        c = skip_whitespace(c, end);
+        if (c < end && *c == ',') {
+            c++;
+            continue;
+        }
+        if (c == end) {
+            break;
+        }
+        if (++num_specs > HTTP_MAX_RANGES) {
+            return -1;
+        }
+        size_t first;
+        size_t last;
+        bool satisfiable;
+        if (*c == '-') {
+            // "-n": the last n bytes
+            c++;
+            size_t suffix;
+            if (!parse_number(&c, end, &suffix)) {
+                return -1;
+            }
+            satisfiable = suffix > 0 && size > 0;
+            first = suffix < size ? size - suffix : 0;
+            last = size - 1;
+        } else {
+            // "first-last" or "first-" (to the end)
+            if (!parse_number(&c, end, &first) || c == end || *c != '-') {
+                return -1;
+            }
+            c++;
+            last = SIZE_MAX;
+            if (c < end && *c >= '0' && *c <= '9' &&
+                (!parse_number(&c, end, &last) || last < first)) {
+                return -1;
+            }
+            satisfiable = first < size;
+            if (last >= size) {
+                last = size - 1;
+            }
+        }
+        if (satisfiable) {
+            ranges[num_ranges].first = first;
+            ranges[num_ranges++].last = last;
+        }
+        c = skip_whitespace(c, end);
+        if (c < end && *c != ',') {
+            return -1;
+        }
+    }
+    return num_specs > 0 ? num_ranges : -1;
+}
+
+bool http_etag_matches(const HttpView &value, const char *etag) {
+    if (value.len == 1 && value.data[0] == '*') {
+        return true;
+    }
+    if (strncmp(etag, "W/", 2) == 0) {
+        etag += 2;
+    }
+    size_t etag_len = strlen(etag);
+    const char *c = value.data;
+    const char *end = value.data + value.len;
+    while (c < end) {
+        c = skip_whitespace(c, end);
+        if (c < end && *c == ',') {
+            c++;
+            continue;
+        }
+        if (end - c >= 2 && c[0] == 'W' && c[1] == '/') {
+            c += 2;
+        }
+        // Entity tags are quoted and cannot contain quotes
+        if (c == end || *c != '"') {
+            return false;
+        }
+        const char *close = (const char *) memchr(c + 1, '"', end - (c + 1));
+        if (close == NULL) {
+            return false;
+        }
+        const char *tag = c;
+        c = close + 1;
+        if ((size_t) (c - tag) == etag_len && memcmp(tag, etag, etag_len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns true if a qvalue ("0", "0.5", "1.000", ...) is zero
+static bool is_zero_weight(const char *c, const char *end) {
+    if (c == end || *c != '0') {
+        return false;
+    }
+    for (c++; c < end && (*c == '.' || *c == '0'); c++) {
+    }
+    return c == end;
+}
+
+bool http_accepts_coding(const HttpView &value, const char *coding) {
+    const char *c = value.data;
+    const char *end = value.data + value.len;
+    bool wildcard = false;    // Whether "*" is listed with a non-zero weight
+    while (c < end) {
+        // Element: coding *( OWS ";" OWS parameter )
+        const char *element_end = (const char *) memchr(c, ',', end - c);
+        if (element_end == NULL) {
+            element_end = end;
+        }
+        c = skip_whitespace(c, element_end);
+        const char *name = c;
+        while (c < element_end && is_token_char(*c)) {
+            c++;
+        }
+        HttpView name_view = { name, (size_t) (c - name) };
+        bool accepted = true;
+        // Only the weight matters among the parameters
+        while ((c = skip_whitespace(c, element_end)) < element_end && *c == ';') {
+            c = skip_whitespace(c + 1, element_end);
+            const char *param_end = c;
+            while (param_end < element_end && *param_end != ';') {
+                param_end++;
+            }
+            const char *value_end = param_end;
+            while (value_end > c && (value_end[-1] == ' ' || value_end[-1] == '\t')) {
+                value_end--;
+            }
+            if (value_end - c >= 2 && (c[0] == 'q' || c[0] == 'Q') && c[1] == '=') {
+                accepted = !is_zero_weight(c + 2, value_end);
+            }
+            c = param_end;
+        }
+        if (http_view_equals(name_view, coding)) {
+            return accepted;
+        }
+        if (http_view_equals(name_view, "*")) {
+            wildcard = accepted;
+        }
+        c = element_end + 1;
+    }
+    return wildcard;
+}
+
+time_t http_parse_date(const HttpView &value) {
+    // IMF-fixdate, then the obsolete RFC 850 and asctime() formats
+    static const char *const formats[] = { "%a, %d %b %Y %H:%M:%S GMT",
+                                           "%A, %d-%b-%y %H:%M:%S GMT", "%a %b %e %H:%M:%S %Y" };
+    char date[64];
+    if (value.len >= sizeof(date)) {
+        return -1;
+    }
+    memcpy(date, value.data, value.len);
+    date[value.len] = '\0';
+    for (const char *format : formats) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        const char *end = strptime(date, format, &tm);
+        if (end != NULL && *end == '\0') {
+            return timegm(&tm);
+        }
+    }
+    return -1;
+}
+
+void http_format_date(time_t time, char *buf) {
+    struct tm tm;
+    gmtime_r(&time, &tm);
+    strftime(buf, HTTP_DATE_SIZE, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
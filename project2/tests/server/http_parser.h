@@ -0,0 +1,118 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stddef.h>
+#include <time.h>
+
+#define HTTP_MAX_REQUEST_SIZE 8192    // Max bytes of a request header (request line included)
+#define HTTP_MAX_REQUEST_LINE 2048    // Max bytes of the request line
+#define HTTP_MAX_HEADERS 32           // Max header fields of a request
+#define HTTP_MAX_RANGES 16            // Max byte ranges served for one request
+#define HTTP_DATE_SIZE 30             // Bytes of a formatted HTTP-date, terminator included
+
+// Bytes inside the buffer being parsed (not terminated)
+struct HttpView {
+    const char *data;
+    size_t len;
+};
+
+// One header field
+struct HttpHeader {
+    HttpView name;     // Field name as sent (compare case-insensitively)
+    HttpView value;    // Field value without surrounding whitespace
+};
+
+// Byte range of a resource, both ends included
+struct HttpRange {
+    size_t first;
+    size_t last;
+};
+
+// A parsed request header. Every view points into the buffer that was parsed
+struct HttpRequest {
+    HttpView method;                         // e.g. GET
+    HttpView path;                           // Request target, e.g. /index.html?x=1
+    HttpView version;                        // e.g. HTTP/1.1
+    int minor_version;                       // 0 for HTTP/1.0, 1 for HTTP/1.1
+    HttpHeader headers[HTTP_MAX_HEADERS];    // Header fields in the order sent
+    int num_headers;                         // Number of header fields
+    size_t length;                           // Bytes of the request header, blank line included
+};
+
+enum HttpParseStatus {
+    HTTP_PARSE_DONE,          // The whole request header was parsed
+    HTTP_PARSE_INCOMPLETE,    // More bytes are needed
+    HTTP_PARSE_ERROR          // Malformed or too large, see HttpParser::error
+};
+
+// Incremental request parser. Parse the bytes received so far, and call
+// http_parse() again with the same buffer (holding more bytes) while it
+// returns HTTP_PARSE_INCOMPLETE. Complete lines are only parsed once, and no
+// byte is scanned twice
+// NOTE: The buffer must not move between the calls for one request, as the
+//       views of the lines parsed so far point into it
+struct HttpParser {
+    int state;              // Part of the request being parsed
+    size_t offset;          // Start of the first line not parsed yet
+    size_t scanned;         // Bytes scanned for the end of that line
+    int error;              // HTTP status to answer a failed request with
+    HttpRequest request;    // The request parsed so far
+};
+
+// Prepare a parser for a new request (at the start of the buffer)
+void http_parser_init(HttpParser *parser);
+
+// Parse the first len bytes of buf
+// Output:
+// - HTTP_PARSE_DONE once the request header is complete (request.length bytes
+//   of buf, any bytes after them belong to the next request)
+// - HTTP_PARSE_INCOMPLETE if more bytes are needed
+// - HTTP_PARSE_ERROR if the request is invalid. error is 400 (malformed), 414
+//   (request line too long), 431 (header too large) or 505 (not HTTP/1.x)
+HttpParseStatus http_parse(HttpParser *parser, const char *buf, size_t len);
+
+// Find a header field by name (case-insensitive)
+// Output:
+// - The field's value, nullptr if the request has no such field
+const HttpView *http_find_header(const HttpRequest *request, const char *name);
+
+// Returns true if view equals str, ignoring case
+bool http_view_equals(const HttpView &view, const char *str);
+
+// Parse a Range field value (RFC 9110 14.1.2) against a resource of size bytes
+// Output:
+// - Number of satisfiable ranges stored in ranges (at most HTTP_MAX_RANGES),
+//   in the order requested. 0 if none is satisfiable (answered with a 416)
+// - -1 if the field must be ignored (the whole resource is sent): it is not a
+//   valid bytes range set, or asks for more than HTTP_MAX_RANGES ranges
+int http_parse_ranges(const HttpView &value, size_t size, HttpRange *ranges);
+
+// Returns true if an If-None-Match field value is "*" or lists etag, ignoring
+// weakness (the weak comparison of RFC 9110 8.8.3.2)
+bool http_etag_matches(const HttpView &value, const char *etag);
+
+// Returns true if an Accept-Encoding field value (RFC 9110 12.5.3) accepts
+// coding: it is listed with a non-zero weight, or "*" is and coding is not
+// listed
+bool http_accepts_coding(const HttpView &value, const char *coding);
+
+// Parse an HTTP-date in any of the three formats of RFC 9110 5.6.7
+// Output:
+// - The time, -1 if value is not a valid date
+time_t http_parse_date(const HttpView &value);
+
+// Format time as an IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+// Input:
+// - buf: At least HTTP_DATE_SIZE bytes
+void http_format_date(time_t time, char *buf);
+
+// Find the end of a line: the first line feed or invalid control character in
+// data. Uses SSE2 when available, 16 bytes per step
+// Output:
+// - Index of the byte found, len if there is none
+size_t http_scan(const char *data, size_t len);
+
+// Byte at a time version of http_scan() (for comparison)
+size_t http_scan_scalar(const char *data, size_t len);
+
+#endif    // HTTP_PARSER_H
@@ -6,84 +6,120 @@
 #include <netdb.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
-#include "../../lib/CondVar.h"
-#include "../../lib/Lock.h"
+#include "../../lib/async_syscall.h"
 #include "../../lib/debug.cpp"
+#include "../../lib/lock_stats.h"
+#include "../../lib/reactor.h"
 #include "../../lib/uthread.h"
 #include "async_socket.h"
-#include "connection_queue.h"
 #include "http.h"
+#include "http_cache.h"
+#include "keepalive.h"
+#include "worker_pool.h"
 
 #define BUFSIZE 512
-#define LISTEN_QUEUE_LEN 5
-#define N_THREADS 5
+#define LISTEN_QUEUE_LEN 128
+#define STATS_INTERVAL 0    // Default usecs between pool stats reports (0 for none)
+#define MAX_INSTANCES 64    // Max server processes
+
+// Counters a server instance leaves for the parent process once it stops
+struct InstanceStats {
+    bool done;               // true once the counters are filled in
+    HttpCacheStats cache;    // Response cache counters
+    PoolStats pool;          // Worker pool counters
+};
 
-static connection_queue_t queue;
 const char *serve_dir;
 int keep_going = 1;
 
-// Thread Function
-void *handle_http_request(void *arg) {
-    connection_queue_t *queue = (connection_queue_t *) arg;
+// Serve the requests of a connection until it is closed or goes idle (then it
+// is parked until its next request arrives)
+void serve_connection(HttpConnection *conn) {
     char resource_name[BUFSIZE];
-    // Worker thread reads and responds to http requests
-    while (keep_going == 1) {
+    while (true) {
         // strcpy will overwrite the old buffer contents
         strcpy(resource_name, serve_dir);
-        // Get a client file descriptor from connection queue
-        PRINT("Thread %d waiting in connection queue\n", uthread_self());
-        int client_fd = connection_queue_dequeue(queue);
-        if (client_fd == -1) {
-            continue;
-        }
         // Read in the http resquest
         printf("Thread %d reading client request\n", uthread_self());
-        if (read_http_request(client_fd, resource_name) == -1) {
-            close(client_fd);
-            continue;
+        if (read_http_request(conn, resource_name, BUFSIZE) == -1) {
+            break;
         }
         // Write response
         PRINT("Thread %d writing server response\n", uthread_self());
-        if (write_http_response(client_fd, resource_name) == -1) {
-            close(client_fd);
-            continue;
+        if (write_http_response(conn, resource_name) == -1) {
+            break;
         }
-        // Close the client file descriptor
-        PRINT("Thread %d closing connection\n", uthread_self());
-        if (close(client_fd) == -1) {
-            perror("close");
+        if (!conn->keep_alive) {
+            http_flush(conn);
+            break;
+        }
+        int idle = http_connection_idle(conn);
+        if (idle == -1) {
+            break;
         }
+        if (idle == 1) {
+            PRINT("Thread %d parking idle connection\n", uthread_self());
+            keepalive_park(conn->fd);
+            return;
+        }
+    }
+    // Close the client file descriptor
+    PRINT("Thread %d closing connection\n", uthread_self());
+    if (close(conn->fd) == -1) {
+        perror("close");
+    }
+}
+
+// Worker function: serve a connection taken from the pool's queue
+void handle_http_request(int client_fd) {
+    HttpConnection conn;
+    http_connection_init(&conn, client_fd);
+    serve_connection(&conn);
+}
+
+// Hand a connection to the worker pool. When the pool's queue is full the
+// client gets a 503 right away instead of waiting behind the backlog
+void dispatch(int client_fd) {
+    PRINT("Thread %d ready to enqueue client fd\n", uthread_self());
+    if (pool_submit(client_fd)) {
+        return;
+    }
+    PRINT("Thread %d shedding client fd %d\n", uthread_self(), client_fd);
+    http_send_unavailable(client_fd);
+    if (close(client_fd) == -1) {
+        perror("close");
     }
-    PRINT("Thread %d exiting\n", uthread_self());
-    return NULL;
 }
 
 /**
- * Helper Function: cleans up the connection queue and joins all ptheads
+ * Helper Function: stops the worker pool and the keep-alive watcher
  * Used to quickly clean up after an error
- * queue: connection queue
- * threads: pthread_t array
- * nthreads: length of pthread_t array
  */
-void clean_up(connection_queue_t *queue, int *threads, int nthreads) {
+void clean_up() {
     keep_going = 0;
-    connection_queue_shutdown(queue);
-    for (int i = 0; i < nthreads; i++) {
-        uthread_join(threads[i], NULL);
-    }
+    pool_stop();
+    // Wake the keep-alive watcher
+    reactor_shutdown();
+    keepalive_stop();
 }
 
 void handle_sigint(int signo) {
     (void) signo;
     fprintf(stderr, "SIGINT recieved\n");
+    // The accept loop notices keep_going and stops the worker pool (the pool
+    // cannot be touched safely from inside the signal handler)
     keep_going = 0;
-    connection_queue_shutdown(&queue);
+    // Wake the accept loop if it is parked on the reactor
+    reactor_shutdown();
     // Abort if server is failing to shutdown
     static int num_sig_caught = 0;
     if (num_sig_caught++ > 3) {
@@ -91,16 +127,217 @@ void handle_sigint(int signo) {
     }
 }
 
+// Print the counters of a response cache
+void print_cache_stats(const char *name, const HttpCacheStats &stats) {
+    fprintf(stderr, "%s: %lu hits, %lu misses, %lu invalidations, %lu evictions, %zu bytes\n",
+            name, stats.hits, stats.misses, stats.invalidations, stats.evictions, stats.bytes);
+}
+
+/**
+ * Wait for the server instances to exit and print the sum of their counters
+ * The first SIGINT (or an instance failing) is forwarded to every instance
+ * NOTE: Assumes SIGINT and SIGCHLD are blocked
+ * pids: process ids of the instances
+ * ninstances: number of instances
+ * stats: counters the instances leave behind
+ * Returns 0 if every instance exited cleanly, 1 otherwise
+ */
+int supervise(pid_t *pids, int ninstances, InstanceStats *stats) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGCHLD);
+    int running = ninstances;
+    int ret = 0;
+    bool stopping = false;
+    bool forwarded = false;
+    while (running > 0) {
+        int signo;
+        if (sigwait(&signals, &signo) != 0) {
+            continue;
+        }
+        if (signo == SIGINT) {
+            fprintf(stderr, "SIGINT recieved\n");
+            stopping = true;
+        }
+        // Reap every instance that exited
+        int status;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            running--;
+            int i = 0;
+            while (pids[i] != pid) {
+                i++;
+            }
+            pids[i] = -1;
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                fprintf(stderr, "Instance %d failed\n", i);
+                ret = 1;
+                stopping = true;
+            }
+        }
+        // The instances stop the way a single server does (only signaled once,
+        // they abort after a few SIGINTs)
+        if (stopping && !forwarded) {
+            for (int i = 0; i < ninstances; i++) {
+                if (pids[i] != -1 && kill(pids[i], SIGINT) == -1) {
+                    perror("kill");
+                }
+            }
+            forwarded = true;
+        }
+    }
+
+    HttpCacheStats cache_total = {};
+    PoolStats pool_total = {};
+    for (int i = 0; i < ninstances; i++) {
+        if (!stats[i].done) {
+            continue;
+        }
+        cache_total.hits += stats[i].cache.hits;
+        cache_total.misses += stats[i].cache.misses;
+        cache_total.invalidations += stats[i].cache.invalidations;
+        cache_total.evictions += stats[i].cache.evictions;
+        cache_total.entries += stats[i].cache.entries;
+        cache_total.bytes += stats[i].cache.bytes;
+        // Peaks of different instances need not have happened together, so
+        // the largest one is reported rather than their sum
+        if (stats[i].pool.max_workers > pool_total.max_workers) {
+            pool_total.max_workers = stats[i].pool.max_workers;
+        }
+        if (stats[i].pool.max_queued > pool_total.max_queued) {
+            pool_total.max_queued = stats[i].pool.max_queued;
+        }
+        pool_total.served += stats[i].pool.served;
+        pool_total.shed += stats[i].pool.shed;
+        pool_total.grown += stats[i].pool.grown;
+        pool_total.shrunk += stats[i].pool.shrunk;
+        pool_total.wait_ns += stats[i].pool.wait_ns;
+        pool_total.worker_ns += stats[i].pool.worker_ns;
+        pool_total.busy_ns += stats[i].pool.busy_ns;
+        pool_total.queued_ns += stats[i].pool.queued_ns;
+    }
+    print_cache_stats("Total cache", cache_total);
+    pool_print_stats("Total pool (peaks per instance)", &pool_total);
+    return ret;
+}
+
 int main(int argc, char **argv) {
+    // Options tune the response cache (see http_cache.h), keep-alive (see
+    // keepalive.h), the worker pool (see worker_pool.h) and the number of
+    // server processes
+    long cache_kb = CACHE_BUDGET / 1024;
+    long revalidate_ms = CACHE_REVALIDATE / 1000;
+    long idle_ms = IDLE_TIMEOUT / 1000;
+    long max_workers = POOL_MAX_WORKERS;
+    long queue_capacity = POOL_QUEUE_CAPACITY;
+    long target_wait_ms = POOL_TARGET_WAIT / 1000;
+    long stats_ms = STATS_INTERVAL / 1000;
+    long ninstances = 1;
+    bool precompress = false;
+    bool bad_option = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:i:n:q:r:s:t:w:z")) != -1) {
+        switch (opt) {
+        case 'c':
+            cache_kb = atol(optarg);
+            break;
+        case 'i':
+            idle_ms = atol(optarg);
+            break;
+        case 'n':
+            ninstances = atol(optarg);
+            break;
+        case 'q':
+            queue_capacity = atol(optarg);
+            break;
+        case 'r':
+            revalidate_ms = atol(optarg);
+            break;
+        case 's':
+            stats_ms = atol(optarg);
+            break;
+        case 't':
+            target_wait_ms = atol(optarg);
+            break;
+        case 'w':
+            max_workers = atol(optarg);
+            break;
+        case 'z':
+            precompress = true;
+            break;
+        default:
+            bad_option = true;
+        }
+    }
     // First argument is directory to server, second is port, third is quantum
-    if (argc != 4) {
-        printf("Usage: %s <directory> <port> <quantum>\n", argv[0]);
+    if (bad_option || argc - optind != 3 || cache_kb < 0 || idle_ms < 0 ||
+        revalidate_ms < 0 || max_workers < POOL_MIN_WORKERS || queue_capacity < 0 ||
+        target_wait_ms < 0 || stats_ms < 0 || ninstances < 1 || ninstances > MAX_INSTANCES) {
+        printf("Usage: %s [-c cache_kb] [-i idle_ms] [-r revalidate_ms] [-w max_workers] "
+               "[-q queue_capacity] [-t target_wait_ms] [-s stats_ms] [-n instances] [-z] "
+               "<directory> <port> <quantum>\n",
+               argv[0]);
         return 1;
     }
 
-    serve_dir = argv[1];
-    const char *port = argv[2];
-    const int quantum_usecs = atoi(argv[3]);
+    serve_dir = argv[optind];
+    const char *port = argv[optind + 1];
+    const int quantum_usecs = atoi(argv[optind + 2]);
+
+    // With several instances, every process runs its own uthread runtime, cache
+    // and worker pool behind its own SO_REUSEPORT socket, and the kernel
+    // spreads the connections among them. The processes are forked before the
+    // runtime starts, and leave their counters in shared memory for the parent
+    int instance = -1;
+    char cache_name[32] = "Cache";
+    char pool_name[32] = "Pool";
+    InstanceStats *instance_stats = NULL;
+    if (ninstances > 1) {
+        instance_stats = (InstanceStats *) mmap(NULL, ninstances * sizeof(InstanceStats),
+                                                PROT_READ | PROT_WRITE,
+                                                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (instance_stats == MAP_FAILED) {
+            perror("mmap");
+            return 1;
+        }
+        // The parent takes signals synchronously in supervise(), the instances
+        // unblock them again
+        sigset_t signals, old_signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGCHLD);
+        if (sigprocmask(SIG_BLOCK, &signals, &old_signals) == -1) {
+            perror("sigprocmask");
+            return 1;
+        }
+        pid_t pids[MAX_INSTANCES];
+        for (int i = 0; i < ninstances; i++) {
+            pids[i] = fork();
+            if (pids[i] == 0) {
+                instance = i;
+                break;
+            }
+            if (pids[i] == -1) {
+                perror("fork");
+                for (int j = 0; j < i; j++) {
+                    kill(pids[j], SIGINT);
+                    waitpid(pids[j], NULL, 0);
+                }
+                return 1;
+            }
+        }
+        if (instance == -1) {
+            return supervise(pids, ninstances, instance_stats);
+        }
+        if (sigprocmask(SIG_SETMASK, &old_signals, NULL) == -1) {
+            perror("sigprocmask");
+            return 1;
+        }
+        snprintf(cache_name, sizeof(cache_name), "Instance %d cache", instance);
+        snprintf(pool_name, sizeof(pool_name), "Instance %d pool", instance);
+    }
+    http_cache_init(cache_kb * 1024, revalidate_ms * 1000);
 
     // Initialize uthread library
     if (uthread_init(quantum_usecs) == -1) {
@@ -121,6 +358,13 @@ int main(int argc, char **argv) {
         perror("sigaction");
         return 1;
     }
+    // Clients hanging up in the middle of a body (e.g. after the range they
+    // wanted) must not kill the server: sendfile() has no MSG_NOSIGNAL
+    sact.sa_handler = SIG_IGN;
+    if (sigaction(SIGPIPE, &sact, NULL) == -1) {
+        perror("sigaction");
+        return 1;
+    }
 
     // Setup for getaddrinfo
     struct addrinfo hints;
@@ -130,7 +374,7 @@ int main(int argc, char **argv) {
     hints.ai_flags = AI_PASSIVE;
     struct addrinfo *server;
     // Setup address info for socket
-    int ret_val = getaddrinfo(NULL, port, &hints, &server);
+    int ret_val = async_getaddrinfo(NULL, port, &hints, &server);
     if (ret_val != 0) {
         fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(ret_val));
         return 1;
@@ -144,6 +388,16 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    // Let every instance bind the same port
+    int reuse_port = 1;
+    if (ninstances > 1 &&
+        setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, &reuse_port, sizeof(reuse_port)) == -1) {
+        perror("setsockopt");
+        freeaddrinfo(server);
+        close(sock_fd);
+        return 1;
+    }
+
     // Bind socket to receive at a specific port
     if (bind(sock_fd, server->ai_addr, server->ai_addrlen)) {
         perror("bind");
@@ -162,27 +416,24 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    // Initalize the connection queue
-    if (connection_queue_init(&queue) == -1) {
+    // Compress the text files into the cache before serving them
+    if (precompress && http_precompress(serve_dir) == -1) {
         close(sock_fd);
         return 1;
     }
 
-    // Create and initialize workers threads in thread pool
-    int threads[N_THREADS];
-    for (int i = 0; i < N_THREADS; i++) {
-        threads[i] = uthread_create(handle_http_request, &queue);
-        if (threads[i] == -1) {
-            fprintf(stderr, "uthread_create\n");
-            // Clean up
-            keep_going = 0;
-            connection_queue_shutdown(&queue);
-            for (int j = 0; j < i; j++) {
-                uthread_join(threads[j], NULL);
-            }
-            close(sock_fd);
-            return 1;
-        }
+    // Start the worker pool, it grows with the load up to max_workers
+    if (pool_start(pool_name, handle_http_request, max_workers, queue_capacity,
+                   target_wait_ms * 1000, stats_ms * 1000) == -1) {
+        close(sock_fd);
+        return 1;
+    }
+
+    // Watch the idle kept alive connections
+    if (keepalive_start(dispatch, idle_ms * 1000) == -1) {
+        clean_up();
+        close(sock_fd);
+        return 1;
     }
 
     // Communicate with client
@@ -193,35 +444,39 @@ int main(int argc, char **argv) {
             // Check if accept failed from something other than SIGINT
             if (errno != EINTR) {
                 perror("accept");
-                // Cleans up queue and joins all threads
-                clean_up(&queue, threads, N_THREADS);
+                // Stops the worker pool and joins all threads
+                clean_up();
                 close(sock_fd);
                 return 1;
             }
             // Otherwise break out of while loop
             break;
         }
-        // Enqueue the client file descriptor to connection queue
-        PRINT("Thread %d ready to enqueue client fd\n", uthread_self());
-        if (connection_queue_enqueue(&queue, client_fd) == -1) {
-            if (close(client_fd) == -1) {
-                perror("close");
-            }
-        }
+        // Hand the client file descriptor to the worker pool
+        dispatch(client_fd);
     }
 
-    // Clean up connection queue
-    connection_queue_shutdown(&queue);
-    // Clean up worker threads
-    for (int i = 0; i < N_THREADS; i++) {
-        if (uthread_join(threads[i], NULL) != 0) {
-            fprintf(stderr, "uthread_join\n");
-        }
-    }
+    // Let the workers drain the queue, then join them
+    pool_stop();
+    // Close the parked connections
+    keepalive_stop();
     // Close socket file descriptor
     if (close(sock_fd) == -1) {
         perror("close");
     }
+    HttpCacheStats cache_stats;
+    http_cache_get_stats(&cache_stats);
+    print_cache_stats(cache_name, cache_stats);
+    pool_dump_stats();
+    if (instance_stats != NULL) {
+        instance_stats[instance].cache = cache_stats;
+        pool_get_stats(&instance_stats[instance].pool);
+        instance_stats[instance].done = true;
+    }
+#ifdef LOCK_STATS
+    // Report which locks were contended while serving
+    uthread_dump_lock_stats();
+#endif
 
     // Exit uthread library
     uthread_exit(NULL);
@@ -0,0 +1,163 @@
+#include "keepalive.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <deque>
+
+#include "../../lib/Lock.h"
+#include "../../lib/debug.cpp"
+#include "../../lib/reactor.h"
+#include "../../lib/timer.h"
+#include "../../lib/uthread.h"
+
+#define KEEPALIVE_EVENTS 64    // Max connections woken per epoll_wait()
+
+// Parked connection. Connections are parked for the same time, so the queue of
+// them is ordered by expiry
+struct IdleConnection {
+    int fd;                      // Client socket
+    unsigned generation;         // Stale once different from generations[fd]
+    struct timespec expires;     // Time to close the connection
+};
+
+static Lock idle_lock("keepalive");    // Guards everything below
+static std::deque<IdleConnection> idle;
+static unsigned generations[REACTOR_MAX_FDS];    // Bumped whenever an fd is unparked
+static int epoll_fd = -1;
+static bool stopped = false;
+static long idle_timeout = IDLE_TIMEOUT;
+static void (*dispatch_connection)(int fd);
+static int watcher = -1;
+
+// Stop watching fd and forget its queue entry
+// NOTE: Assumes the lock is held
+static void unpark(int fd) {
+    generations[fd]++;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL) == -1 && errno != ENOENT) {
+        perror("epoll_ctl");
+    }
+}
+
+// Drop stale queue entries and close the connections whose time is up. Returns
+// when the next connection expires
+// NOTE: Assumes the lock is held
+static struct timespec expire(const struct timespec &now) {
+    while (!idle.empty()) {
+        IdleConnection &conn = idle.front();
+        if (conn.generation == generations[conn.fd]) {
+            if (timer_compare(conn.expires, now) > 0) {
+                return conn.expires;
+            }
+            PRINT("Closing idle connection %d\n", conn.fd);
+            unpark(conn.fd);
+            close(conn.fd);
+        }
+        idle.pop_front();
+    }
+    return timer_deadline(idle_timeout);
+}
+
+// Watcher thread: hand connections whose next request arrived back to the
+// workers, and close the ones that stayed idle
+static void *watch(void *arg) {
+    (void) arg;
+    while (true) {
+        idle_lock.lock();
+        struct timespec deadline = expire(timer_now());
+        idle_lock.unlock();
+        IoControl ctl;
+        ctl.deadline = &deadline;
+        if (reactor_wait(epoll_fd, EPOLLIN, &ctl) == -1) {
+            if (errno == ETIMEDOUT) {
+                continue;
+            }
+            break;
+        }
+        struct epoll_event events[KEEPALIVE_EVENTS];
+        int num_events = epoll_wait(epoll_fd, events, KEEPALIVE_EVENTS, 0);
+        if (num_events == -1) {
+            perror("epoll_wait");
+            continue;
+        }
+        idle_lock.lock();
+        for (int i = 0; i < num_events; i++) {
+            unpark(events[i].data.fd);
+        }
+        idle_lock.unlock();
+        for (int i = 0; i < num_events; i++) {
+            PRINT("Idle connection %d is ready\n", events[i].data.fd);
+            dispatch_connection(events[i].data.fd);
+        }
+    }
+    // Close every parked connection
+    idle_lock.lock();
+    stopped = true;
+    for (const IdleConnection &conn : idle) {
+        if (conn.generation == generations[conn.fd]) {
+            unpark(conn.fd);
+            close(conn.fd);
+        }
+    }
+    idle.clear();
+    idle_lock.unlock();
+    return NULL;
+}
+
+int keepalive_start(void (*dispatch)(int fd), long idle_usecs) {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        perror("epoll_create1");
+        return -1;
+    }
+    dispatch_connection = dispatch;
+    idle_timeout = idle_usecs;
+    watcher = uthread_create(watch, NULL);
+    if (watcher == -1) {
+        fprintf(stderr, "uthread_create\n");
+        close(epoll_fd);
+        epoll_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void keepalive_park(int fd) {
+    idle_lock.lock();
+    if (stopped || epoll_fd == -1 || fd >= REACTOR_MAX_FDS) {
+        idle_lock.unlock();
+        close(fd);
+        return;
+    }
+    // The peer closing the connection wakes it up as well, the worker then
+    // reads end of file and closes it
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    event.data.fd = fd;
+    int ret_val = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    if (ret_val == -1) {
+        perror("epoll_ctl");
+        idle_lock.unlock();
+        close(fd);
+        return;
+    }
+    IdleConnection conn;
+    conn.fd = fd;
+    conn.generation = generations[fd];
+    conn.expires = timer_deadline(idle_timeout);
+    idle.push_back(conn);
+    idle_lock.unlock();
+}
+
+void keepalive_stop() {
+    if (watcher != -1 && uthread_join(watcher, NULL) != 0) {
+        fprintf(stderr, "uthread_join\n");
+    }
+    watcher = -1;
+    if (epoll_fd != -1) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef KEEPALIVE_H
+#define KEEPALIVE_H
+
+#define IDLE_TIMEOUT 5000000L    // Default usecs a kept alive connection may stay idle
+
+// Idle kept alive connections. Instead of holding a worker while the client
+// thinks, a worker parks the connection here once it goes idle. A watcher
+// thread waits for all parked connections at once (through one epoll
+// instance parked on the reactor), hands a connection back to the workers as
+// soon as its next request arrives, and closes connections that stay idle for
+// too long
+
+// Start the watcher thread
+// Input:
+// - dispatch: Hands a connection to the workers without blocking (dispatch
+//   owns fd)
+// - idle_usecs: Time a parked connection may stay idle before it is closed
+// Output:
+// - 0 on success, -1 on failure
+int keepalive_start(void (*dispatch)(int fd), long idle_usecs);
+
+// Park an idle connection until its next request arrives. The connection is
+// closed if it cannot be parked
+void keepalive_park(int fd);
+
+// Wait for the watcher thread to exit (after reactor_shutdown()) and close the
+// parked connections
+void keepalive_stop();
+
+#endif    // KEEPALIVE_H
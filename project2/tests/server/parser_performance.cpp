@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <iostream>
+
+#include "http_parser.h"
+
+#define SPLIT_SIZE 64    // Bytes per read when requests arrive in pieces
+
+// Realistic request headers, from a short command line request to a browser
+// request carrying cookies
+static const char *const requests[] = {
+    // curl
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: localhost:8000\r\n"
+    "User-Agent: curl/7.81.0\r\n"
+    "Accept: */*\r\n"
+    "\r\n",
+    // Browser navigation
+    "GET /courses.txt HTTP/1.1\r\n"
+    "Host: localhost:8000\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "sec-ch-ua-platform: \"Linux\"\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+    "Chrome/124.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,"
+    "image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "\r\n",
+    // Browser media request with cookies and a range
+    "GET /rain.mp3 HTTP/1.1\r\n"
+    "Host: localhost:8000\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Ubuntu; Linux x86_64; rv:125.0) Gecko/20100101 "
+    "Firefox/125.0\r\n"
+    "Accept: audio/webm,audio/ogg,audio/wav,audio/*;q=0.9,application/ogg;q=0.7,video/*;q=0.6,"
+    "*/*;q=0.5\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Range: bytes=0-\r\n"
+    "Connection: keep-alive\r\n"
+    "Referer: http://localhost:8000/index.html\r\n"
+    "Cookie: session=3f9a1c2e7b5d4a8f9e0c1b2a3d4e5f60; theme=dark; "
+    "_ga=GA1.1.1234567890.1712345678; _ga_ABCDEF1234=GS1.1.1712345678.3.1.1712349999.0.0.0; "
+    "prefs=%7B%22volume%22%3A0.8%2C%22autoplay%22%3Afalse%7D\r\n"
+    "Sec-Fetch-Dest: audio\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Accept-Encoding: identity\r\n"
+    "If-None-Match: \"44eea-5f1b2c3d\"\r\n"
+    "If-Modified-Since: Wed, 07 May 2025 12:00:00 GMT\r\n"
+    "\r\n",
+};
+
+#define NUM_REQUESTS (int) (sizeof(requests) / sizeof(requests[0]))
+
+// Request target and number of header fields of each request
+static const struct {
+    const char *path;
+    int num_headers;
+} expected[NUM_REQUESTS] = { { "/index.html", 3 }, { "/courses.txt", 14 }, { "/rain.mp3", 14 } };
+
+// Parse request (len bytes) into parser whole, or in SPLIT_SIZE pieces as if
+// it arrived in several reads. Returns the number of headers
+int parse(HttpParser &parser, const char *request, size_t len, bool split) {
+    http_parser_init(&parser);
+    size_t available = split ? SPLIT_SIZE : len;
+    while (true) {
+        if (available > len) {
+            available = len;
+        }
+        HttpParseStatus status = http_parse(&parser, request, available);
+        if (status == HTTP_PARSE_DONE) {
+            return parser.request.num_headers;
+        }
+        if (status == HTTP_PARSE_ERROR || available == len) {
+            std::cerr << "Parse failed\n";
+            exit(1);
+        }
+        available += SPLIT_SIZE;
+    }
+}
+
+// Scan request (len bytes) line by line. Returns the number of lines
+int scan(const char *request, size_t len, size_t (*scan_line)(const char *, size_t)) {
+    int lines = 0;
+    size_t offset = 0;
+    while (offset < len) {
+        offset += scan_line(request + offset, len - offset) + 1;
+        lines++;
+    }
+    return lines;
+}
+
+// Exit if a request does not parse to what it holds or the line scans
+// disagree, so a broken fast path cannot report a speedup
+void check_requests() {
+    for (int i = 0; i < NUM_REQUESTS; i++) {
+        size_t len = strlen(requests[i]);
+        for (bool split : { false, true }) {
+            HttpParser parser;
+            const HttpRequest &request = parser.request;
+            if (parse(parser, requests[i], len, split) != expected[i].num_headers ||
+                !http_view_equals(request.method, "GET") ||
+                !http_view_equals(request.path, expected[i].path) || request.length != len) {
+                std::cerr << "Request " << i << " parsed wrong\n";
+                exit(1);
+            }
+        }
+        if (scan(requests[i], len, http_scan) != scan(requests[i], len, http_scan_scalar)) {
+            std::cerr << "Line scans of request " << i << " disagree\n";
+            exit(1);
+        }
+    }
+}
+
+// Time niters runs of each request through fn and print the cost per request
+template <typename F>
+void run_test(const std::string &name, int niters, F fn) {
+    for (int i = 0; i < NUM_REQUESTS; i++) {
+        size_t len = strlen(requests[i]);
+        // The checksum keeps the work from being optimized away
+        volatile long checksum = 0;
+        auto start_time = std::chrono::high_resolution_clock::now();
+        for (int j = 0; j < niters; j++) {
+            checksum += fn(requests[i], len);
+        }
+        auto end_time = std::chrono::high_resolution_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(end_time - start_time).count();
+        printf("%-18s request %d (%4zu bytes): %8.1f ns/request %8.1f MB/s\n", name.c_str(), i,
+               len, ns / niters, len * niters / ns * 1000);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        std::cerr << "Usage: ./parserperformance <niters>\n";
+        exit(1);
+    }
+    const int niters = atoi(argv[1]);
+
+    check_requests();
+    run_test("parse whole", niters, [](const char *request, size_t len) {
+        HttpParser parser;
+        return parse(parser, request, len, false);
+    });
+    run_test("parse split", niters, [](const char *request, size_t len) {
+        HttpParser parser;
+        return parse(parser, request, len, true);
+    });
+    run_test("scan lines simd", niters,
+             [](const char *request, size_t len) { return scan(request, len, http_scan); });
+    run_test("scan lines scalar", niters, [](const char *request, size_t len) {
+        return scan(request, len, http_scan_scalar);
+    });
+    return 0;
+}
@@ -0,0 +1,319 @@
+#include "worker_pool.h"
+
+#include <stdio.h>
+
+#include <deque>
+#include <vector>
+
+#include "../../lib/CondVar.h"
+#include "../../lib/Lock.h"
+#include "../../lib/debug.cpp"
+#include "../../lib/timer.h"
+#include "../../lib/uthread.h"
+
+// Connection waiting for a worker
+struct Job {
+    int fd;                    // Client socket
+    struct timespec queued;    // Time it was queued
+};
+
+static Lock pool_lock("worker_pool");         // Guards everything below
+static CondVar work_cv("pool work");          // Signals idle workers that a job was queued
+static CondVar manager_cv("pool manager");    // Signals the manager that the pool may need it
+static std::deque<Job> jobs;
+static std::vector<int> exited;               // Workers that exited and must be joined
+static const char *pool_name;
+static void (*serve_connection)(int fd);
+static int max_workers;
+static size_t capacity;
+static long target_wait;
+static long report_interval;
+static int idle_workers = 0;                  // Workers waiting for a job
+static int starting_workers = 0;              // Workers created that have not run yet
+static bool stopping = false;
+static int manager = -1;
+static PoolStats stats;
+static uint64_t last_change_ns;               // Time stats were last integrated
+static uint64_t start_ns;                     // Time the pool started
+
+// Get a timespec in nanoseconds
+static uint64_t to_ns(const struct timespec &time) {
+    return (uint64_t) time.tv_sec * 1000000000ULL + time.tv_nsec;
+}
+
+// Account the time spent with the current number of workers, busy workers and
+// queued connections
+// NOTE: Assumes the lock is held
+static void integrate(uint64_t now_ns) {
+    uint64_t elapsed = now_ns - last_change_ns;
+    stats.worker_ns += stats.workers * elapsed;
+    stats.busy_ns += stats.busy * elapsed;
+    stats.queued_ns += stats.queued * elapsed;
+    last_change_ns = now_ns;
+}
+
+// Worker thread: serve queued connections, exit once idle for too long while
+// the pool is above its minimum
+static void *work(void *arg) {
+    (void) arg;
+    pool_lock.lock();
+    // The manager waits for new workers to run before growing again
+    starting_workers--;
+    manager_cv.signal();
+    while (true) {
+        bool timed_out = false;
+        while (jobs.empty() && !stopping && !timed_out) {
+            idle_workers++;
+            if (stats.workers > POOL_MIN_WORKERS) {
+                timed_out = work_cv.wait_for(pool_lock, POOL_IDLE_TIMEOUT) == CV_TIMEOUT;
+            } else {
+                work_cv.wait(pool_lock);
+            }
+            idle_workers--;
+        }
+        // Finish the queued connections even when stopping
+        if (jobs.empty() && (stopping || stats.workers > POOL_MIN_WORKERS)) {
+            break;
+        }
+        if (jobs.empty()) {
+            continue;
+        }
+        Job job = jobs.front();
+        jobs.pop_front();
+        uint64_t now_ns = to_ns(timer_now());
+        integrate(now_ns);
+        stats.queued--;
+        stats.busy++;
+        stats.served++;
+        stats.wait_ns += now_ns - to_ns(job.queued);
+        pool_lock.unlock();
+        serve_connection(job.fd);
+        pool_lock.lock();
+        integrate(to_ns(timer_now()));
+        stats.busy--;
+    }
+    integrate(to_ns(timer_now()));
+    stats.workers--;
+    if (!stopping) {
+        stats.shrunk++;
+    }
+    PRINT("Worker %d exiting, %d left\n", uthread_self(), stats.workers);
+    exited.push_back(uthread_self());
+    manager_cv.signal();
+    pool_lock.unlock();
+    return NULL;
+}
+
+// Add a worker. Returns 0 on success, -1 on failure
+// NOTE: Assumes the lock is held
+static int add_worker() {
+    int tid = uthread_create(work, NULL);
+    if (tid == -1) {
+        return -1;
+    }
+    integrate(to_ns(timer_now()));
+    stats.workers++;
+    starting_workers++;
+    if (stats.workers > stats.max_workers) {
+        stats.max_workers = stats.workers;
+    }
+    return 0;
+}
+
+// Print the stats of the interval since last
+static void report(const PoolStats &now, const PoolStats &last) {
+    uint64_t worker_ns = now.worker_ns - last.worker_ns;
+    uint64_t elapsed_ns = now.elapsed_ns - last.elapsed_ns;
+    unsigned long served = now.served - last.served;
+    fprintf(stderr,
+            "%s: %d workers (%d busy, %.0f%% utilization), %d queued (%.2f average), "
+            "%lu served (%.3f ms average wait), %lu shed\n",
+            pool_name, now.workers, now.busy,
+            worker_ns != 0 ? 100.0 * (now.busy_ns - last.busy_ns) / worker_ns : 0, now.queued,
+            elapsed_ns != 0 ? (double) (now.queued_ns - last.queued_ns) / elapsed_ns : 0, served,
+            served != 0 ? (now.wait_ns - last.wait_ns) / 1e6 / served : 0, now.shed - last.shed);
+}
+
+// Copy the counters into snapshot
+// NOTE: Assumes the lock is held
+static void snapshot_stats(PoolStats *snapshot) {
+    uint64_t now_ns = to_ns(timer_now());
+    integrate(now_ns);
+    *snapshot = stats;
+    snapshot->elapsed_ns = now_ns - start_ns;
+}
+
+// Manager thread: grow the pool while connections wait too long, join the
+// workers that exited and report the stats
+static void *manage(void *arg) {
+    (void) arg;
+    PoolStats last;
+    struct timespec next_report = timer_deadline(report_interval);
+    pool_lock.lock();
+    snapshot_stats(&last);
+    while (true) {
+        // Workers that exited are joined right away (they no longer need the
+        // lock)
+        while (!exited.empty()) {
+            int tid = exited.back();
+            exited.pop_back();
+            uthread_join(tid, NULL);
+        }
+        if (stopping && stats.workers == 0) {
+            break;
+        }
+        struct timespec now = timer_now();
+        struct timespec deadline = next_report;
+        // Idle workers (even those signaled but not run yet) and workers that
+        // were just added each take one of the oldest connections, so the pool
+        // only grows for the connections left after them
+        size_t covered = idle_workers + starting_workers;
+        bool waiting = !stopping && jobs.size() > covered;
+        if (waiting) {
+            // Grow once the oldest uncovered connection waited for the target
+            // time
+            struct timespec grow_at = jobs[covered].queued;
+            grow_at.tv_nsec += (target_wait % 1000000) * 1000;
+            grow_at.tv_sec += target_wait / 1000000 + grow_at.tv_nsec / 1000000000;
+            grow_at.tv_nsec %= 1000000000;
+            if (timer_compare(grow_at, now) <= 0 && stats.workers < max_workers) {
+                if (add_worker() == -1) {
+                    fprintf(stderr, "Worker pool limited to %d workers\n", stats.workers);
+                    max_workers = stats.workers;
+                } else {
+                    stats.grown++;
+                    PRINT("Worker pool grown to %d workers\n", stats.workers);
+                }
+                continue;
+            }
+            if (stats.workers < max_workers &&
+                (report_interval <= 0 || timer_compare(grow_at, deadline) < 0)) {
+                deadline = grow_at;
+            }
+        }
+        if (report_interval > 0 && timer_compare(next_report, now) <= 0) {
+            PoolStats current;
+            snapshot_stats(&current);
+            report(current, last);
+            last = current;
+            next_report = timer_deadline(report_interval);
+            continue;
+        }
+        bool timed = report_interval > 0 || (waiting && stats.workers < max_workers);
+        if (timed) {
+            manager_cv.wait_until(pool_lock, deadline);
+        } else {
+            manager_cv.wait(pool_lock);
+        }
+    }
+    pool_lock.unlock();
+    return NULL;
+}
+
+int pool_start(const char *name, void (*serve)(int fd), int max, size_t queue_capacity,
+               long target_wait_usecs, long report_usecs) {
+    pool_name = name;
+    serve_connection = serve;
+    max_workers = max > POOL_MIN_WORKERS ? max : POOL_MIN_WORKERS;
+    capacity = queue_capacity;
+    target_wait = target_wait_usecs;
+    report_interval = report_usecs;
+    pool_lock.lock();
+    start_ns = last_change_ns = to_ns(timer_now());
+    for (int i = 0; i < POOL_MIN_WORKERS; i++) {
+        if (add_worker() == -1) {
+            fprintf(stderr, "uthread_create\n");
+            pool_lock.unlock();
+            pool_stop();
+            return -1;
+        }
+    }
+    manager = uthread_create(manage, NULL);
+    pool_lock.unlock();
+    if (manager == -1) {
+        fprintf(stderr, "uthread_create\n");
+        pool_stop();
+        return -1;
+    }
+    return 0;
+}
+
+bool pool_submit(int fd) {
+    pool_lock.lock();
+    if (stopping || jobs.size() >= capacity) {
+        if (!stopping) {
+            stats.shed++;
+        }
+        pool_lock.unlock();
+        return false;
+    }
+    integrate(to_ns(timer_now()));
+    Job job;
+    job.fd = fd;
+    job.queued = timer_now();
+    jobs.push_back(job);
+    stats.queued++;
+    if (stats.queued > stats.max_queued) {
+        stats.max_queued = stats.queued;
+    }
+    // Wake an idle worker. The manager watches the wait of connections no
+    // idle worker takes: a burst can outrun a signaled worker that has not run
+    // yet, which still counts as idle
+    if (idle_workers > 0) {
+        work_cv.signal();
+    }
+    if (jobs.size() > (size_t) idle_workers) {
+        manager_cv.signal();
+    }
+    pool_lock.unlock();
+    return true;
+}
+
+void pool_stop() {
+    pool_lock.lock();
+    stopping = true;
+    work_cv.broadcast();
+    manager_cv.signal();
+    int manager_tid = manager;
+    pool_lock.unlock();
+    if (manager_tid != -1) {
+        uthread_join(manager_tid, NULL);
+        return;
+    }
+    // The manager never started, wait for the workers here
+    pool_lock.lock();
+    while (stats.workers > 0 || !exited.empty()) {
+        while (!exited.empty()) {
+            int tid = exited.back();
+            exited.pop_back();
+            uthread_join(tid, NULL);
+        }
+        if (stats.workers > 0) {
+            manager_cv.wait(pool_lock);
+        }
+    }
+    pool_lock.unlock();
+}
+
+void pool_get_stats(PoolStats *snapshot) {
+    pool_lock.lock();
+    snapshot_stats(snapshot);
+    pool_lock.unlock();
+}
+
+void pool_dump_stats() {
+    PoolStats snapshot;
+    pool_get_stats(&snapshot);
+    pool_print_stats(pool_name, &snapshot);
+}
+
+void pool_print_stats(const char *name, const PoolStats *counters) {
+    unsigned long served = counters->served;
+    uint64_t worker_ns = counters->worker_ns;
+    fprintf(stderr,
+            "%s: %lu served (%.3f ms average wait), %lu shed, %.0f%% utilization, at most %d "
+            "workers and %d queued, %lu grown, %lu shrunk\n",
+            name, served, served != 0 ? counters->wait_ns / 1e6 / served : 0, counters->shed,
+            worker_ns != 0 ? 100.0 * counters->busy_ns / worker_ns : 0, counters->max_workers,
+            counters->max_queued, counters->grown, counters->shrunk);
+}
@@ -0,0 +1,70 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define POOL_MIN_WORKERS 5            // Workers kept even when idle
+#define POOL_MAX_WORKERS 64           // Default max workers
+#define POOL_QUEUE_CAPACITY 64        // Default max connections waiting for a worker
+#define POOL_TARGET_WAIT 5000L        // Default usecs a connection may wait before the pool grows
+#define POOL_IDLE_TIMEOUT 2000000L    // Usecs a worker above the minimum may stay idle
+
+// Elastic pool of worker threads serving connections. A manager thread adds a
+// worker whenever the oldest queued connection has waited longer than the
+// target while no worker is idle, up to the maximum. Workers above the minimum
+// exit once they stay idle for POOL_IDLE_TIMEOUT. Once the queue is full the
+// pool refuses connections, so the caller can shed them (e.g. with a 503)
+// instead of letting them pile up
+
+// Counters since the pool started
+struct PoolStats {
+    int workers;             // Workers now
+    int busy;                // Workers serving a connection now
+    int max_workers;         // Most workers at once
+    int queued;              // Connections waiting for a worker now
+    int max_queued;          // Most connections waiting at once
+    unsigned long served;    // Connections taken by a worker
+    unsigned long shed;      // Connections refused because the queue was full
+    unsigned long grown;     // Workers added above the minimum
+    unsigned long shrunk;    // Idle workers that exited
+    uint64_t wait_ns;        // Time served connections waited in the queue
+    uint64_t worker_ns;      // Number of workers integrated over time
+    uint64_t busy_ns;        // Number of busy workers integrated over time
+    uint64_t queued_ns;      // Queue depth integrated over time
+    uint64_t elapsed_ns;     // Time covered by the counters
+};
+
+// Start the pool
+// Input:
+// - name: Printed before the stats reports
+// - serve: Called by a worker for every connection it takes (serve owns fd)
+// - max_workers: Most workers at once (at least POOL_MIN_WORKERS)
+// - capacity: Most connections waiting for a worker
+// - target_wait_usecs: Queue wait that makes the pool grow
+// - report_usecs: If > 0, print the stats of every interval of this length
+// Output:
+// - 0 on success, -1 on failure
+int pool_start(const char *name, void (*serve)(int fd), int max_workers, size_t capacity,
+               long target_wait_usecs, long report_usecs);
+
+// Queue a connection for the workers without blocking
+// Output:
+// - true on success, false if the queue is full or the pool is stopping (the
+//   caller still owns fd)
+bool pool_submit(int fd);
+
+// Let the workers finish the queued connections, then wait for every thread
+// of the pool to exit
+void pool_stop();
+
+// Copy the counters into stats
+void pool_get_stats(PoolStats *stats);
+
+// Print the counters to stderr
+void pool_dump_stats();
+
+// Print counters (e.g. the sum of several pools') to stderr
+void pool_print_stats(const char *name, const PoolStats *counters);
+
+#endif    // WORKER_POOL_H
@@ -1,12 +1,37 @@
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <string>
 
+#include "../lib/AsyncFileWriter.h"
+#include "../lib/Channel.h"
+#include "../lib/Combiner.h"
 #include "../lib/CondVar.h"
 #include "../lib/Lock.h"
+#include "../lib/WaitQueue.h"
+#include "../lib/SeqLock.h"
 #include "../lib/SpinLock.h"
 #include "../lib/async_io.h"
+#include "../lib/async_syscall.h"
+#include "../lib/io_stats.h"
+#include "../lib/lock_stats.h"
+#include "../lib/rcu.h"
+#include "../lib/timer.h"
 #include "../lib/uthread.h"
+#include "server/async_socket.h"
+#include "server/http_parser.h"
 
 // Test cases
 enum tests {
@@ -14,11 +39,30 @@ enum tests {
     SPIN_LOCK,
     COND_VAR,
     MULTI_COND_VAR,
-    ASYNC_IO
+    ASYNC_IO,
+    TIMED_COND_VAR,
+    CHANNEL,
+    BARGING_LOCK,
+    COMBINER,
+    SEQ_LOCK,
+    RCU,
+    IO_BATCH,
+    LARGE_FILE_IO,
+    ASYNC_SYSCALL,
+    SENDFILE,
+    IO_CANCEL,
+    IO_STATS_TEST,
+    FILE_WRITER,
+    LOCK_STATS_TEST,
+    DEADLOCK,
+    WAIT_QUEUE_TAG,
+    HTTP_PARSER,
+    HTTP_FIELDS,
+    ASYNC_SOCKET
 };
 
 // Busy waiting counter
-static volatile unsigned int wait = 0;
+static volatile unsigned int busy_wait_counter = 0;
 
 /* Testing Setup Functions */
 
@@ -75,7 +119,7 @@ inline void random_yield(const int chance) {
 
 // Busy waiting loop
 inline void busy_wait(const int bitstring) {
-    while (++wait &= bitstring);
+    while (++busy_wait_counter &= bitstring);
 }
 
 /* ====== Test 1: Mutex Lock ====== */
@@ -427,63 +471,2167 @@ int test_async_io() {
     return 0;
 }
 
-/* ======= Main ====== */
+/* ====== Test 6: Timed Condition Variable ====== */
 
-int main(int argc, char *argv[]) {
-    if (argc != 3 && argc != 4) {
-        std::cerr << "Usage: ./test <testnum> <quantum_usecs>" << std::endl;
-        std::cerr << "Usage: ./test <testnum> <quantum_usecs> <seed>" << std::endl;
-        exit(1);
+#define TIMEOUT_T6 20000    // usecs
+
+static Lock lock_t6;
+static CondVar cv_t6;
+
+static int waiting_t6 = 0;
+
+void *thread_timed_cond_var(void *args) {
+    (void) args;
+    random_yield(50);
+    lock_t6.lock();
+    // Nobody signals, so the wait must time out after at least TIMEOUT_T6
+    struct timespec start = timer_now();
+    if (cv_t6.wait_for(lock_t6, TIMEOUT_T6) != CV_TIMEOUT) {
+        std::cerr << "Thread " << uthread_self() << " was not timed out" << std::endl;
+        lock_t6.unlock();
+        return (void *) -1;
+    }
+    struct timespec end = timer_now();
+    long elapsed = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+    if (elapsed < TIMEOUT_T6) {
+        std::cerr << "Thread " << uthread_self() << " timed out early" << std::endl;
+        lock_t6.unlock();
+        return (void *) -1;
     }
+    std::cout << "Thread " << uthread_self() << " timed out after " << elapsed << " usecs"
+              << std::endl;
+    // The broadcast must arrive well before this deadline
+    waiting_t6++;
+    random_yield(33);
+    CvStatus status = cv_t6.wait_for(lock_t6, TIMEOUT_T6 * 500);
+    lock_t6.unlock();
+    if (status != CV_NO_TIMEOUT) {
+        std::cerr << "Thread " << uthread_self() << " missed the broadcast" << std::endl;
+        return (void *) -1;
+    }
+    return nullptr;
+}
 
-    const int testnum = atoi(argv[1]);
-    const int quantum_usecs = atoi(argv[2]);
-    const int seed = (argc == 4 ? atoi(argv[3]) : SEED);
-    const bool test_all = (testnum <= 0 ? true : false);
+// Tests CondVar::wait_for() timing out and being signaled before the deadline
+int test_timed_cond_var() {
+    display_test("Starting timed condition variable test...");
+    // Setup threads
+    if (testing_setup(thread_timed_cond_var, nullptr) != 0) {
+        return -1;
+    }
+    // Wake all threads once they are all waiting again
+    while (true) {
+        lock_t6.lock();
+        if (waiting_t6 == NUM_THREADS) {
+            cv_t6.broadcast();
+            lock_t6.unlock();
+            break;
+        }
+        lock_t6.unlock();
+        uthread_yield();
+    }
+    // Join threads
+    if (testing_cleanup() != 0) {
+        return -1;
+    }
+    // Check for correct results
+    for (int i = 0; i < NUM_THREADS; i++) {
+        if (t_results[i] != nullptr) {
+            return -1;
+        }
+    }
+    return 0;
+}
 
-    // Initialize uthread library
-    if (uthread_init(quantum_usecs) != 0) {
-        std::cerr << "uthread_init" << std::endl;
-        exit(1);
+/* ====== Test 7: Channel ====== */
+
+#define NUM_ITEMS_T7 50
+#define CAPACITY_T7 3
+
+static Channel<int> channel_t7(CAPACITY_T7);
+static Channel<int> select_a_t7(1);
+static Channel<int> select_b_t7(1);
+static Channel<int> *select_t7[] = { &select_a_t7, &select_b_t7 };
+
+void *thread_channel(void *args) {
+    (void) args;
+    // Consume until the channel is closed and drained
+    long sum = 0;
+    int value;
+    while (channel_t7.recv(value)) {
+        random_yield(25);
+        sum += value;
     }
+    return (void *) sum;
+}
 
-    srand(seed);
+void *thread_channel_select(void *args) {
+    (void) args;
+    // Receive one item from each channel, then observe both closed
+    long received = 0;
+    int value;
+    int idx;
+    while ((idx = channel_select(select_t7, 2, value)) != -1) {
+        received += (idx == 0 ? 1 : 100) * value;
+    }
+    return (void *) received;
+}
 
-    // Run tests
-    if (test_all || testnum == MUTEX_LOCK) {
-        if (test_mutex_lock() != 0) {
-            std::cerr << "Mutex lock test failed!" << std::endl;
-            exit(1);
+// Tests Channel send/recv, try_send/try_recv, close() and channel_select()
+int test_channel() {
+    display_test("Starting channel test...");
+    // Setup threads
+    if (testing_setup(thread_channel, nullptr) != 0) {
+        return -1;
+    }
+    // Produce items (blocks whenever the consumers fall behind)
+    for (int i = 1; i <= NUM_ITEMS_T7; i++) {
+        random_yield(25);
+        if (!channel_t7.send(i)) {
+            std::cerr << "send failed" << std::endl;
+            return -1;
         }
-        std::cout << "Mutex lock test passed!" << std::endl;
     }
-    if (test_all || testnum == SPIN_LOCK) {
-        if (test_spin_lock() != 0) {
-            std::cerr << "Spinlock test failed!" << std::endl;
-            exit(1);
+    channel_t7.close();
+    if (channel_t7.send(0) || channel_t7.try_send(0)) {
+        std::cerr << "Sent to a closed channel" << std::endl;
+        return -1;
+    }
+    // Join threads
+    if (testing_cleanup() != 0) {
+        return -1;
+    }
+    // Check every item was received exactly once
+    long total = 0;
+    for (int i = 0; i < NUM_THREADS; i++) {
+        total += (long) t_results[i];
+    }
+    if (total != NUM_ITEMS_T7 * (NUM_ITEMS_T7 + 1) / 2) {
+        std::cerr << "Total received is incorrect" << std::endl;
+        return -1;
+    }
+    // Non-blocking operations on a full/empty channel
+    int value;
+    if (select_a_t7.try_recv(value) || !select_a_t7.try_send(1) || select_a_t7.try_send(2) ||
+        !select_a_t7.try_recv(value) || value != 1) {
+        std::cerr << "try_send/try_recv are incorrect" << std::endl;
+        return -1;
+    }
+    // Select across two channels
+    int tid = uthread_create(thread_channel_select, nullptr);
+    if (tid == -1) {
+        std::cerr << "uthread_create" << std::endl;
+        return -1;
+    }
+    uthread_yield();
+    select_b_t7.send(2);
+    uthread_yield();
+    select_a_t7.send(3);
+    select_a_t7.close();
+    select_b_t7.close();
+    void *received;
+    if (uthread_join(tid, &received) != 0) {
+        std::cerr << "uthread_join" << std::endl;
+        return -1;
+    }
+    if ((long) received != 203) {
+        std::cerr << "Select received incorrect items" << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+/* ====== Test 8: Barging Lock ====== */
+
+#define NUM_ITER_T8 50
+
+static Lock lock_t8("lock_t8", LOCK_BARGING);
+
+static int counter_t8 = 0;
+static bool in_critical_t8 = false;
+static bool overlap_t8 = false;
+
+void *thread_barging_lock(void *args) {
+    (void) args;
+    for (int i = 0; i < NUM_ITER_T8; i++) {
+        random_yield(25);
+        lock_t8.lock();
+        // Check no other thread is in the critical section
+        if (in_critical_t8) {
+            overlap_t8 = true;
         }
-        std::cout << "Spinlock test passed!" << std::endl;
+        in_critical_t8 = true;
+        random_yield(50);
+        counter_t8++;
+        in_critical_t8 = false;
+        lock_t8.unlock();
     }
-    if (test_all || testnum == COND_VAR) {
-        if (test_cond_var() != 0) {
-            std::cerr << "Condition variable test failed!" << std::endl;
-            exit(1);
+    return nullptr;
+}
+
+// Tests Lock::lock() and Lock::unlock() with the LOCK_BARGING policy
+int test_barging_lock() {
+    display_test("Starting barging lock test...");
+    // Setup threads
+    if (testing_setup(thread_barging_lock, nullptr) != 0) {
+        return -1;
+    }
+    // Join threads (every thread must finish despite losing races for the lock)
+    if (testing_cleanup() != 0) {
+        return -1;
+    }
+    // Check for correctness
+    if (overlap_t8) {
+        std::cerr << "Threads overlapped in the critical section" << std::endl;
+        return -1;
+    }
+    if (counter_t8 != NUM_ITER_T8 * NUM_THREADS) {
+        std::cerr << "Counter is incorrect" << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+/* ====== Test 9: Combiner ====== */
+
+#define NUM_ITER_T9 50
+
+static Combiner combiner_t9("combiner_t9");
+
+static int values_t9[NUM_ITER_T9 * NUM_THREADS];
+static int counter_t9 = 0;
+
+void *thread_combiner(void *args) {
+    (void) args;
+    int tid = uthread_self();
+    for (int i = 0; i < NUM_ITER_T9; i++) {
+        random_yield(25);
+        bool done = false;
+        combiner_t9.execute([tid, &done]() {
+            values_t9[counter_t9] = tid;
+            counter_t9++;
+            done = true;
+        });
+        // The operation must have run before execute() returns
+        if (!done) {
+            return (void *) -1L;
         }
-        std::cout << "Condition variable test passed!" << std::endl;
     }
-    if (test_all || testnum == MULTI_COND_VAR) {
-        if (test_multi_cond_var() != 0) {
-            std::cerr << "Multiple condition variables test failed!" << std::endl;
-            exit(1);
+    return (void *) (long) tid;
+}
+
+// Tests Combiner::execute()
+int test_combiner() {
+    display_test("Starting combiner test...");
+    // Setup threads
+    if (testing_setup(thread_combiner, nullptr) != 0) {
+        return -1;
+    }
+    // Join threads
+    if (testing_cleanup() != 0) {
+        return -1;
+    }
+    // Check for correctness
+    long total_expected = 0;
+    for (int i = 0; i < NUM_THREADS; i++) {
+        if ((long) t_results[i] == -1) {
+            std::cerr << "execute() returned before the operation ran" << std::endl;
+            return -1;
         }
-        std::cout << "Multiple condition variables test passed!" << std::endl;
+        total_expected += (long) t_results[i] * NUM_ITER_T9;
     }
-    if (test_all || testnum == ASYNC_IO) {
-        if (test_async_io() != 0) {
-            std::cerr << "Asynchronus I/O test failed!" << std::endl;
-            exit(1);
+    if (counter_t9 != NUM_ITER_T9 * NUM_THREADS) {
+        std::cerr << "Counter is incorrect" << std::endl;
+        return -1;
+    }
+    long total_actual = 0;
+    for (int i = 0; i < counter_t9; i++) {
+        total_actual += values_t9[i];
+    }
+    if (total_actual != total_expected) {
+        std::cerr << "Total sum is incorrect" << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+/* ====== Test 10: SeqLock ====== */
+
+#define NUM_WRITES_T10 50
+#define NUM_READS_T10 200
+
+struct Pair {
+    long a;
+    long b;    // Always -a in a consistent snapshot
+};
+
+static SeqLock<Pair> seqlock_t10;
+
+static volatile bool writing_t10 = false;
+
+void *thread_seq_lock(void *args) {
+    (void) args;
+    // Read until the writer is done, counting torn snapshots
+    long torn = 0;
+    for (int i = 0; i < NUM_READS_T10 || writing_t10; i++) {
+        Pair pair = seqlock_t10.load();
+        if (pair.a != -pair.b) {
+            torn++;
         }
-        std::cout << "Asynchronus I/O test passed!" << std::endl;
+        random_yield(25);
+    }
+    return (void *) torn;
+}
+
+// Tests SeqLock::load(), SeqLock::store() and SeqLock::update()
+int test_seq_lock() {
+    display_test("Starting seqlock test...");
+    writing_t10 = true;
+    // Setup threads
+    if (testing_setup(thread_seq_lock, nullptr) != 0) {
+        return -1;
+    }
+    // Write while the readers run, yielding in the middle of updates
+    for (long i = 1; i <= NUM_WRITES_T10; i++) {
+        seqlock_t10.update([i](Pair &pair) {
+            pair.a = i;
+            random_yield(50);
+            pair.b = -i;
+        });
+        random_yield(50);
+    }
+    seqlock_t10.store({ 0, 0 });
+    writing_t10 = false;
+    // Join threads
+    if (testing_cleanup() != 0) {
+        return -1;
+    }
+    // Check no reader saw a torn snapshot
+    for (int i = 0; i < NUM_THREADS; i++) {
+        if ((long) t_results[i] != 0) {
+            std::cerr << "Reader saw a torn snapshot" << std::endl;
+            return -1;
+        }
+    }
+    Pair pair = seqlock_t10.load();
+    if (pair.a != 0 || pair.b != 0) {
+        std::cerr << "Final value is incorrect" << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+/* ====== Test 11: RCU ====== */
+
+#define NUM_VERSIONS_T11 60
+
+struct Version {
+    long value;
+    bool reclaimed;    // Set by the free callback instead of freeing
+    RcuHead head;
+};
+
+static Version versions_t11[NUM_VERSIONS_T11];
+static std::atomic<Version *> current_t11;
+static int reclaimed_t11 = 0;
+
+static volatile bool writing_t11 = false;
+
+void reclaim_version(RcuHead *head) {
+    Version *version = (Version *) ((char *) head - offsetof(Version, head));
+    version->reclaimed = true;
+    reclaimed_t11++;
+}
+
+void *thread_rcu(void *args) {
+    (void) args;
+    // Read until the writer is done, counting reads of reclaimed versions
+    long bad = 0;
+    while (writing_t11) {
+        rcu_read_lock();
+        Version *version = current_t11.load(std::memory_order_acquire);
+        random_yield(50);
+        rcu_read_lock();    // Nested sections are allowed
+        random_yield(50);
+        if (version->reclaimed) {
+            bad++;
+        }
+        rcu_read_unlock();
+        rcu_read_unlock();
+        random_yield(25);
+    }
+    return (void *) bad;
+}
+
+// Tests rcu_read_lock(), rcu_read_unlock(), rcu_retire() and rcu_synchronize()
+int test_rcu() {
+    display_test("Starting RCU test...");
+    current_t11 = &versions_t11[0];
+    writing_t11 = true;
+    // Setup threads
+    if (testing_setup(thread_rcu, nullptr) != 0) {
+        return -1;
+    }
+    // Publish new versions, retiring the old ones
+    for (int i = 1; i < NUM_VERSIONS_T11; i++) {
+        versions_t11[i].value = i;
+        Version *old = current_t11.exchange(&versions_t11[i]);
+        rcu_retire(&old->head, reclaim_version);
+        random_yield(50);
+    }
+    writing_t11 = false;
+    // Join threads
+    if (testing_cleanup() != 0) {
+        return -1;
+    }
+    for (int i = 0; i < NUM_THREADS; i++) {
+        if ((long) t_results[i] != 0) {
+            std::cerr << "Reader saw a reclaimed version" << std::endl;
+            return -1;
+        }
+    }
+    // Every retired version must be reclaimed once all readers are gone
+    rcu_synchronize();
+    if (reclaimed_t11 != NUM_VERSIONS_T11 - 1 || current_t11.load()->reclaimed) {
+        std::cerr << "Retired versions were not reclaimed" << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+/* ====== Test 12: I/O Batch ====== */
+
+#define NUM_BLOCKS_T12 8
+#define BLOCK_SIZE_T12 64
+#define REGION_SIZE_T12 (NUM_BLOCKS_T12 * BLOCK_SIZE_T12)
+
+static int fd_t12;
+static std::atomic<int> next_region_t12;
+
+void *thread_io_batch(void *args) {
+    (void) args;
+    int region = next_region_t12++;
+    char out[NUM_BLOCKS_T12][BLOCK_SIZE_T12];
+    char in[NUM_BLOCKS_T12][BLOCK_SIZE_T12];
+    // Write every block of the region in one batch
+    uthread_io_batch batch;
+    uthread_io_batch_init(&batch);
+    for (int i = 0; i < NUM_BLOCKS_T12; i++) {
+        memset(out[i], 'a' + region, BLOCK_SIZE_T12);
+        out[i][0] = '0' + i;
+        int offset = region * REGION_SIZE_T12 + i * BLOCK_SIZE_T12;
+        if (uthread_io_batch_write(&batch, fd_t12, out[i], BLOCK_SIZE_T12, offset) != i) {
+            return (void *) 1;
+        }
+    }
+    random_yield(50);
+    if (uthread_io_batch_wait_all(&batch) != 0) {
+        perror("write");
+        return (void *) 1;
+    }
+    // Read the blocks back two at a time with vectored reads, collecting the
+    // reads in completion order
+    struct iovec iov[NUM_BLOCKS_T12];
+    uthread_io_batch_init(&batch);
+    for (int i = 0; i < NUM_BLOCKS_T12; i += 2) {
+        iov[i] = { in[i], BLOCK_SIZE_T12 };
+        iov[i + 1] = { in[i + 1], BLOCK_SIZE_T12 };
+        int offset = region * REGION_SIZE_T12 + i * BLOCK_SIZE_T12;
+        uthread_io_batch_readv(&batch, fd_t12, &iov[i], 2, offset);
+    }
+    int num_completed = 0;
+    bool seen[NUM_BLOCKS_T12 / 2] = {};
+    int index;
+    while ((index = uthread_io_batch_wait_any(&batch)) != -1) {
+        if (seen[index] || uthread_io_batch_result(&batch, index) != 2 * BLOCK_SIZE_T12) {
+            return (void *) 1;
+        }
+        seen[index] = true;
+        num_completed++;
+        random_yield(50);
+    }
+    if (num_completed != NUM_BLOCKS_T12 / 2 || memcmp(in, out, sizeof(in)) != 0) {
+        return (void *) 1;
+    }
+    return nullptr;
+}
+
+// Tests uthread_io_batch with file reads/writes and a pipe
+int test_io_batch() {
+    display_test("Starting I/O batch test...");
+    char path[] = "/tmp/uthread_io_batch_XXXXXX";
+    fd_t12 = mkstemp(path);
+    if (fd_t12 == -1) {
+        perror("mkstemp");
+        return -1;
+    }
+    unlink(path);
+    // Setup threads
+    if (testing_setup(thread_io_batch, nullptr) != 0) {
+        return -1;
+    }
+    // Join threads
+    if (testing_cleanup() != 0) {
+        return -1;
+    }
+    close(fd_t12);
+    for (int i = 0; i < NUM_THREADS; i++) {
+        if (t_results[i] != nullptr) {
+            std::cerr << "Batched file I/O is incorrect" << std::endl;
+            return -1;
+        }
+    }
+    // Pipes have no file offset
+    int pipe_fds[2];
+    if (pipe(pipe_fds) == -1) {
+        perror("pipe");
+        return -1;
+    }
+    char message[] = "batch", received[sizeof(message)];
+    uthread_io_batch batch;
+    uthread_io_batch_init(&batch);
+    uthread_io_batch_write(&batch, pipe_fds[1], message, sizeof(message), -1);
+    int read_index = uthread_io_batch_read(&batch, pipe_fds[0], received, sizeof(received), -1);
+    if (uthread_io_batch_wait_all(&batch) != 0 ||
+        uthread_io_batch_result(&batch, read_index) != sizeof(message) ||
+        strcmp(message, received) != 0) {
+        std::cerr << "Batched pipe I/O is incorrect" << std::endl;
+        return -1;
+    }
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    return 0;
+}
+
+/* ====== Test 13: Large File I/O ====== */
+
+#define BLOCK_SIZE_T13 4096
+#define BASE_OFFSET_T13 ((off_t) 5 << 30)    // Past 4 GB to catch 32-bit truncation
+
+static int fd_t13;
+static char buffers_t13[NUM_THREADS][BLOCK_SIZE_T13];
+static std::atomic<int> next_slot_t13;
+
+void *thread_large_file_io(void *args) {
+    (void) args;
+    int slot = next_slot_t13++;
+    off_t offset = BASE_OFFSET_T13 + (off_t) slot * 2 * BLOCK_SIZE_T13;
+    char expected[BLOCK_SIZE_T13];
+    memset(expected, 'a' + slot, BLOCK_SIZE_T13);
+    // Write from the registered buffer, read back into a regular one
+    memcpy(buffers_t13[slot], expected, BLOCK_SIZE_T13);
+    random_yield(50);
+    if (async_pwrite_fixed(fd_t13, slot, BLOCK_SIZE_T13, offset) != BLOCK_SIZE_T13) {
+        perror("write");
+        return (void *) 1;
+    }
+    char in[BLOCK_SIZE_T13];
+    if (async_pread(fd_t13, in, BLOCK_SIZE_T13, offset) != BLOCK_SIZE_T13 ||
+        memcmp(in, expected, BLOCK_SIZE_T13) != 0) {
+        return (void *) 1;
+    }
+    // Write the next block regularly, read it into the registered buffer
+    random_yield(50);
+    memset(buffers_t13[slot], 0, BLOCK_SIZE_T13);
+    uthread_io_batch batch;
+    uthread_io_batch_init(&batch);
+    uthread_io_batch_write(&batch, fd_t13, expected, BLOCK_SIZE_T13, offset + BLOCK_SIZE_T13);
+    if (uthread_io_batch_wait_all(&batch) != 0) {
+        return (void *) 1;
+    }
+    uthread_io_batch_init(&batch);
+    uthread_io_batch_read_fixed(&batch, fd_t13, slot, BLOCK_SIZE_T13, offset + BLOCK_SIZE_T13);
+    if (uthread_io_batch_wait_all(&batch) != 0 ||
+        memcmp(buffers_t13[slot], expected, BLOCK_SIZE_T13) != 0) {
+        return (void *) 1;
+    }
+    return nullptr;
+}
+
+// Tests the off_t API past 4 GB (in a sparse file) and registered buffers
+int test_large_file_io() {
+    display_test("Starting large file I/O test...");
+    char path[] = "/tmp/uthread_large_file_XXXXXX";
+    fd_t13 = mkstemp(path);
+    if (fd_t13 == -1) {
+        perror("mkstemp");
+        return -1;
+    }
+    unlink(path);
+    struct iovec pool[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; i++) {
+        pool[i].iov_base = buffers_t13[i];
+        pool[i].iov_len = BLOCK_SIZE_T13;
+    }
+    if (async_register_buffers(pool, NUM_THREADS) != 0) {
+        perror("async_register_buffers");
+        return -1;
+    }
+    // Only one pool at a time and indices are checked
+    if (async_register_buffers(pool, NUM_THREADS) != -1 || errno != EBUSY ||
+        async_pread_fixed(fd_t13, NUM_THREADS, 1, 0) != -1 || errno != EINVAL ||
+        async_pread_fixed(fd_t13, 0, BLOCK_SIZE_T13 + 1, 0) != -1 || errno != EINVAL) {
+        std::cerr << "Invalid buffer pool use was not rejected" << std::endl;
+        return -1;
+    }
+    // Setup threads
+    if (testing_setup(thread_large_file_io, nullptr) != 0) {
+        return -1;
+    }
+    // Join threads
+    if (testing_cleanup() != 0) {
+        return -1;
+    }
+    if (async_unregister_buffers() != 0) {
+        perror("async_unregister_buffers");
+        return -1;
+    }
+    for (int i = 0; i < NUM_THREADS; i++) {
+        if (t_results[i] != nullptr) {
+            std::cerr << "Large file I/O is incorrect" << std::endl;
+            return -1;
+        }
+    }
+    // The last block must end where expected
+    struct stat statbuf;
+    if (fstat(fd_t13, &statbuf) == -1 ||
+        statbuf.st_size != BASE_OFFSET_T13 + (off_t) NUM_THREADS * 2 * BLOCK_SIZE_T13) {
+        std::cerr << "Large file has the wrong size" << std::endl;
+        return -1;
+    }
+    close(fd_t13);
+    return 0;
+}
+
+/* ====== Test 14: Async Syscall ====== */
+
+#define SLEEP_USECS_T14 20000
+
+static volatile bool sleeping_t14 = false;
+
+void *thread_async_syscall(void *args) {
+    (void) args;
+    // Block a helper instead of the whole process
+    long ret_val = async_syscall([]() -> long { return usleep(SLEEP_USECS_T14); });
+    return (void *) ret_val;
+}
+
+void *thread_async_syscall_spinner(void *args) {
+    (void) args;
+    // Count how often this thread runs while the others sleep
+    long runs = 0;
+    while (sleeping_t14) {
+        runs++;
+        uthread_yield();
+    }
+    return (void *) runs;
+}
+
+// Tests async_syscall() with closures and the offloaded system calls
+int test_async_syscall() {
+    display_test("Starting async syscall test...");
+    // Sleeping threads must not stall the other threads
+    sleeping_t14 = true;
+    int spinner = uthread_create(thread_async_syscall_spinner, nullptr);
+    struct timespec start = timer_now();
+    if (testing_setup(thread_async_syscall, nullptr) != 0) {
+        return -1;
+    }
+    if (testing_cleanup() != 0) {
+        return -1;
+    }
+    struct timespec end = timer_now();
+    sleeping_t14 = false;
+    void *runs;
+    if (spinner == -1 || uthread_join(spinner, &runs) != 0) {
+        std::cerr << "uthread_join" << std::endl;
+        return -1;
+    }
+    for (int i = 0; i < NUM_THREADS; i++) {
+        if (t_results[i] != nullptr) {
+            std::cerr << "Offloaded call failed" << std::endl;
+            return -1;
+        }
+    }
+    // Only the helpers sleep, so the sleeps overlap and the spinner keeps
+    // running
+    long elapsed_usecs =
+        (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+    std::cout << NUM_THREADS << " sleeps took " << elapsed_usecs << " usecs, spinner ran "
+              << (long) runs << " times" << std::endl;
+    if (elapsed_usecs >= NUM_THREADS * SLEEP_USECS_T14 || (long) runs == 0) {
+        std::cerr << "Offloaded calls blocked other threads" << std::endl;
+        return -1;
+    }
+    // Results and errno come back from the helper
+    if (async_open("/nonexistent/uthread", O_RDONLY) != -1 || errno != ENOENT) {
+        std::cerr << "Offloaded call lost errno" << std::endl;
+        return -1;
+    }
+    char path[] = "/tmp/uthread_syscall_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        return -1;
+    }
+    char data[] = "offloaded";
+    struct stat statbuf;
+    if (async_pwrite(fd, data, sizeof(data), 0) != sizeof(data) || async_fsync(fd) != 0 ||
+        async_close(fd) != 0 || async_stat(path, &statbuf) != 0 ||
+        statbuf.st_size != sizeof(data)) {
+        std::cerr << "Offloaded file calls failed" << std::endl;
+        unlink(path);
+        return -1;
+    }
+    unlink(path);
+    return 0;
+}
+
+/* ====== Test 15: Sendfile and Splice ====== */
+
+#define FILE_SIZE_T15 (1 << 20)    // Much larger than a pipe buffer
+
+static char data_t15[FILE_SIZE_T15];
+
+struct SpliceArgs {
+    int pipe_fd;    // Read end of the pipe
+    int file_fd;    // File to splice into
+};
+
+void *thread_splice(void *args) {
+    SpliceArgs *params = (SpliceArgs *) args;
+    off_t offset = 0;
+    ssize_t nbytes;
+    while ((nbytes = async_splice(params->pipe_fd, nullptr, params->file_fd, &offset,
+                                  FILE_SIZE_T15, 0)) > 0) {
+    }
+    return nbytes == 0 ? (void *) offset : (void *) -1;
+}
+
+// Send in_fd through a non-blocking pipe with async_sendfile() while another
+// thread splices the pipe into a new file. Returns true if the copy matches
+bool sendfile_through_pipe(int in_fd) {
+    char path[] = "/tmp/uthread_splice_XXXXXX";
+    int out_fd = mkstemp(path);
+    int pipe_fds[2];
+    if (out_fd == -1 || pipe2(pipe_fds, O_NONBLOCK) == -1) {
+        perror("sendfile_through_pipe");
+        return false;
+    }
+    unlink(path);
+    SpliceArgs args = { pipe_fds[0], out_fd };
+    int tid = uthread_create(thread_splice, &args);
+    ssize_t sent = async_sendfile(pipe_fds[1], in_fd, 0, FILE_SIZE_T15);
+    close(pipe_fds[1]);
+    void *spliced;
+    if (tid == -1 || uthread_join(tid, &spliced) != 0) {
+        std::cerr << "uthread_join" << std::endl;
+        return false;
+    }
+    static char copy[FILE_SIZE_T15];
+    bool same = sent == FILE_SIZE_T15 && (long) spliced == FILE_SIZE_T15 &&
+                pread(out_fd, copy, FILE_SIZE_T15, 0) == FILE_SIZE_T15 &&
+                memcmp(copy, data_t15, FILE_SIZE_T15) == 0;
+    close(pipe_fds[0]);
+    close(out_fd);
+    return same;
+}
+
+void *thread_pipe_writer(void *args) {
+    int fd = *(int *) args;
+    // The pipe is non-blocking, so yield while it is full
+    for (size_t written = 0; written < FILE_SIZE_T15;) {
+        ssize_t nbytes = write(fd, data_t15 + written, FILE_SIZE_T15 - written);
+        if (nbytes > 0) {
+            written += nbytes;
+        } else {
+            uthread_yield();
+        }
+    }
+    close(fd);
+    return nullptr;
+}
+
+// Tests async_sendfile() (zero-copy and the copy fallback) and async_splice()
+int test_sendfile() {
+    display_test("Starting sendfile test...");
+    for (int i = 0; i < FILE_SIZE_T15; i++) {
+        data_t15[i] = rand();
+    }
+    char path[] = "/tmp/uthread_sendfile_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        return -1;
+    }
+    unlink(path);
+    if (async_pwrite(fd, data_t15, FILE_SIZE_T15, 0) != FILE_SIZE_T15) {
+        perror("write");
+        return -1;
+    }
+    // A file is sent inside the kernel
+    if (!sendfile_through_pipe(fd)) {
+        std::cerr << "Sendfile from a file is incorrect" << std::endl;
+        return -1;
+    }
+    close(fd);
+    // The kernel refuses to sendfile from a pipe, so the data is copied
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_NONBLOCK) == -1) {
+        perror("pipe2");
+        return -1;
+    }
+    int tid = uthread_create(thread_pipe_writer, &pipe_fds[1]);
+    bool same = sendfile_through_pipe(pipe_fds[0]);
+    if (tid == -1 || uthread_join(tid, nullptr) != 0) {
+        std::cerr << "uthread_join" << std::endl;
+        return -1;
+    }
+    close(pipe_fds[0]);
+    if (!same) {
+        std::cerr << "Sendfile fallback is incorrect" << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+/* ====== Test 16: I/O Deadlines and Cancellation ====== */
+
+#define TIMEOUT_T16 20000    // usecs
+
+static IoCancelToken token_t16;
+static volatile bool reading_t16 = false;
+
+// Microseconds since start
+long usecs_since(const struct timespec &start) {
+    struct timespec now = timer_now();
+    return (now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000;
+}
+
+void *thread_cancelled_read(void *args) {
+    int fd = *(int *) args;
+    IoControl ctl;
+    ctl.token = &token_t16;
+    char c;
+    reading_t16 = true;
+    ssize_t nbytes = async_pread(fd, &c, 1, 0, &ctl);
+    return nbytes == -1 && errno == ECANCELED ? (void *) 0 : (void *) -1;
+}
+
+// Tests deadlines and cancellation tokens of the io_uring, reactor and batch
+// paths. Nothing is ever written to the pipes being read, so every operation
+// can only end by being aborted
+int test_io_cancel() {
+    display_test("Starting I/O cancellation test...");
+    int pipe_fds[2];
+    if (pipe(pipe_fds) == -1) {
+        perror("pipe");
+        return -1;
+    }
+    char buf[2];
+    struct timespec start = timer_now();
+    struct timespec deadline = timer_deadline(TIMEOUT_T16);
+    IoControl ctl;
+    ctl.deadline = &deadline;
+    // Read that times out
+    if (async_pread(pipe_fds[0], buf, 1, 0, &ctl) != -1 || errno != ETIMEDOUT ||
+        usecs_since(start) < TIMEOUT_T16) {
+        std::cerr << "Read was not timed out" << std::endl;
+        return -1;
+    }
+    std::cout << "Read timed out after " << usecs_since(start) << " usecs" << std::endl;
+
+    // Read cancelled by another thread while it is blocked
+    int tid = uthread_create(thread_cancelled_read, &pipe_fds[0]);
+    while (!reading_t16) {
+        uthread_yield();
+    }
+    uthread_yield();
+    io_cancel(&token_t16);
+    void *ret_val;
+    if (tid == -1 || uthread_join(tid, &ret_val) != 0 || ret_val != nullptr) {
+        std::cerr << "Read was not cancelled" << std::endl;
+        return -1;
+    }
+    // Later operations fail at once
+    ctl.deadline = nullptr;
+    ctl.token = &token_t16;
+    if (async_pread(pipe_fds[0], buf, 1, 0, &ctl) != -1 || errno != ECANCELED) {
+        std::cerr << "Cancelled token did not fail the read" << std::endl;
+        return -1;
+    }
+    // The cancelled reads consumed nothing
+    if (write(pipe_fds[1], "x", 1) != 1 || async_pread(pipe_fds[0], buf, 1, 0) != 1 ||
+        buf[0] != 'x') {
+        std::cerr << "Cancelled read consumed data" << std::endl;
+        return -1;
+    }
+
+    // Batch that times out, its reads are cancelled
+    uthread_io_batch batch;
+    uthread_io_batch_init(&batch);
+    uthread_io_batch_read(&batch, pipe_fds[0], &buf[0], 1, -1);
+    uthread_io_batch_read(&batch, pipe_fds[0], &buf[1], 1, -1);
+    deadline = timer_deadline(TIMEOUT_T16);
+    ctl.deadline = &deadline;
+    ctl.token = nullptr;
+    if (uthread_io_batch_wait_all(&batch, &ctl) != -1 || errno != ETIMEDOUT) {
+        std::cerr << "Batch was not timed out" << std::endl;
+        return -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (uthread_io_batch_result(&batch, i) != -1 || errno != ECANCELED) {
+            std::cerr << "Batch read " << i << " was not cancelled" << std::endl;
+            return -1;
+        }
+    }
+
+    // Reactor wait that times out
+    close(pipe_fds[1]);
+    close(pipe_fds[0]);
+    char path[] = "/tmp/uthread_cancel_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1 || pipe2(pipe_fds, O_NONBLOCK) == -1) {
+        perror("test_io_cancel");
+        return -1;
+    }
+    unlink(path);
+    deadline = timer_deadline(TIMEOUT_T16);
+    off_t offset = 0;
+    if (async_splice(pipe_fds[0], nullptr, fd, &offset, 1, 0, &ctl) != -1 || errno != ETIMEDOUT) {
+        std::cerr << "Splice was not timed out" << std::endl;
+        return -1;
+    }
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    close(fd);
+    return 0;
+}
+
+/* ====== Test 17: I/O Stats ====== */
+
+#define NUM_READS_T17 8
+#define READ_SIZE_T17 512
+
+// Sum of the samples of a latency histogram
+unsigned long histogram_samples(const unsigned long *buckets) {
+    unsigned long total = 0;
+    for (int i = 0; i < IO_STATS_BUCKETS; i++) {
+        total += buckets[i];
+    }
+    return total;
+}
+
+// Tests the I/O counters and latency histograms (only built with IO_STATS)
+int test_io_stats() {
+    display_test("Starting I/O stats test...");
+    IoStats stats;
+#ifndef IO_STATS
+    if (uthread_get_io_stats(&stats) != -1 || errno != ENOSYS) {
+        std::cerr << "Stats reported without IO_STATS" << std::endl;
+        return -1;
+    }
+    std::cout << "Built without IO_STATS, nothing to collect" << std::endl;
+    return 0;
+#else
+    char path[] = "/tmp/uthread_io_stats_XXXXXX";
+    int fd = mkstemp(path);
+    static char buf[NUM_READS_T17 * READ_SIZE_T17];
+    if (fd == -1 || write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+        perror("test_io_stats");
+        return -1;
+    }
+    int write_only_fd = open(path, O_WRONLY);
+    unlink(path);
+    uthread_reset_io_stats();
+    for (int i = 0; i < NUM_READS_T17; i++) {
+        if (async_pread(fd, buf, READ_SIZE_T17, i * READ_SIZE_T17) != READ_SIZE_T17) {
+            perror("async_pread");
+            return -1;
+        }
+    }
+    // Fails with EBADF
+    if (async_pread(write_only_fd, buf, READ_SIZE_T17, 0) != -1) {
+        std::cerr << "Read from a write-only fd succeeded" << std::endl;
+        return -1;
+    }
+    if (uthread_get_io_stats(&stats) != 0) {
+        perror("uthread_get_io_stats");
+        return -1;
+    }
+    const IoClassStats &files = stats.classes[IO_FD_FILE];
+    if (files.submitted != NUM_READS_T17 + 1 || files.completed != NUM_READS_T17 ||
+        files.failed != 1 || stats.in_flight != 0 || stats.max_in_flight == 0) {
+        std::cerr << "Wrong counts: " << files.submitted << " submitted, " << files.completed
+                  << " completed, " << files.failed << " failed, " << stats.in_flight
+                  << " in flight" << std::endl;
+        return -1;
+    }
+    // Without io_uring threads poll their requests, so there is no separate
+    // scheduling delay
+    unsigned long resumed = uring_available() ? NUM_READS_T17 + 1 : 0;
+    if (histogram_samples(stats.service) != NUM_READS_T17 + 1 ||
+        histogram_samples(stats.resume) != resumed) {
+        std::cerr << "Wrong number of latency samples" << std::endl;
+        return -1;
+    }
+    uthread_dump_io_stats();
+    close(write_only_fd);
+    close(fd);
+    return 0;
+#endif
+}
+
+/* ====== Test 18: AsyncFileWriter ====== */
+
+#define NUM_RECORDS_T18 200
+#define RECORD_SIZE_T18 100     // Does not divide the buffer size, records spill
+#define BUFFER_SIZE_T18 4096    // Small buffers so appenders wait for the flusher
+#define SYNC_USECS_T18 20000
+
+static AsyncFileWriter *writer_t18;
+
+// Fill a record with the thread's index and a sequence number
+void make_record_t18(char *record, int thread, int seq) {
+    memset(record, 'a' + thread, RECORD_SIZE_T18);
+    memcpy(record + 1, &seq, sizeof(seq));
+    record[RECORD_SIZE_T18 - 1] = '\n';
+}
+
+void *thread_file_writer(void *args) {
+    int thread = *(int *) args;
+    char record[RECORD_SIZE_T18];
+    for (int i = 0; i < NUM_RECORDS_T18; i++) {
+        make_record_t18(record, thread, i);
+        if (writer_t18->append(record, RECORD_SIZE_T18) == -1) {
+            perror("AsyncFileWriter::append");
+            return (void *) -1;
+        }
+        if (rand() % 4 == 0) {
+            uthread_yield();
+        }
+    }
+    return nullptr;
+}
+
+static char piped_t18[NUM_RECORDS_T18 * RECORD_SIZE_T18];
+
+// Reads the pipe at its current position until the writer closes it. Returns
+// the number of bytes read
+void *thread_pipe_reader(void *args) {
+    int fd = *(int *) args;
+    size_t total = 0;
+    ssize_t nbytes;
+    while (total < sizeof(piped_t18) &&
+           (nbytes = async_pread(fd, piped_t18 + total, sizeof(piped_t18) - total, -1)) > 0) {
+        total += nbytes;
+    }
+    return (void *) total;
+}
+
+// Tests that a writer on a pipe (no file offset) delivers every record in order
+int test_file_writer_pipe() {
+    int pipe_fds[2];
+    if (pipe(pipe_fds) == -1) {
+        perror("pipe");
+        return -1;
+    }
+    // The records outgrow the pipe, so it must be drained while they are written
+    int tid = uthread_create(thread_pipe_reader, &pipe_fds[0]);
+    AsyncFileWriter writer(pipe_fds[1], BUFFER_SIZE_T18, 2);
+    char record[RECORD_SIZE_T18];
+    for (int i = 0; i < NUM_RECORDS_T18; i++) {
+        make_record_t18(record, 0, i);
+        if (writer.append(record, RECORD_SIZE_T18) == -1) {
+            perror("AsyncFileWriter::append");
+            return -1;
+        }
+    }
+    if (writer.close() == -1) {
+        perror("AsyncFileWriter::close");
+        return -1;
+    }
+    void *ret_val;
+    if (tid == -1 || uthread_join(tid, &ret_val) != 0 || (size_t) ret_val != sizeof(piped_t18)) {
+        std::cerr << "Pipe reader did not get every record" << std::endl;
+        return -1;
+    }
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    for (int i = 0; i < NUM_RECORDS_T18; i++) {
+        make_record_t18(record, 0, i);
+        if (memcmp(piped_t18 + i * RECORD_SIZE_T18, record, RECORD_SIZE_T18) != 0) {
+            std::cerr << "Piped record " << i << " is wrong" << std::endl;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Tests that concurrent appends reach the file whole and in order, that the
+// periodic sync writes a partial buffer without a flush(), and that pipes are
+// written too
+int test_file_writer() {
+    display_test("Starting AsyncFileWriter test...");
+    char path[] = "/tmp/uthread_writer_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        return -1;
+    }
+    unlink(path);
+    writer_t18 = new AsyncFileWriter(fd, BUFFER_SIZE_T18, 2, SYNC_USECS_T18);
+    int threads[NUM_THREADS];
+    int tids[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; i++) {
+        threads[i] = i;
+        tids[i] = uthread_create(thread_file_writer, &threads[i]);
+    }
+    for (int i = 0; i < NUM_THREADS; i++) {
+        void *ret_val;
+        if (tids[i] == -1 || uthread_join(tids[i], &ret_val) != 0 || ret_val != nullptr) {
+            std::cerr << "Appender " << i << " failed" << std::endl;
+            return -1;
+        }
+    }
+    if (writer_t18->flush() == -1) {
+        perror("AsyncFileWriter::flush");
+        return -1;
+    }
+    // The writes are positioned
+    if (lseek(fd, 0, SEEK_CUR) != 0) {
+        std::cerr << "File position was moved" << std::endl;
+        return -1;
+    }
+    // Every record is whole and each thread's records are in order
+    const off_t size = NUM_THREADS * NUM_RECORDS_T18 * RECORD_SIZE_T18;
+    static char contents[NUM_THREADS * NUM_RECORDS_T18 * RECORD_SIZE_T18];
+    if (lseek(fd, 0, SEEK_END) != size || pread(fd, contents, size, 0) != size) {
+        std::cerr << "Wrong file size" << std::endl;
+        return -1;
+    }
+    int next_seq[NUM_THREADS] = { 0 };
+    char expected[RECORD_SIZE_T18];
+    for (off_t offset = 0; offset < size; offset += RECORD_SIZE_T18) {
+        int thread = contents[offset] - 'a';
+        if (thread < 0 || thread >= NUM_THREADS) {
+            std::cerr << "Corrupt record at offset " << offset << std::endl;
+            return -1;
+        }
+        make_record_t18(expected, thread, next_seq[thread]++);
+        if (memcmp(contents + offset, expected, RECORD_SIZE_T18) != 0) {
+            std::cerr << "Record at offset " << offset << " is torn or out of order" << std::endl;
+            return -1;
+        }
+    }
+
+    // A partial buffer is written by the periodic sync alone
+    char record[RECORD_SIZE_T18];
+    make_record_t18(record, 0, NUM_RECORDS_T18);
+    if (writer_t18->append(record, RECORD_SIZE_T18) == -1) {
+        perror("AsyncFileWriter::append");
+        return -1;
+    }
+    struct timespec start = timer_now();
+    while (lseek(fd, 0, SEEK_END) != size + RECORD_SIZE_T18) {
+        if (usecs_since(start) > 100 * SYNC_USECS_T18) {
+            std::cerr << "Partial buffer was not written by the periodic sync" << std::endl;
+            return -1;
+        }
+        uthread_yield();
+    }
+    std::cout << "Partial buffer written after " << usecs_since(start) << " usecs" << std::endl;
+
+    // Appends fail once the writer is closed
+    if (writer_t18->close() == -1 || writer_t18->append(record, RECORD_SIZE_T18) != -1 ||
+        errno != EBADF) {
+        std::cerr << "Append after close() did not fail" << std::endl;
+        return -1;
+    }
+    delete writer_t18;
+    close(fd);
+    return test_file_writer_pipe();
+}
+
+/* ====== Test 19: Lock Stats ====== */
+
+#define NUM_WAITERS_T19 4
+#define NUM_TIMEOUTS_T19 3
+#define TIMEOUT_T19 1000    // usecs
+
+static Lock lock_t19("lock_t19");
+static CondVar cond_t19("cond_t19");
+static std::atomic<int> arrived_t19(0);
+static bool signaled_t19 = false;
+
+void *thread_contended_lock(void *args) {
+    (void) args;
+    arrived_t19++;
+    lock_t19.lock();
+    lock_t19.unlock();
+    return nullptr;
+}
+
+void *thread_stats_signaler(void *args) {
+    (void) args;
+    lock_t19.lock();
+    signaled_t19 = true;
+    cond_t19.signal();
+    lock_t19.unlock();
+    return nullptr;
+}
+
+// Tests the contention counters of Lock and CondVar (only built with
+// LOCK_STATS)
+int test_lock_stats() {
+    display_test("Starting lock stats test...");
+    LockCounters counters;
+#ifndef LOCK_STATS
+    if (uthread_get_lock_stats("lock_t19", &counters) != -1 || errno != ENOSYS) {
+        std::cerr << "Stats reported without LOCK_STATS" << std::endl;
+        return -1;
+    }
+    std::cout << "Built without LOCK_STATS, nothing to collect" << std::endl;
+    return 0;
+#else
+    // Every waiter finds the lock held, so each of their acquisitions is
+    // contended and the holder's is not
+    lock_t19.lock();
+    int tids[NUM_WAITERS_T19];
+    for (int i = 0; i < NUM_WAITERS_T19; i++) {
+        tids[i] = uthread_create(thread_contended_lock, nullptr);
+    }
+    while (arrived_t19 < NUM_WAITERS_T19) {
+        uthread_yield();
+    }
+    // Let the last ones to arrive block in lock()
+    for (int i = 0; i < NUM_WAITERS_T19; i++) {
+        uthread_yield();
+    }
+    lock_t19.unlock();
+    for (int i = 0; i < NUM_WAITERS_T19; i++) {
+        if (tids[i] == -1 || uthread_join(tids[i], nullptr) != 0) {
+            std::cerr << "uthread_join" << std::endl;
+            return -1;
+        }
+    }
+    if (uthread_get_lock_stats("lock_t19", &counters) != 0) {
+        perror("uthread_get_lock_stats");
+        return -1;
+    }
+    if (counters.acquisitions != NUM_WAITERS_T19 + 1 || counters.contended != NUM_WAITERS_T19 ||
+        counters.total_wait_ns == 0) {
+        std::cerr << "Wrong lock counts: " << counters.acquisitions << " acquired, "
+                  << counters.contended << " contended" << std::endl;
+        return -1;
+    }
+
+    // For a CondVar, contended counts the waits that timed out
+    lock_t19.lock();
+    for (int i = 0; i < NUM_TIMEOUTS_T19; i++) {
+        if (cond_t19.wait_for(lock_t19, TIMEOUT_T19) != CV_TIMEOUT) {
+            std::cerr << "Wait was not timed out" << std::endl;
+            return -1;
+        }
+    }
+    // The signaler can only take the lock once this thread waits
+    int tid = uthread_create(thread_stats_signaler, nullptr);
+    while (!signaled_t19) {
+        cond_t19.wait(lock_t19);
+    }
+    lock_t19.unlock();
+    if (tid == -1 || uthread_join(tid, nullptr) != 0) {
+        std::cerr << "uthread_join" << std::endl;
+        return -1;
+    }
+    if (uthread_get_lock_stats("cond_t19", &counters) != 0) {
+        perror("uthread_get_lock_stats");
+        return -1;
+    }
+    if (counters.acquisitions != NUM_TIMEOUTS_T19 + 1 ||
+        counters.contended != NUM_TIMEOUTS_T19) {
+        std::cerr << "Wrong condition variable counts: " << counters.acquisitions << " waits, "
+                  << counters.contended << " timed out" << std::endl;
+        return -1;
+    }
+    if (uthread_get_lock_stats("no such lock", &counters) != -1 || errno != ENOENT) {
+        std::cerr << "Stats reported for an unknown name" << std::endl;
+        return -1;
+    }
+    uthread_dump_lock_stats();
+    return 0;
+#endif
+}
+
+/* ====== Test 20: Deadlock Detection ====== */
+
+#ifdef DEADLOCK_DETECT
+static Lock lock_a_t20("lock_a_t20");
+static Lock lock_b_t20("lock_b_t20");
+static CondVar cond_t20("cond_t20");
+static std::atomic<bool> holding_t20(false);
+
+// Hold lock_a_t20 while waiting on cond_t20 (which releases lock_b_t20)
+void *thread_wait_holding_lock(void *args) {
+    (void) args;
+    lock_a_t20.lock();
+    lock_b_t20.lock();
+    holding_t20 = true;
+    cond_t20.wait(lock_b_t20);
+    lock_b_t20.unlock();
+    lock_a_t20.unlock();
+    return nullptr;
+}
+
+// The waiter is signaled, so it waits to reacquire lock_b_t20 (held by this
+// thread) while this thread waits for lock_a_t20 (held by the waiter)
+static void signaled_cycle_t20() {
+    uthread_create(thread_wait_holding_lock, nullptr);
+    while (!holding_t20) {
+        uthread_yield();
+    }
+    // Handed lock_b_t20 once the waiter waits
+    lock_b_t20.lock();
+    cond_t20.signal();
+    lock_a_t20.lock();
+}
+
+// The waiter is never signaled and this thread waits for lock_a_t20, so no
+// thread can run again
+static void all_blocked_t20() {
+    uthread_create(thread_wait_holding_lock, nullptr);
+    while (!holding_t20) {
+        uthread_yield();
+    }
+    lock_a_t20.lock();
+}
+
+// Run scenario in a child process and collect what it prints to stderr
+// Output:
+// - 0 if the child aborted, -1 otherwise
+static int run_deadlock_child(void (*scenario)(), std::string &report) {
+    int fds[2];
+    if (pipe(fds) == -1) {
+        perror("pipe");
+        return -1;
+    }
+    // Keep buffered output from being written by both processes
+    std::cout.flush();
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[1]);
+        scenario();
+        // Not detected
+        _exit(0);
+    }
+    close(fds[1]);
+    char buffer[BUFSIZ];
+    ssize_t nbytes;
+    while ((nbytes = read(fds[0], buffer, sizeof(buffer))) != 0) {
+        if (nbytes > 0) {
+            report.append(buffer, nbytes);
+        } else if (errno != EINTR) {
+            perror("read");
+            break;
+        }
+    }
+    close(fds[0]);
+    int status;
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            perror("waitpid");
+            return -1;
+        }
+    }
+    if (!WIFSIGNALED(status) || WTERMSIG(status) != SIGABRT) {
+        std::cerr << "Deadlock was not reported, child exit status " << status << std::endl;
+        return -1;
+    }
+    return 0;
+}
+#endif    // DEADLOCK_DETECT
+
+// Tests that a lock cycle through a signaled condition variable waiter and a
+// process with every thread blocked are reported (only built with
+// DEADLOCK_DETECT)
+int test_deadlock() {
+    display_test("Starting deadlock detection test...");
+#ifndef DEADLOCK_DETECT
+    std::cout << "Built without DEADLOCK_DETECT, nothing to detect" << std::endl;
+    return 0;
+#else
+    std::string report;
+    if (run_deadlock_child(signaled_cycle_t20, report) != 0) {
+        return -1;
+    }
+    if (report.find("deadlock detected:\n") == std::string::npos ||
+        report.find("waits for lock \"lock_a_t20\" held by thread") == std::string::npos ||
+        report.find("waits for lock \"lock_b_t20\" held by thread") == std::string::npos) {
+        std::cerr << "Wrong cycle report:\n" << report << std::endl;
+        return -1;
+    }
+    report.clear();
+    if (run_deadlock_child(all_blocked_t20, report) != 0) {
+        return -1;
+    }
+    if (report.find("every thread is blocked with no pending timers") == std::string::npos ||
+        report.find("thread 0 waits for lock \"lock_a_t20\" held by thread") ==
+            std::string::npos) {
+        std::cerr << "Wrong all blocked report:\n" << report << std::endl;
+        return -1;
+    }
+    return 0;
+#endif
+}
+
+/* ====== Test 21: Wait Queue Tag ====== */
+
+#define NUM_NODES_T21 3
+
+// Returns 0 if queue holds nodes[first..NUM_NODES_T21) in order and its tag is
+// tag
+static int check_queue_t21(const WaitQueue &queue, WaitNode *nodes, int first, bool tag) {
+    if (queue.tag() != tag) {
+        std::cerr << "Tag lost, expected " << tag << std::endl;
+        return -1;
+    }
+    if (queue.empty() != (first == NUM_NODES_T21)) {
+        std::cerr << "Wrong emptiness" << std::endl;
+        return -1;
+    }
+    if (queue.empty()) {
+        return 0;
+    }
+    WaitNode *node = queue.front();
+    for (int i = first; i < NUM_NODES_T21; i++, node = node->next) {
+        if (node != &nodes[i] || node->queue != &queue) {
+            std::cerr << "Wrong node at position " << i - first << std::endl;
+            return -1;
+        }
+    }
+    if (node != queue.front()) {
+        std::cerr << "List is not circular" << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+// Tests that the tag bit (Lock's held flag and barging policy) survives every
+// queue operation and never corrupts the head pointer
+int test_wait_queue_tag() {
+    display_test("Starting wait queue tag test...");
+    WaitNode nodes[NUM_NODES_T21];
+    for (int tag = 0; tag <= 1; tag++) {
+        WaitQueue queue;
+        if (check_queue_t21(queue, nodes, NUM_NODES_T21, false) != 0) {
+            return -1;
+        }
+        queue.set_tag(tag);
+        if (check_queue_t21(queue, nodes, NUM_NODES_T21, tag) != 0) {
+            return -1;
+        }
+        // Push the last node to the front to cover both ends
+        for (int i = 0; i < NUM_NODES_T21 - 1; i++) {
+            queue.push(&nodes[i]);
+        }
+        queue.push_front(&nodes[NUM_NODES_T21 - 1]);
+        queue.remove(&nodes[NUM_NODES_T21 - 1]);
+        queue.push(&nodes[NUM_NODES_T21 - 1]);
+        if (check_queue_t21(queue, nodes, 0, tag) != 0) {
+            return -1;
+        }
+        // Flip the tag with waiters queued, like a Lock changing hands
+        queue.set_tag(!tag);
+        if (check_queue_t21(queue, nodes, 0, !tag) != 0) {
+            return -1;
+        }
+        queue.set_tag(tag);
+        for (int i = 0; i < NUM_NODES_T21; i++) {
+            if (queue.pop() != &nodes[i] || nodes[i].queue != nullptr) {
+                std::cerr << "Wrong node popped" << std::endl;
+                return -1;
+            }
+            if (check_queue_t21(queue, nodes, i + 1, tag) != 0) {
+                return -1;
+            }
+        }
+        if (queue.pop() != nullptr) {
+            std::cerr << "Node popped from an empty queue" << std::endl;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* ====== Test 22: HTTP Parser ====== */
+
+// Request header and what parsing it must give
+struct ParseCase {
+    const char *request;
+    HttpParseStatus status;
+    int error;                // HTTP status of a failed request
+    const char *method;       // Only checked for parsed requests
+    const char *path;
+    int minor_version;
+    int num_headers;
+    const char *host;         // Value of the Host field, nullptr if absent
+};
+
+static const ParseCase parse_cases[] = {
+    { "GET /index.html HTTP/1.1\r\nHost: localhost\r\nAccept: */*\r\n\r\n", HTTP_PARSE_DONE, 0,
+      "GET", "/index.html", 1, 2, "localhost" },
+    // Bare LFs, leading empty lines, value whitespace and field name case
+    { "\r\n\nHEAD /a?b=c HTTP/1.0\nhOsT: \t example.com \t\n\n", HTTP_PARSE_DONE, 0, "HEAD",
+      "/a?b=c", 0, 1, "example.com" },
+    { "GET / HTTP/1.1\r\nEmpty:\r\nHost: h\r\n\r\n", HTTP_PARSE_DONE, 0, "GET", "/", 1, 2, "h" },
+    { "GET / HTTP/1.1\r\nHost: h\r\n", HTTP_PARSE_INCOMPLETE, 0, nullptr, nullptr, 0, 0, nullptr },
+    { "GET / HTTP/2.0\r\n\r\n", HTTP_PARSE_ERROR, 505, nullptr, nullptr, 0, 0, nullptr },
+    { "GET / HTTP/1.10\r\n\r\n", HTTP_PARSE_ERROR, 400, nullptr, nullptr, 0, 0, nullptr },
+    { "GET /\r\n\r\n", HTTP_PARSE_ERROR, 400, nullptr, nullptr, 0, 0, nullptr },
+    { "G(T / HTTP/1.1\r\n\r\n", HTTP_PARSE_ERROR, 400, nullptr, nullptr, 0, 0, nullptr },
+    { "GET  / HTTP/1.1\r\n\r\n", HTTP_PARSE_ERROR, 400, nullptr, nullptr, 0, 0, nullptr },
+    { "GET / HTTP/1.1\r\nHost : h\r\n\r\n", HTTP_PARSE_ERROR, 400, nullptr, nullptr, 0, 0,
+      nullptr },
+    { "GET / HTTP/1.1\r\nNo colon\r\n\r\n", HTTP_PARSE_ERROR, 400, nullptr, nullptr, 0, 0,
+      nullptr },
+    // Control characters past the first 16 bytes (found by the SIMD scan)
+    { "GET / HTTP/1.1\r\nUser-Agent: abcdefghijklmnop\x01qrstuvwxyz\r\n\r\n", HTTP_PARSE_ERROR,
+      400, nullptr, nullptr, 0, 0, nullptr },
+    { "GET / HTTP/1.1\r\nUser-Agent: abcdefghijklmnopqrstuvwxyz\x7f\r\n\r\n", HTTP_PARSE_ERROR,
+      400, nullptr, nullptr, 0, 0, nullptr },
+};
+
+#define NUM_PARSE_CASES (int) (sizeof(parse_cases) / sizeof(parse_cases[0]))
+
+// Parse len bytes of request, piece bytes more per call (as if they arrived in
+// several reads)
+static HttpParseStatus parse_in_pieces(HttpParser *parser, const char *request, size_t len,
+                                       size_t piece) {
+    http_parser_init(parser);
+    HttpParseStatus status = HTTP_PARSE_INCOMPLETE;
+    for (size_t available = piece; status == HTTP_PARSE_INCOMPLETE; available += piece) {
+        status = http_parse(parser, request, available < len ? available : len);
+        if (available >= len) {
+            break;
+        }
+    }
+    return status;
+}
+
+// Returns 0 if parsing the request of test case i gives what it expects
+static int check_parse_case(int i, const HttpParser &parser, HttpParseStatus status, size_t len) {
+    const ParseCase &test = parse_cases[i];
+    const HttpRequest &request = parser.request;
+    if (status != test.status || (status == HTTP_PARSE_ERROR && parser.error != test.error)) {
+        std::cerr << "Parse case " << i << ": status " << status << " error " << parser.error
+                  << std::endl;
+        return -1;
+    }
+    if (status != HTTP_PARSE_DONE) {
+        return 0;
+    }
+    const HttpView *host = http_find_header(&request, "Host");
+    if (!http_view_equals(request.method, test.method) ||
+        !http_view_equals(request.path, test.path) ||
+        request.minor_version != test.minor_version || request.num_headers != test.num_headers ||
+        request.length != len || (host == nullptr) != (test.host == nullptr) ||
+        (host != nullptr && !http_view_equals(*host, test.host))) {
+        std::cerr << "Parse case " << i << ": wrong request" << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+// Returns 0 if a request line or header of size bytes fails with error
+static int check_parse_limit(size_t line_size, int num_headers, int error) {
+    static char request[2 * HTTP_MAX_REQUEST_SIZE];
+    std::string text = "GET /" + std::string(line_size, 'a') + " HTTP/1.1\r\n";
+    for (int i = 0; i < num_headers; i++) {
+        text += "X-Header: " + std::to_string(i) + "\r\n";
+    }
+    text += "\r\n";
+    size_t len = text.size() < sizeof(request) ? text.size() : sizeof(request);
+    memcpy(request, text.data(), len);
+    HttpParser parser;
+    http_parser_init(&parser);
+    if (http_parse(&parser, request, len) != (error != 0 ? HTTP_PARSE_ERROR : HTTP_PARSE_DONE) ||
+        parser.error != error) {
+        std::cerr << "Request of a " << line_size << " byte target and " << num_headers
+                  << " headers: error " << parser.error << " instead of " << error << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+// Tests the request parser (whole and split across reads, size limits and
+// the SIMD line scan)
+int test_http_parser() {
+    display_test("Starting HTTP parser test...");
+    HttpParser parser;
+    for (int i = 0; i < NUM_PARSE_CASES; i++) {
+        const char *request = parse_cases[i].request;
+        size_t len = strlen(request);
+        // Whole, then split at every possible size
+        for (size_t piece = len; piece > 0; piece--) {
+            HttpParseStatus status = parse_in_pieces(&parser, request, len, piece);
+            if (check_parse_case(i, parser, status, len) != 0) {
+                std::cerr << "(parsed " << piece << " bytes at a time)" << std::endl;
+                return -1;
+            }
+        }
+    }
+    // Bytes after the blank line belong to the next request
+    const char *pipelined = "GET /1 HTTP/1.1\r\n\r\nGET /2 HTTP/1.1\r\n\r\n";
+    http_parser_init(&parser);
+    if (http_parse(&parser, pipelined, strlen(pipelined)) != HTTP_PARSE_DONE ||
+        parser.request.length != strlen(pipelined) / 2 ||
+        !http_view_equals(parser.request.path, "/1")) {
+        std::cerr << "Pipelined request was not parsed on its own" << std::endl;
+        return -1;
+    }
+    // Limits: the request line, the whole header and the number of fields
+    if (check_parse_limit(HTTP_MAX_REQUEST_LINE - 32, 0, 0) != 0 ||
+        check_parse_limit(HTTP_MAX_REQUEST_LINE, 0, 414) != 0 ||
+        check_parse_limit(HTTP_MAX_REQUEST_SIZE, 0, 414) != 0 ||
+        check_parse_limit(0, HTTP_MAX_HEADERS, 0) != 0 ||
+        check_parse_limit(0, HTTP_MAX_HEADERS + 1, 431) != 0 ||
+        check_parse_limit(HTTP_MAX_REQUEST_LINE - 32, HTTP_MAX_HEADERS, 0) != 0) {
+        return -1;
+    }
+    static char large[HTTP_MAX_REQUEST_SIZE + 1];
+    std::string header = "GET / HTTP/1.1\r\nCookie: ";
+    memset(large, 'a', sizeof(large));
+    memcpy(large, header.data(), header.size());
+    http_parser_init(&parser);
+    if (http_parse(&parser, large, sizeof(large)) != HTTP_PARSE_ERROR || parser.error != 431) {
+        std::cerr << "Oversized header was not refused with 431" << std::endl;
+        return -1;
+    }
+    // The SIMD scan stops where the scalar one does, wherever the stop is. Tabs,
+    // carriage returns and bytes >= 0x80 do not stop it
+    const char allowed[] = "a\t\r\x80 ~\xff";
+    char line[64];
+    for (size_t len = 0; len <= sizeof(line); len++) {
+        for (size_t stop = 0; stop <= len; stop++) {
+            for (char c : { '\n', '\0', '\x1f', '\x7f' }) {
+                for (size_t k = 0; k < sizeof(line); k++) {
+                    line[k] = allowed[k % (sizeof(allowed) - 1)];
+                }
+                if (stop < len) {
+                    line[stop] = c;
+                }
+                if (http_scan(line, len) != http_scan_scalar(line, len) ||
+                    http_scan(line, len) != stop) {
+                    std::cerr << "Scan of " << len << " bytes missed " << stop << std::endl;
+                    return -1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/* ====== Test 23: HTTP Field Parsers ====== */
+
+// Range field value, resource size and the ranges to serve
+struct RangeCase {
+    const char *value;
+    size_t size;
+    int count;                           // Satisfiable ranges, -1 if ignored
+    HttpRange ranges[2];
+};
+
+static const RangeCase range_cases[] = {
+    { "bytes=0-499", 1000, 1, { { 0, 499 } } },
+    { "bytes=500-", 1000, 1, { { 500, 999 } } },
+    { "bytes=0-1999", 1000, 1, { { 0, 999 } } },
+    { "bytes=-200", 1000, 1, { { 800, 999 } } },
+    { "bytes=-2000", 1000, 1, { { 0, 999 } } },
+    { "Bytes= 0-0 ,, -1", 1000, 2, { { 0, 0 }, { 999, 999 } } },
+    { "bytes=1000-,2000-2001", 1000, 0, {} },
+    { "bytes=-0", 1000, 0, {} },
+    { "bytes=1000-,5-9", 1000, 1, { { 5, 9 } } },
+    { "bytes=5-3", 1000, -1, {} },
+    { "bytes=", 1000, -1, {} },
+    { "bytes=1-2;", 1000, -1, {} },
+    { "items=0-1", 1000, -1, {} },
+    { "bytes=0-1,2-3,4-5,6-7,8-9,10-11,12-13,14-15,16-17,18-19,20-21,22-23,24-25,26-27,28-29,"
+      "30-31,32-33",
+      1000, -1, {} },
+    { "bytes=0-18446744073709551616", 1000, -1, {} },
+};
+
+// If-None-Match field value and whether it matches the entity tag "abc"
+struct EtagCase {
+    const char *value;
+    bool matches;
+};
+
+static const EtagCase etag_cases[] = {
+    { "\"abc\"", true },        { "W/\"abc\"", true },   { "\"x\", W/\"abc\"", true },
+    { "*", true },              { "\"abcd\"", false },   { "\"ab\"", false },
+    { "abc", false },           { "", false },           { "\"x\" ,\"abc\"", true },
+    { "\"abc", false },
+};
+
+// Accept-Encoding field value and whether it accepts gzip
+struct CodingCase {
+    const char *value;
+    bool accepted;
+};
+
+static const CodingCase coding_cases[] = {
+    { "gzip", true },
+    { "deflate, GZIP;q=0.5", true },
+    { "gzip;q=0", false },
+    { "gzip ; q=0.000", false },
+    { "gzip;q=0.001", true },
+    { "*", true },
+    { "*;q=0", false },
+    { "*, gzip;q=0", false },
+    { "gzip;q=0, *", false },
+    { "identity", false },
+    { "", false },
+    { "gzipx, xgzip", false },
+};
+
+// HTTP-date and the time it stands for, -1 if invalid
+struct DateCase {
+    const char *value;
+    time_t time;
+};
+
+static const DateCase date_cases[] = {
+    { "Sun, 06 Nov 1994 08:49:37 GMT", 784111777 },
+    { "Sunday, 06-Nov-94 08:49:37 GMT", 784111777 },
+    { "Sun Nov  6 08:49:37 1994", 784111777 },
+    { "Sun, 06 Nov 1994 08:49:37", -1 },
+    { "Sun, 06 Nov 1994 08:49:37 GMT trailing", -1 },
+    { "yesterday", -1 },
+    { "", -1 },
+};
+
+#define NUM_CASES(cases) (int) (sizeof(cases) / sizeof(cases[0]))
+
+// Returns a view of a C string
+static HttpView view_of(const char *str) {
+    return HttpView{ str, strlen(str) };
+}
+
+// Tests the Range, If-None-Match, Accept-Encoding and date field parsers
+int test_http_fields() {
+    display_test("Starting HTTP field parsers test...");
+    HttpRange ranges[HTTP_MAX_RANGES];
+    for (int i = 0; i < NUM_CASES(range_cases); i++) {
+        const RangeCase &test = range_cases[i];
+        int count = http_parse_ranges(view_of(test.value), test.size, ranges);
+        bool same = count == test.count;
+        for (int j = 0; same && j < count; j++) {
+            same = ranges[j].first == test.ranges[j].first &&
+                   ranges[j].last == test.ranges[j].last;
+        }
+        if (!same) {
+            std::cerr << "Wrong ranges for \"" << test.value << "\" (" << count << ")" << std::endl;
+            return -1;
+        }
+    }
+    for (int i = 0; i < NUM_CASES(etag_cases); i++) {
+        // A weak validator compares like its strong form
+        for (const char *etag : { "\"abc\"", "W/\"abc\"" }) {
+            if (http_etag_matches(view_of(etag_cases[i].value), etag) != etag_cases[i].matches) {
+                std::cerr << "Wrong match of " << etag << " against \"" << etag_cases[i].value
+                          << "\"" << std::endl;
+                return -1;
+            }
+        }
+    }
+    for (int i = 0; i < NUM_CASES(coding_cases); i++) {
+        if (http_accepts_coding(view_of(coding_cases[i].value), "gzip") !=
+            coding_cases[i].accepted) {
+            std::cerr << "Wrong gzip acceptance for \"" << coding_cases[i].value << "\""
+                      << std::endl;
+            return -1;
+        }
+    }
+    char date[HTTP_DATE_SIZE];
+    for (int i = 0; i < NUM_CASES(date_cases); i++) {
+        time_t time = http_parse_date(view_of(date_cases[i].value));
+        if (time != date_cases[i].time) {
+            std::cerr << "Wrong time for \"" << date_cases[i].value << "\": " << time << std::endl;
+            return -1;
+        }
+        // Valid dates (all the same time) format as the IMF-fixdate case
+        if (time != -1) {
+            http_format_date(time, date);
+            if (http_parse_date(view_of(date)) != time || strcmp(date, date_cases[0].value) != 0) {
+                std::cerr << "Formatted date " << date << " does not round-trip" << std::endl;
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* ====== Test 24: Async Socket ====== */
+
+#define MESSAGE_SIZE_T24 64
+
+// async_accept() stops once the server clears this
+int keep_going = 1;
+
+static int sockets_t24[2];    // Connected pair, the test reads from [0]
+
+// Returns true once the reader took every byte sent so far
+static bool all_read_t24() {
+    int unread = 0;
+    return ioctl(sockets_t24[0], FIONREAD, &unread) == 0 && unread == 0;
+}
+
+// Send str, then wait for the reader to take it so the next send arrives in
+// a read of its own
+static int send_read_t24(const char *str) {
+    if (async_send(sockets_t24[1], str, strlen(str), 0) != (ssize_t) strlen(str)) {
+        perror("async_send");
+        return -1;
+    }
+    while (!all_read_t24()) {
+        uthread_yield();
+    }
+    return 0;
+}
+
+void *thread_socket_peer(void *args) {
+    (void) args;
+    // The delimiter is split across two reads, and the next message starts in
+    // the second one
+    if (send_read_t24("GET / HTTP/1.1\r\n") != 0 || send_read_t24("\r\nNEXT") != 0 ||
+        send_read_t24(" MSG\r\n\r\n") != 0) {
+        return (void *) -1;
+    }
+    // Two messages in one read, then the connection is closed
+    if (send_read_t24("A\r\n\r\nB\r\n\r\n") != 0) {
+        return (void *) -1;
+    }
+    close(sockets_t24[1]);
+    return nullptr;
+}
+
+// Receive the next message into buf and check it is expected. Bytes after it
+// are moved to the front of buf for the next call
+static int expect_message_t24(char *buf, size_t *buffered, const char *expected) {
+    ssize_t len = async_recv_until(sockets_t24[0], buf, MESSAGE_SIZE_T24, buffered, "\r\n\r\n");
+    if (len != (ssize_t) strlen(expected) || memcmp(buf, expected, len) != 0) {
+        std::cerr << "Received " << len << " bytes instead of \"" << expected << "\""
+                  << std::endl;
+        return -1;
+    }
+    *buffered -= len;
+    memmove(buf, buf + len, *buffered);
+    return 0;
+}
+
+// Returns a TCP socket bound to a free loopback port, stored in addr
+static int bind_loopback_t24(struct sockaddr_in *addr) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    socklen_t len = sizeof(*addr);
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd == -1 || bind(fd, (struct sockaddr *) addr, sizeof(*addr)) == -1 ||
+        getsockname(fd, (struct sockaddr *) addr, &len) == -1) {
+        perror("bind");
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+// Returns 0 if connecting a new socket to addr gives expected (0 or errno)
+static int check_connect_t24(const struct sockaddr_in *addr, int expected) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    int ret_val = async_connect(fd, (const struct sockaddr *) addr, sizeof(*addr));
+    int error = ret_val == 0 ? 0 : errno;
+    close(fd);
+    if (error != expected) {
+        std::cerr << "Connect gave " << strerror(error) << " instead of " << strerror(expected)
+                  << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+// Tests async_recv_until() (split delimiters, leftover bytes, a full buffer and
+// the peer closing) and async_connect()
+int test_async_socket() {
+    display_test("Starting async socket test...");
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets_t24) == -1) {
+        perror("socketpair");
+        return -1;
+    }
+    int tid = uthread_create(thread_socket_peer, nullptr);
+    char buf[MESSAGE_SIZE_T24];
+    size_t buffered = 0;
+    // The second message is complete in the leftover bytes, so it is returned
+    // before the close is seen
+    if (expect_message_t24(buf, &buffered, "GET / HTTP/1.1\r\n\r\n") != 0 ||
+        buffered != strlen("NEXT") || expect_message_t24(buf, &buffered, "NEXT MSG\r\n\r\n") != 0 ||
+        expect_message_t24(buf, &buffered, "A\r\n\r\n") != 0 ||
+        expect_message_t24(buf, &buffered, "B\r\n\r\n") != 0) {
+        return -1;
+    }
+    if (async_recv_until(sockets_t24[0], buf, sizeof(buf), &buffered, "\r\n\r\n") != 0) {
+        std::cerr << "Peer close was not reported" << std::endl;
+        return -1;
+    }
+    void *ret_val;
+    if (tid == -1 || uthread_join(tid, &ret_val) != 0 || ret_val != nullptr) {
+        std::cerr << "Peer thread failed" << std::endl;
+        return -1;
+    }
+    close(sockets_t24[0]);
+
+    // A message that does not fit fails once the buffer is full
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets_t24) == -1) {
+        perror("socketpair");
+        return -1;
+    }
+    const char *long_message = "0123456789\r\n\r\n";
+    buffered = 0;
+    if (async_send(sockets_t24[1], long_message, strlen(long_message), 0) == -1 ||
+        async_recv_until(sockets_t24[0], buf, 8, &buffered, "\r\n\r\n") != -1 ||
+        errno != EMSGSIZE || buffered != 8) {
+        std::cerr << "Full buffer did not fail with EMSGSIZE" << std::endl;
+        return -1;
+    }
+    close(sockets_t24[0]);
+    close(sockets_t24[1]);
+
+    // Connect to a listening socket, then to one that is bound but not
+    // listening
+    struct sockaddr_in addr;
+    int fd = bind_loopback_t24(&addr);
+    if (fd == -1) {
+        return -1;
+    }
+    if (check_connect_t24(&addr, ECONNREFUSED) != 0) {
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, 1) == -1) {
+        perror("listen");
+        close(fd);
+        return -1;
+    }
+    int ret_val2 = check_connect_t24(&addr, 0);
+    close(fd);
+    return ret_val2;
+}
+
+/* ======= Main ====== */
+
+int main(int argc, char *argv[]) {
+    if (argc != 3 && argc != 4) {
+        std::cerr << "Usage: ./test <testnum> <quantum_usecs>" << std::endl;
+        std::cerr << "Usage: ./test <testnum> <quantum_usecs> <seed>" << std::endl;
+        exit(1);
+    }
+
+    const int testnum = atoi(argv[1]);
+    const int quantum_usecs = atoi(argv[2]);
+    const int seed = (argc == 4 ? atoi(argv[3]) : SEED);
+    const bool test_all = (testnum <= 0 ? true : false);
+
+    // Initialize uthread library
+    if (uthread_init(quantum_usecs) != 0) {
+        std::cerr << "uthread_init" << std::endl;
+        exit(1);
+    }
+
+    srand(seed);
+
+    // Run tests
+    if (test_all || testnum == MUTEX_LOCK) {
+        if (test_mutex_lock() != 0) {
+            std::cerr << "Mutex lock test failed!" << std::endl;
+            exit(1);
+        }
+        std::cout << "Mutex lock test passed!" << std::endl;
+    }
+    if (test_all || testnum == SPIN_LOCK) {
+        if (test_spin_lock() != 0) {
+            std::cerr << "Spinlock test failed!" << std::endl;
+            exit(1);
+        }
+        std::cout << "Spinlock test passed!" << std::endl;
+    }
+    if (test_all || testnum == COND_VAR) {
+        if (test_cond_var() != 0) {
+            std::cerr << "Condition variable test failed!" << std::endl;
+            exit(1);
+        }
+        std::cout << "Condition variable test passed!" << std::endl;
+    }
+    if (test_all || testnum == MULTI_COND_VAR) {
+        if (test_multi_cond_var() != 0) {
+            std::cerr << "Multiple condition variables test failed!" << std::endl;
+            exit(1);
+        }
+        std::cout << "Multiple condition variables test passed!" << std::endl;
+    }
+    if (test_all || testnum == ASYNC_IO) {
+        if (test_async_io() != 0) {
+            std::cerr << "Asynchronus I/O test failed!" << std::endl;
+            exit(1);
+        }
+        std::cout << "Asynchronus I/O test passed!" << std::endl;
+    }
+    if (test_all || testnum == TIMED_COND_VAR) {
+        if (test_timed_cond_var() != 0) {
+            std::cerr << "Timed condition variable test failed!" << std::endl;
+            exit(1);
+        }
+        std::cout << "Timed condition variable test passed!" << std::endl;
+    }
+    if (test_all || testnum == CHANNEL) {
+        if (test_channel() != 0) {
+            std::cerr << "Channel test failed!" << std::endl;
+            exit(1);
+        }
+        std::cout << "Channel test passed!" << std::endl;
+    }
+    if (test_all || testnum == BARGING_LOCK) {
+        if (test_barging_lock() != 0) {
+            std::cerr << "Barging lock test failed!" << std::endl;
+            exit(1);
+        }
+        std::cout << "Barging lock test passed!" << std::endl;
+    }
+    if (test_all || testnum == COMBINER) {
+        if (test_combiner() != 0) {
+            std::cerr << "Combiner test failed!" << std::endl;
+            exit(1);
+        }
+        std::cout << "Combiner test passed!" << std::endl;
+    }
+    if (test_all || testnum == SEQ_LOCK) {
+        if (test_seq_lock() != 0) {
+            std::cerr << "Seqlock test failed!" << std::endl;
+            exit(1);
+        }
+        std::cout << "Seqlock test passed!" << std::endl;
+    }
+    if (test_all || testnum == RCU) {
+        if (test_rcu() != 0) {
+            std::cerr << "RCU test failed!" << std::endl;
+            exit(1);
+        }
+        std::cout << "RCU test passed!" << std::endl;
+    }
+    if (test_all || testnum == IO_BATCH) {
+        if (test_io_batch() != 0) {
+            std::cerr << "I/O batch test failed!" << std::endl;
+            exit(1);
+        }
+        std::cout << "I/O batch test passed!" << std::endl;
+    }
+    if (test_all || testnum == LARGE_FILE_IO) {
+        if (test_large_file_io() != 0) {
+            std::cerr << "Large file I/O test failed!" << std::endl;
+            exit(1);
+        }
+        std::cout << "Large file I/O test passed!" << std::endl;
+    }
+    if (test_all || testnum == ASYNC_SYSCALL) {
+        if (test_async_syscall() != 0) {
+            std::cerr << "Async syscall test failed!" << std::endl;
+            exit(1);
+        }
+        std::cout << "Async syscall test passed!" << std::endl;
+    }
+    if (test_all || testnum == SENDFILE) {
+        if (test_sendfile() != 0) {
+            std::cerr << "Sendfile test failed!" << std::endl;
+            exit(1);
+        }
+        std::cout << "Sendfile test passed!" << std::endl;
+    }
+    if (test_all || testnum == IO_CANCEL) {
+        if (test_io_cancel() != 0) {
+            std::cerr << "I/O cancellation test failed!" << std::endl;
+            exit(1);
+        }
+        std::cout << "I/O cancellation test passed!" << std::endl;
+    }
+    if (test_all || testnum == IO_STATS_TEST) {
+        if (test_io_stats() != 0) {
+            std::cerr << "I/O stats test failed!" << std::endl;
+            exit(1);
+        }
+        std::cout << "I/O stats test passed!" << std::endl;
+    }
+    if (test_all || testnum == FILE_WRITER) {
+        if (test_file_writer() != 0) {
+            std::cerr << "AsyncFileWriter test failed!" << std::endl;
+            exit(1);
+        }
+        std::cout << "AsyncFileWriter test passed!" << std::endl;
+    }
+    if (test_all || testnum == LOCK_STATS_TEST) {
+        if (test_lock_stats() != 0) {
+            std::cerr << "Lock stats test failed!" << std::endl;
+            exit(1);
+        }
+        std::cout << "Lock stats test passed!" << std::endl;
+    }
+    if (test_all || testnum == DEADLOCK) {
+        if (test_deadlock() != 0) {
+            std::cerr << "Deadlock detection test failed!" << std::endl;
+            exit(1);
+        }
+        std::cout << "Deadlock detection test passed!" << std::endl;
+    }
+    if (test_all || testnum == WAIT_QUEUE_TAG) {
+        if (test_wait_queue_tag() != 0) {
+            std::cerr << "Wait queue tag test failed!" << std::endl;
+            exit(1);
+        }
+        std::cout << "Wait queue tag test passed!" << std::endl;
+    }
+    if (test_all || testnum == HTTP_PARSER) {
+        if (test_http_parser() != 0) {
+            std::cerr << "HTTP parser test failed!" << std::endl;
+            exit(1);
+        }
+        std::cout << "HTTP parser test passed!" << std::endl;
+    }
+    if (test_all || testnum == HTTP_FIELDS) {
+        if (test_http_fields() != 0) {
+            std::cerr << "HTTP field parsers test failed!" << std::endl;
+            exit(1);
+        }
+        std::cout << "HTTP field parsers test passed!" << std::endl;
+    }
+    if (test_all || testnum == ASYNC_SOCKET) {
+        if (test_async_socket() != 0) {
+            std::cerr << "Async socket test failed!" << std::endl;
+            exit(1);
+        }
+        std::cout << "Async socket test passed!" << std::endl;
     }
     std::cout << "============================================================" << std::endl;
     std::cout << "All executed tests passed!" << std::endl;
@@ -0,0 +1,123 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+
+#include "../lib/AsyncFileWriter.h"
+#include "../lib/async_io.h"
+#include "../lib/uthread.h"
+
+#define RECORD_SIZE 64    // Bytes per append (e.g. one log line)
+
+struct ThreadArgs {
+    int fd;
+    int n_appends;
+    AsyncFileWriter *writer;    // nullptr for raw async_pwrite()
+};
+
+std::atomic<off_t> next_offset;
+std::atomic<long> failed_appends;
+
+// Fill a record with the thread's id and a sequence number
+void make_record(char *record, int tid, int seq) {
+    int len = snprintf(record, RECORD_SIZE, "thread %3d record %8d ", tid, seq);
+    for (int i = len; i < RECORD_SIZE - 1; i++) {
+        record[i] = '.';
+    }
+    record[RECORD_SIZE - 1] = '\n';
+}
+
+void *appender(void *args) {
+    ThreadArgs *params = (ThreadArgs *) args;
+    char record[RECORD_SIZE];
+    for (int i = 0; i < params->n_appends; i++) {
+        make_record(record, uthread_self(), i);
+        if (params->writer != nullptr) {
+            if (params->writer->append(record, RECORD_SIZE) == -1) {
+                failed_appends++;
+            }
+        } else {
+            // Reserve the range, so concurrent appends do not overwrite each other
+            off_t offset = next_offset.fetch_add(RECORD_SIZE);
+            if (async_pwrite(params->fd, record, RECORD_SIZE, offset) != RECORD_SIZE) {
+                failed_appends++;
+            }
+        }
+    }
+    return nullptr;
+}
+
+void run_test(bool use_writer, int nthreads, int nappends) {
+    char path[] = "/tmp/writer_performance_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        exit(1);
+    }
+    unlink(path);
+    next_offset = 0;
+    failed_appends = 0;
+    // Start timer
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    AsyncFileWriter *writer = use_writer ? new AsyncFileWriter(fd) : nullptr;
+    ThreadArgs args = { .fd = fd, .n_appends = nappends, .writer = writer };
+    int *tids = (int *) malloc(sizeof(int) * nthreads);
+    for (int i = 0; i < nthreads; ++i) {
+        tids[i] = uthread_create(appender, &args);
+        if (tids[i] == -1) {
+            std::cerr << "uthread_create\n";
+        }
+    }
+
+    for (int i = 0; i < nthreads; ++i) {
+        if (uthread_join(tids[i], nullptr) != 0) {
+            std::cerr << "uthread_join\n";
+        }
+    }
+    // The appends only count once they reached the file
+    if (writer != nullptr && writer->close() == -1) {
+        perror("AsyncFileWriter::close");
+    }
+
+    // Stop timer
+    auto end_time = std::chrono::high_resolution_clock::now();
+    double duration = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+
+    off_t size = lseek(fd, 0, SEEK_END);
+    bool complete = failed_appends == 0 && size == (off_t) nthreads * nappends * RECORD_SIZE;
+    long total = (long) nthreads * nappends;
+    std::cout << (use_writer ? "AsyncFileWriter" : "async_pwrite   ") << " " << total
+              << " appends in " << duration << " ms (" << total / duration * 1000
+              << " appends/s, " << (complete ? "complete" : "MISSING DATA") << ")" << std::endl;
+
+    delete writer;
+    free(tids);
+    close(fd);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 4) {
+        std::cerr << "Usage: ./writerperformance <nthreads> <nappends> <quantum>\n";
+        exit(1);
+    }
+
+    const int max_threads = atoi(argv[1]);
+    const int num_appends = atoi(argv[2]);
+
+    // Initialize thread library
+    uthread_init(atoi(argv[3]));
+
+    // Double the number of appenders each round
+    for (int nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+        std::cout << "==================== " << nthreads << " Appenders ====================\n";
+        run_test(false, nthreads, num_appends);
+        run_test(true, nthreads, num_appends);
+    }
+
+    uthread_exit(nullptr);
+    return 0;
+}